@@ -0,0 +1,113 @@
+#pragma once
+#include <chrono>
+#include <memory>
+#include <q3.h>
+#include <stdio.h>
+
+// Headless scene wiring, the same as the demo App does it, so benchmarks
+// drive the engine through the public callbacks.
+struct BenchWorld {
+  q3Env env;
+  std::unique_ptr<q3Scene> scene;
+  std::unique_ptr<q3BroadPhase> broadPhase;
+  std::unique_ptr<q3ContactManager> contactManager;
+  // Fat AABB margin of the boxes added from now on
+  float aabbMargin = 0.5f;
+  // Islands are solved on this pool when set
+  q3ThreadPool *islandPool = nullptr;
+
+  BenchWorld(q3BroadPhaseType type = eAABBTreeBroadPhase) {
+    scene.reset(new q3Scene);
+    broadPhase.reset(new q3BroadPhase(type));
+    contactManager.reset(new q3ContactManager);
+    scene->OnBodyAdd = [](q3Body *body) {};
+    scene->OnBodyRemove = [contactManager =
+                               contactManager.get()](q3Body *body) {
+      contactManager->RemoveContactsFromBody(body);
+    };
+    scene->OnBodyTransformUpdated = [broadphase =
+                                         broadPhase.get()](q3Body *body) {
+      broadphase->SynchronizeProxies(body);
+    };
+    scene->OnTransformsUpdated =
+        [broadphase = broadPhase.get()](std::span<q3Body *const> bodies) {
+          broadphase->SynchronizeProxies(bodies);
+        };
+    scene->OnBoxAdd = [broadphase = broadPhase.get()](q3Body *body,
+                                                      q3Shape *box) {
+      broadphase->InsertBox(body, box, box->ComputeAABB(body->Transform()));
+    };
+    scene->OnBoxRemove =
+        [broadphase = broadPhase.get(),
+         contactManager = contactManager.get()](q3Body *body,
+                                                const q3Shape *box) {
+          contactManager->ForEachContact(
+              body, [&](q3ContactHandle handle,
+                        const q3ContactConstraint &contact, q3Body *) {
+                if (box == contact.A || box == contact.B) {
+                  contactManager->RemoveContact(handle);
+                }
+              });
+          broadphase->RemoveBox(box);
+        };
+  }
+
+  ~BenchWorld() {
+    // Bodies must go before the broadphase and contact manager
+    scene.reset();
+  }
+
+  q3Body *AddBox(const q3Vec3 &position, q3BodyType type,
+                 const q3Vec3 &e = q3Vec3{0.5f, 0.5f, 0.5f}) {
+    auto body = scene->CreateBody({
+        .position = position,
+        .bodyType = type,
+    });
+    scene->AddBox(body, {
+                            .m_tx = {},
+                            .m_e = e,
+                            .m_restitution = 0,
+                            .m_aabbMargin = aabbMargin,
+                        });
+    return body;
+  }
+
+  void Step() {
+    q3TimeStep(env, scene.get(), broadPhase.get(), contactManager.get(),
+               islandPool);
+  }
+};
+
+// Wall clock milliseconds spent in f
+template <typename F> double BenchMs(F &&f) {
+  auto begin = std::chrono::steady_clock::now();
+  f();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+void BenchStaticFloor();
+void BenchParallelPairs();
+void BenchBulkSync();
+void BenchSweepBox();
+void BenchNearest();
+void BenchTreeLayouts();
+void BenchTreeQuality();
+void BenchNodeLayout();
+void BenchQueryVisitor();
+void BenchSweepAndPrune();
+void BenchFatMargins();
+void BenchPairCache();
+void BenchDualTree();
+void BenchHashGrid();
+void BenchRayBatch();
+void BenchContactStorage();
+void BenchIslandBuild();
+void BenchParallelNarrowphase();
+void BenchContactEvents();
+void BenchBoxSat();
+void BenchSatCache();
+void BenchRoundShapes();
+void BenchCompound();
+void BenchWideSolver();
+void BenchParallelIslands();
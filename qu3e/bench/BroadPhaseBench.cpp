@@ -0,0 +1,457 @@
+#include "Bench.h"
+#include <algorithm>
+#include <q3ThreadPool.h>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+const int k_floorSide = 200;  // static boxes per floor edge
+const int k_dynamicSide = 45; // dynamic boxes per layer edge
+const int k_iterations = 20;
+
+// Dynamic boxes alternate between two heights that leave their fat AABB
+// every iteration, so each one is re-buffered and queries again.
+q3AABB JitteredAABB(const q3Body *body, const q3Shape *box, int iteration) {
+  q3Transform tx = body->Transform();
+  tx.position.y += (iteration & 1) ? 0.0f : 1.2f;
+  return box->ComputeAABB(tx);
+}
+
+// The previous layout: one tree holding every box, each moved proxy querying
+// the whole tree. Every inserted box, static or not, was buffered once.
+double SingleTreePairs(
+    const std::vector<std::tuple<q3Body *, q3Shape *>> &all,
+    const std::vector<int> &dynamics,
+    const std::function<void(q3Body *, q3Shape *, q3Body *, q3Shape *)>
+        &addPair,
+    double *loadMs, size_t *pairCount) {
+  q3DynamicAABBTree<int> tree;
+  std::vector<int> nodes;
+  std::vector<int> moveBuffer;
+  for (int i = 0; i < int(all.size()); ++i) {
+    auto [body, box] = all[i];
+    nodes.push_back(tree.Insert(box->ComputeAABB(body->Transform()), i));
+    moveBuffer.push_back(nodes.back());
+  }
+
+  std::vector<q3ContactPair> pairs;
+  auto updatePairs = [&] {
+      pairs.clear();
+      for (int current : moveBuffer) {
+        tree.QueryAABB(
+            [&](int index) {
+              if (index != current)
+                pairs.push_back({std::min(index, current),
+                                 std::max(index, current)});
+              return true;
+            },
+            tree.GetFatAABB(current));
+      }
+      std::sort(pairs.begin(), pairs.end(),
+                [](const q3ContactPair &l, const q3ContactPair &r) {
+                  return l.A < r.A || (l.A == r.A && l.B < r.B);
+                });
+      pairs.erase(std::unique(pairs.begin(), pairs.end(),
+                              [](const q3ContactPair &l,
+                                 const q3ContactPair &r) {
+                                return l.A == r.A && l.B == r.B;
+                              }),
+                  pairs.end());
+      for (auto pair : pairs) {
+        auto [bodyA, A] = all[tree.GetUserData(pair.A)];
+        auto [bodyB, B] = all[tree.GetUserData(pair.B)];
+        addPair(bodyA, A, bodyB, B);
+      }
+      tree.Validate();
+  };
+  *loadMs = BenchMs(updatePairs);
+
+  double ms = 0;
+  for (int it = 0; it < k_iterations; ++it) {
+    moveBuffer.clear();
+    for (int i : dynamics) {
+      auto [body, box] = all[i];
+      if (tree.Update(nodes[i], JitteredAABB(body, box, it)))
+        moveBuffer.push_back(nodes[i]);
+    }
+    ms += BenchMs(updatePairs);
+  }
+  *pairCount = pairs.size();
+  return ms;
+}
+
+} // namespace
+
+// Pair finding on a large static floor made of many boxes with a few
+// thousand dynamic boxes resting on it.
+void BenchStaticFloor() {
+  BenchWorld world;
+  std::vector<std::tuple<q3Body *, q3Shape *>> all;
+  std::vector<int> dynamics;
+
+  for (int i = 0; i < k_floorSide; ++i) {
+    for (int j = 0; j < k_floorSide; ++j) {
+      auto body = world.AddBox({float(i), 0.0f, float(j)}, eStaticBody);
+      all.push_back({body, *body->begin()});
+    }
+  }
+  for (int i = 0; i < k_dynamicSide; ++i) {
+    for (int j = 0; j < k_dynamicSide; ++j) {
+      auto body = world.AddBox(
+          {float(i) * 4.0f + 0.5f, 1.0f, float(j) * 4.0f + 0.5f},
+          eDynamicBody);
+      dynamics.push_back(int(all.size()));
+      all.push_back({body, *body->begin()});
+    }
+  }
+
+  size_t pairCount = 0;
+  auto count = [&pairCount](q3Body *, q3Shape *, q3Body *, q3Shape *) {
+    ++pairCount;
+  };
+
+  double singleLoad = 0;
+  size_t singlePairs = 0;
+  double single =
+      SingleTreePairs(all, dynamics, count, &singleLoad, &singlePairs);
+  pairCount = 0;
+  double splitLoad = BenchMs([&] { world.broadPhase->UpdatePairs(count); });
+  double split = 0;
+  for (int it = 0; it < k_iterations; ++it) {
+    for (int i : dynamics) {
+      auto [body, box] = all[i];
+      world.broadPhase->Update(box->BroadPhaseIndex(),
+                               JitteredAABB(body, box, it));
+    }
+    pairCount = 0;
+    split += BenchMs([&] { world.broadPhase->UpdatePairs(count); });
+  }
+  size_t splitPairs = pairCount;
+
+  printf("  %d static + %zu dynamic boxes, %d iterations\n",
+         k_floorSide * k_floorSide, dynamics.size(), k_iterations);
+  printf("  single tree      : load %8.2f ms, moved %8.2f ms (%zu pairs)\n",
+         singleLoad, single, singlePairs);
+  printf("  static + dynamic : load %8.2f ms, moved %8.2f ms (%zu pairs)\n",
+         splitLoad, split, splitPairs);
+}
+
+// A wake-up of thousands of packed bodies: every dynamic proxy is in the
+// move buffer. Serial UpdatePairs, which descends the trees together, against
+// the same scene with a thread pool, which spreads one query per moved proxy
+// over its threads. Both must report the same begins and ends and hold the
+// same pairs afterwards.
+void BenchParallelPairs() {
+  const int k_side = 30;
+  const int k_layers = 10;
+
+  struct Run {
+    BenchWorld world;
+    std::vector<std::tuple<q3Body *, q3Shape *>> boxes;
+    // Boxes by insertion order, so the runs can be compared
+    std::unordered_map<const q3Shape *, int> index;
+    std::vector<std::pair<int, int>> begun;
+    std::vector<std::pair<int, int>> ended;
+    std::set<std::pair<int, int>> pairs;
+    double ms = 0;
+  };
+  auto setup = [&](Run &run) {
+    q3Body *floor = run.world.AddBox({0.0f, 0.0f, 0.0f}, eStaticBody,
+                                     q3Vec3{50.0f, 0.5f, 50.0f});
+    run.index[*floor->begin()] = -1;
+    for (int i = 0; i < k_layers; ++i) {
+      for (int j = 0; j < k_side; ++j) {
+        for (int k = 0; k < k_side; ++k) {
+          auto body = run.world.AddBox(
+              {float(j) - k_side / 2, 1.0f + float(i), float(k) - k_side / 2},
+              eDynamicBody);
+          run.index[*body->begin()] = int(run.boxes.size());
+          run.boxes.push_back({body, *body->begin()});
+        }
+      }
+    }
+  };
+  auto updatePairs = [](Run &run, int it) {
+    for (auto [body, box] : run.boxes)
+      run.world.broadPhase->Update(box->BroadPhaseIndex(),
+                                   JitteredAABB(body, box, it));
+    using Reported = std::vector<std::pair<const q3Shape *, const q3Shape *>>;
+    Reported begun;
+    Reported ended;
+    run.ms += BenchMs([&] {
+      run.world.broadPhase->UpdatePairs(
+          [&](q3Body *, q3Shape *A, q3Body *, q3Shape *B) {
+            begun.push_back({A, B});
+          },
+          [&](q3Body *, q3Shape *A, q3Body *, q3Shape *B) {
+            ended.push_back({A, B});
+          });
+    });
+    auto indices = [&run](const Reported &reported,
+                          std::vector<std::pair<int, int>> &out) {
+      out.clear();
+      for (auto [A, B] : reported)
+        out.push_back({run.index.at(A), run.index.at(B)});
+    };
+    indices(begun, run.begun);
+    indices(ended, run.ended);
+    for (auto pair : run.ended)
+      run.pairs.erase(pair);
+    for (auto pair : run.begun)
+      run.pairs.insert(pair);
+  };
+
+  Run serial;
+  Run parallel;
+  setup(serial);
+  setup(parallel);
+  // At least three workers, so the pool takes the per proxy queries even on
+  // small machines
+  q3ThreadPool pool(std::max(3, q3ThreadPool::DefaultWorkerCount()));
+  parallel.world.broadPhase->SetThreadPool(&pool);
+
+  bool same = true;
+  for (int it = 0; it < k_iterations; ++it) {
+    updatePairs(serial, it);
+    updatePairs(parallel, it);
+    same = same && serial.begun == parallel.begun &&
+           serial.ended == parallel.ended && serial.pairs == parallel.pairs;
+  }
+
+  printf("  %zu dynamic boxes all moved, %d iterations, %zu pairs, "
+         "%zu begun last\n",
+         serial.boxes.size(), k_iterations, serial.pairs.size(),
+         serial.begun.size());
+  printf("  serial, dual tree    : %8.2f ms\n", serial.ms);
+  printf("  %2d threads, per proxy: %8.2f ms (%s)\n", pool.ThreadCount(),
+         parallel.ms, same ? "same pairs, same order" : "MISMATCH");
+}
+
+// Thousands of awake bodies drifting every step with thin fat AABBs, so most
+// proxies leave theirs each step. Synchronized one body at a time, in bulk,
+// and in bulk with a thread pool.
+void BenchBulkSync() {
+  const int k_side = 64;
+  const int k_steps = 300;
+
+  struct Run {
+    const char *name;
+    bool bulk;
+    bool pool;
+  } runs[] = {{"per body", false, false},
+              {"bulk", true, false},
+              {"bulk + pool", true, true}};
+
+  q3ThreadPool pool;
+  printf("  %d bodies, %d steps\n", k_side * k_side, k_steps);
+  for (auto run : runs) {
+    srand(11);
+    BenchWorld world;
+    world.aabbMargin = 0.1f;
+    if (run.pool)
+      world.broadPhase->SetThreadPool(&pool);
+
+    std::vector<q3Body *> bodies;
+    for (int i = 0; i < k_side; ++i) {
+      for (int j = 0; j < k_side; ++j) {
+        auto body = world.AddBox(
+            {1.2f * (i - k_side / 2), 1.0f, 1.2f * (j - k_side / 2)},
+            eDynamicBody);
+        body->VelocityState().linearVelocity = {
+            q3RandomFloat(-4.0f, 4.0f), q3RandomFloat(-1.0f, 1.0f),
+            q3RandomFloat(-4.0f, 4.0f)};
+        bodies.push_back(body);
+      }
+    }
+    auto ignore = [](q3Body *, q3Shape *, q3Body *, q3Shape *) {};
+    world.broadPhase->UpdatePairs(ignore);
+    world.broadPhase->ResetStats();
+
+    double syncMs = 0.0;
+    double pairMs = 0.0;
+    for (int step = 0; step < k_steps; ++step) {
+      for (auto body : bodies)
+        body->ApplyVelocityState(world.env);
+
+      syncMs += BenchMs([&] {
+        if (run.bulk) {
+          world.broadPhase->SynchronizeProxies(bodies);
+        } else {
+          for (auto body : bodies)
+            world.broadPhase->SynchronizeProxies(body);
+        }
+      });
+      pairMs += BenchMs([&] { world.broadPhase->UpdatePairs(ignore); });
+    }
+
+    printf("    %-12s: sync %7.2f ms, pairs %7.2f ms, %d reinsertions, "
+           "tree cost %.1f\n",
+           run.name, syncMs, pairMs, world.broadPhase->Stats().reinsertions,
+           world.broadPhase->DynamicTreeCost());
+  }
+}
+
+// Small fast boxes cast across a floor scattered with thin walls, the way a
+// projectile system would. SweepBox against the old workaround of sampling
+// overlap queries along the path, which skips walls thinner than a step.
+void BenchSweepBox() {
+  const int k_tiles = 100;
+  const int k_walls = 500;
+  const int k_sweeps = 10000;
+  const int k_samples = 16;
+  const float k_length = 20.0f;
+  const q3Vec3 k_projectile = {0.1f, 0.1f, 0.1f};
+
+  srand(5);
+  BenchWorld world;
+  for (int i = 0; i < k_tiles; ++i) {
+    for (int j = 0; j < k_tiles; ++j)
+      world.AddBox({float(i), 0.0f, float(j)}, eStaticBody);
+  }
+  for (int i = 0; i < k_walls; ++i) {
+    q3Vec3 e = (i & 1) ? q3Vec3{2.0f, 1.5f, 0.02f} : q3Vec3{0.02f, 1.5f, 2.0f};
+    world.AddBox({q3RandomFloat(0.0f, k_tiles), 2.0f,
+                  q3RandomFloat(0.0f, k_tiles)},
+                 eStaticBody, e);
+  }
+  world.broadPhase->UpdatePairs(
+      [](q3Body *, q3Shape *, q3Body *, q3Shape *) {});
+
+  std::vector<q3SweepData> sweeps;
+  for (int i = 0; i < k_sweeps; ++i) {
+    q3Transform tx;
+    tx.position = {q3RandomFloat(0.0f, k_tiles), q3RandomFloat(0.7f, 3.0f),
+                   q3RandomFloat(0.0f, k_tiles)};
+    q3Vec3 dir = q3Vec3{q3RandomFloat(-1.0f, 1.0f), q3RandomFloat(-0.1f, 0.1f),
+                        q3RandomFloat(-1.0f, 1.0f)}
+                     .Normalized();
+    q3SweepData sweep;
+    sweep.Set(tx, k_projectile, dir, k_length);
+    sweeps.push_back(sweep);
+  }
+
+  int sweepHits = 0;
+  double sweepMs = BenchMs([&] {
+    for (auto sweep : sweeps) {
+      auto [body, box] = world.broadPhase->SweepBox(sweep);
+      if (box)
+        ++sweepHits;
+    }
+  });
+
+  // A zero length sweep is an exact overlap test
+  int sampledHits = 0;
+  double sampledMs = BenchMs([&] {
+    for (const auto &sweep : sweeps) {
+      bool hit = false;
+      for (int k = 0; k <= k_samples && !hit; ++k) {
+        q3SweepData at = sweep;
+        at.tx.position += sweep.dir * (k_length * k / k_samples);
+        at.t = 0.0f;
+        q3AABB aabb = {at.tx.position - k_projectile,
+                       at.tx.position + k_projectile};
+        world.broadPhase->QueryAABB(
+            [&](q3Body *body, q3Shape *box) {
+              q3SweepData test = at;
+              hit = box->Sweep(body->Transform(), &test);
+              return !hit;
+            },
+            aabb);
+      }
+      if (hit)
+        ++sampledHits;
+    }
+  });
+
+  printf("  %d sweeps of length %.0f over %d tiles and %d thin walls\n",
+         k_sweeps, k_length, k_tiles * k_tiles, k_walls);
+  printf("  SweepBox          : %8.2f ms, %5d hits\n", sweepMs, sweepHits);
+  printf("  %2d sampled AABBs  : %8.2f ms, %5d hits\n", k_samples + 1,
+         sampledMs, sampledHits);
+}
+
+// k nearest boxes around random points among scattered bodies, the way AI
+// perception would ask. The best first walk against one large QueryAABB
+// followed by a sort, at a radius that usually holds k boxes. Part of the
+// queries are checked against testing every box.
+void BenchNearest() {
+  const int k_boxes = 20000;
+  const int k_queries = 5000;
+  const int k_nearest = 8;
+  const float k_worldSize = 200.0f;
+  const float k_radius = 12.0f;
+  const int k_checked = 500;
+
+  srand(6);
+  BenchWorld world;
+  std::vector<std::tuple<q3Body *, q3Shape *>> all;
+  for (int i = 0; i < k_boxes; ++i) {
+    auto body = world.AddBox({q3RandomFloat(0.0f, k_worldSize),
+                              q3RandomFloat(0.0f, 20.0f),
+                              q3RandomFloat(0.0f, k_worldSize)},
+                             (i & 7) ? eDynamicBody : eStaticBody);
+    all.push_back({body, *body->begin()});
+  }
+  world.broadPhase->UpdatePairs(
+      [](q3Body *, q3Shape *, q3Body *, q3Shape *) {});
+
+  std::vector<q3Vec3> points;
+  for (int i = 0; i < k_queries; ++i) {
+    points.push_back({q3RandomFloat(0.0f, k_worldSize),
+                      q3RandomFloat(0.0f, 20.0f),
+                      q3RandomFloat(0.0f, k_worldSize)});
+  }
+
+  // Distances of the k-th nearest box per query, to compare the methods
+  std::vector<float> nearest(k_queries);
+  std::vector<q3NearestHit> hits;
+  double nearestMs = BenchMs([&] {
+    for (int i = 0; i < k_queries; ++i) {
+      world.broadPhase->QueryKNearest(points[i], k_nearest, hits);
+      nearest[i] = hits.back().distance;
+    }
+  });
+
+  int tooFew = 0;
+  std::vector<float> distances;
+  double sortMs = BenchMs([&] {
+    for (int i = 0; i < k_queries; ++i) {
+      q3Vec3 r = {k_radius, k_radius, k_radius};
+      distances.clear();
+      world.broadPhase->QueryAABB(
+          [&](q3Body *body, q3Shape *box) {
+            distances.push_back(box->Distance(body->Transform(), points[i]));
+            return true;
+          },
+          q3AABB{points[i] - r, points[i] + r});
+      if (distances.size() < k_nearest) {
+        ++tooFew;
+        continue;
+      }
+      std::sort(distances.begin(), distances.end());
+    }
+  });
+
+  int wrong = 0;
+  double bruteMs = BenchMs([&] {
+    for (int i = 0; i < k_checked; ++i) {
+      distances.clear();
+      for (auto [body, box] : all)
+        distances.push_back(box->Distance(body->Transform(), points[i]));
+      std::nth_element(distances.begin(), distances.begin() + k_nearest - 1,
+                       distances.end());
+      if (distances[k_nearest - 1] != nearest[i])
+        ++wrong;
+    }
+  });
+
+  printf("  %d boxes, %d queries for the %d nearest\n", k_boxes, k_queries,
+         k_nearest);
+  printf("  QueryKNearest         : %8.2f ms\n", nearestMs);
+  printf("  QueryAABB r=%.0f + sort : %8.2f ms (%d found fewer than %d)\n",
+         k_radius, sortMs, tooFew, k_nearest);
+  printf("  testing every box     : %8.2f ms for %d queries (%d differ)\n",
+         bruteMs, k_checked, wrong);
+}
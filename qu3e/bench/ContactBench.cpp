@@ -0,0 +1,673 @@
+#include "Bench.h"
+#include <dynamics/q3Island.h>
+#include <dynamics/q3Magnifold.h>
+#include <q3ThreadPool.h>
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <random>
+#include <set>
+#include <string.h>
+#include <vector>
+
+namespace {
+
+// Enough boxes in a packed pile for about 50k broadphase pairs
+const int k_side = 26;
+const int k_layers = 8;
+const int k_passes = 20;
+
+struct ContactKey {
+  q3Shape *A;
+  q3Body *bodyA;
+  q3Shape *B;
+  q3Body *bodyB;
+};
+
+// Narrowphase loop stand-in that only touches the constraint, so the walk
+// over the storage is what gets timed
+int Touch(q3ContactConstraint &c) {
+  c.RemoveFlag(q3ContactConstraintFlags::eIsland);
+  return c.manifold.contactCount +
+         c.HasFlag(q3ContactConstraintFlags::eColliding);
+}
+
+} // namespace
+
+// Contact storage with 50k live contacts: the list of shared_ptr with a
+// linear search per removal that q3ContactManager used before, against the
+// slot map. A quarter of the contacts, those of the top layers, are removed
+// as when the top of a pile collapses.
+void BenchContactStorage() {
+  BenchWorld world;
+  std::vector<q3Body *> bodies;
+  for (int i = 0; i < k_layers; ++i) {
+    for (int j = 0; j < k_side; ++j) {
+      for (int k = 0; k < k_side; ++k) {
+        bodies.push_back(world.AddBox({1.05f * (j - k_side / 2), 1.05f * i,
+                                       1.05f * (k - k_side / 2)},
+                                      eDynamicBody));
+      }
+    }
+  }
+  auto contacts = world.contactManager.get();
+  double loadMs = BenchMs([&] { world.Step(); });
+
+  std::vector<ContactKey> keys;
+  for (q3ContactConstraint &c : *contacts)
+    keys.push_back({c.A, c.bodyA, c.B, c.bodyB});
+
+  // Contacts of the top two layers, in creation order
+  float top = 1.05f * (k_layers - 2) - 0.5f;
+  std::vector<int> removed;
+  for (int i = 0; i < int(keys.size()); ++i) {
+    if (keys[i].bodyA->Transform().position.y > top ||
+        keys[i].bodyB->Transform().position.y > top)
+      removed.push_back(i);
+  }
+  std::shuffle(removed.begin(), removed.end(), std::mt19937(7));
+
+  printf("  %zu boxes, %zu contacts, first step %.2f ms\n", bodies.size(),
+         keys.size(), loadMs);
+
+  int sum = 0;
+  {
+    std::list<std::shared_ptr<q3ContactConstraint>> list;
+    std::vector<std::shared_ptr<q3ContactConstraint>> ptrs;
+    double createMs = BenchMs([&] {
+      for (const ContactKey &k : keys) {
+        list.push_back(std::make_shared<q3ContactConstraint>(k.A, k.bodyA,
+                                                             k.B, k.bodyB));
+        ptrs.push_back(list.back());
+      }
+    });
+    double iterateMs = BenchMs([&] {
+      for (int pass = 0; pass < k_passes; ++pass) {
+        for (auto &c : list)
+          sum += Touch(*c);
+      }
+    });
+    double removeMs = BenchMs([&] {
+      for (int i : removed)
+        list.erase(std::find(list.begin(), list.end(), ptrs[i]));
+    });
+    printf("  list     create %8.2f ms, iterate %8.3f ms, remove %zu "
+           "%9.2f ms\n",
+           createMs, iterateMs / k_passes, removed.size(), removeMs);
+  }
+
+  {
+    q3SlotMap<q3ContactConstraint> slots;
+    std::vector<q3SlotHandle> handles;
+    double createMs = BenchMs([&] {
+      for (const ContactKey &k : keys)
+        handles.push_back(slots.Emplace(k.A, k.bodyA, k.B, k.bodyB));
+    });
+    double iterateMs = BenchMs([&] {
+      for (int pass = 0; pass < k_passes; ++pass) {
+        for (auto &c : slots)
+          sum += Touch(c);
+      }
+    });
+    double removeMs = BenchMs([&] {
+      for (int i : removed)
+        slots.Remove(handles[i]);
+    });
+    printf("  slot map create %8.2f ms, iterate %8.3f ms, remove %zu "
+           "%9.2f ms\n",
+           createMs, iterateMs / k_passes, removed.size(), removeMs);
+  }
+
+  // The same collapse through the manager, edges included
+  std::vector<q3ContactHandle> handles;
+  for (size_t i = 0; i < contacts->ContactCount(); ++i)
+    handles.push_back(contacts->HandleAt(i));
+  double removeMs = BenchMs([&] {
+    for (int i : removed)
+      contacts->RemoveContact(handles[i]);
+  });
+  int stale = 0;
+  for (int i : removed)
+    stale += contacts->GetContact(handles[i]) == nullptr;
+  printf("  manager  remove %zu %9.2f ms, %d stale handles, %zu left "
+         "(checksum %d)\n",
+         removed.size(), removeMs, stale, contacts->ContactCount(), sum);
+}
+
+// Island construction as q3TimeStep does it, over a settled pile where
+// every box is in contact with its neighbours. Each pass wakes all bodies
+// first, so every pass builds the same islands.
+void BenchIslandBuild() {
+  const int k_settleSteps = 30;
+  const int k_builds = 20;
+
+  BenchWorld world;
+  world.AddBox({0, -1, 0}, eStaticBody, {40, 0.5f, 40});
+  std::vector<q3Body *> bodies;
+  for (int i = 0; i < k_layers; ++i) {
+    for (int j = 0; j < k_side; ++j) {
+      for (int k = 0; k < k_side; ++k) {
+        bodies.push_back(world.AddBox({0.99f * (j - k_side / 2), 1.01f * i,
+                                       0.99f * (k - k_side / 2)},
+                                      eDynamicBody));
+      }
+    }
+  }
+  for (int i = 0; i < k_settleSteps; ++i)
+    world.Step();
+
+  auto contacts = world.contactManager.get();
+  size_t islands = 0;
+  size_t constraints = 0;
+  double ms = 0;
+  for (int pass = 0; pass < k_builds; ++pass) {
+    for (auto body : *world.scene) {
+      body->SetToAwake();
+      body->RemoveFlag(q3BodyFlags::eIsland);
+    }
+    for (q3ContactConstraint &c : *contacts)
+      c.RemoveFlag(q3ContactConstraintFlags::eIsland);
+
+    islands = 0;
+    constraints = 0;
+    ms += BenchMs([&] {
+      for (auto seed : *world.scene) {
+        if (seed->HasFlag(q3BodyFlags::eIsland) ||
+            !seed->HasFlag(q3BodyFlags::eAwake) ||
+            seed->HasFlag(q3BodyFlags::eStatic))
+          continue;
+
+        q3Island island(seed, contacts);
+        ++islands;
+        constraints += island.m_constraints.size();
+      }
+    });
+  }
+
+  printf("  %zu boxes, %zu contacts, %zu islands, %zu island constraints\n",
+         bodies.size(), contacts->ContactCount(), islands, constraints);
+  printf("  build %8.2f ms per step\n", ms / k_builds);
+}
+
+// A pile dropping onto a floor, stepped serially and with the narrowphase
+// on a thread pool. The runs must stay bit for bit the same. Afterwards
+// TestCollisions alone is timed over the settled contacts.
+void BenchParallelNarrowphase() {
+  const int k_steps = 30;
+  const int k_tests = 20;
+
+  struct Run {
+    BenchWorld world;
+    std::vector<q3Body *> bodies;
+    double stepMs = 0;
+    double testMs = 0;
+  };
+  auto setup = [](Run &run) {
+    run.world.AddBox({0, -1, 0}, eStaticBody, {40, 0.5f, 40});
+    for (int i = 0; i < k_layers; ++i) {
+      for (int j = 0; j < k_side; ++j) {
+        for (int k = 0; k < k_side; ++k) {
+          run.bodies.push_back(run.world.AddBox(
+              {0.99f * (j - k_side / 2), 1.01f * i, 0.99f * (k - k_side / 2)},
+              eDynamicBody));
+        }
+      }
+    }
+  };
+  auto sameManifolds = [](Run &a, Run &b) {
+    auto &ca = *a.world.contactManager;
+    auto &cb = *b.world.contactManager;
+    if (ca.ContactCount() != cb.ContactCount())
+      return false;
+    for (size_t i = 0; i < ca.ContactCount(); ++i) {
+      const q3Manifold &ma = ca.Contact(i).manifold;
+      const q3Manifold &mb = cb.Contact(i).manifold;
+      if (ma.contactCount != mb.contactCount ||
+          memcmp(&ma.normal, &mb.normal, sizeof(ma.normal)) != 0)
+        return false;
+
+      // Field by field, the solver scratch fields are never set here
+      for (int j = 0; j < ma.contactCount; ++j) {
+        const q3Contact &a = ma.contacts[j];
+        const q3Contact &b = mb.contacts[j];
+        if (a.fp.key != b.fp.key ||
+            memcmp(&a.position, &b.position, sizeof(a.position)) != 0 ||
+            memcmp(&a.penetration, &b.penetration, sizeof(float) * 4) != 0)
+          return false;
+      }
+    }
+    return true;
+  };
+
+  Run serial;
+  Run parallel;
+  setup(serial);
+  setup(parallel);
+  q3ThreadPool pool;
+  parallel.world.contactManager->SetThreadPool(&pool);
+
+  bool same = true;
+  for (int i = 0; i < k_steps; ++i) {
+    serial.stepMs += BenchMs([&] { serial.world.Step(); });
+    parallel.stepMs += BenchMs([&] { parallel.world.Step(); });
+  }
+  for (int i = 0; i < int(serial.bodies.size()); ++i) {
+    q3Transform a = serial.bodies[i]->Transform();
+    q3Transform b = parallel.bodies[i]->Transform();
+    same = same && memcmp(&a, &b, sizeof(a)) == 0;
+  }
+  same = same && sameManifolds(serial, parallel);
+
+  for (int i = 0; i < k_tests; ++i) {
+    serial.testMs +=
+        BenchMs([&] { serial.world.contactManager->TestCollisions(); });
+    parallel.testMs +=
+        BenchMs([&] { parallel.world.contactManager->TestCollisions(); });
+    same = same && sameManifolds(serial, parallel);
+  }
+
+  printf("  %zu boxes, %zu contacts, %d steps\n", serial.bodies.size(),
+         serial.world.contactManager->ContactCount(), k_steps);
+  printf("  serial     : step %8.2f ms, narrowphase %8.2f ms\n",
+         serial.stepMs / k_steps, serial.testMs / k_tests);
+  printf("  %2d threads : step %8.2f ms, narrowphase %8.2f ms (%s)\n",
+         pool.ThreadCount(), parallel.stepMs / k_steps,
+         parallel.testMs / k_tests, same ? "identical" : "MISMATCH");
+}
+
+// Boxes raining through a sensor slab onto a floor. Begin and end events
+// against what a caller had to do before: scan every contact each step and
+// diff its touching flag against the last step.
+void BenchContactEvents() {
+  const int k_steps = 120;
+  const int k_rainSide = 16;
+  const int k_rainLayers = 4;
+
+  BenchWorld world;
+  world.AddBox({0, -1, 0}, eStaticBody, {40, 0.5f, 40});
+  auto sensor = world.scene->CreateBody({.position = {0, 3, 0}});
+  world.scene->AddBox(sensor, {.m_e = {4, 0.5f, 4}, .m_sensor = true});
+  for (int i = 0; i < k_rainLayers; ++i) {
+    for (int j = 0; j < k_rainSide; ++j) {
+      for (int k = 0; k < k_rainSide; ++k) {
+        // Odd layers land on the edges of the boxes below and tumble
+        world.AddBox({1.5f * (j - k_rainSide / 2) + 0.75f * (i & 1),
+                      6.0f + 1.5f * i, 1.5f * (k - k_rainSide / 2)},
+                     eDynamicBody);
+      }
+    }
+  }
+
+  auto contacts = world.contactManager.get();
+  using Pair = std::pair<const q3Shape *, const q3Shape *>;
+  std::set<Pair> touching;
+  std::set<Pair> now;
+  size_t scanBegin = 0, scanEnd = 0;
+  size_t eventBegin = 0, eventEnd = 0, sensorBegin = 0, sensorEnd = 0;
+  double scanMs = 0, eventMs = 0, stepMs = 0;
+  for (int i = 0; i < k_steps; ++i) {
+    stepMs += BenchMs([&] { world.Step(); });
+
+    scanMs += BenchMs([&] {
+      now.clear();
+      for (const q3ContactConstraint &c : *contacts) {
+        if (!c.manifold.sensor &&
+            c.HasFlag(q3ContactConstraintFlags::eColliding))
+          now.insert({c.A, c.B});
+      }
+      for (const Pair &p : now)
+        scanBegin += !touching.count(p);
+      for (const Pair &p : touching)
+        scanEnd += !now.count(p);
+      touching.swap(now);
+    });
+
+    eventMs += BenchMs([&] {
+      eventBegin += contacts->BeginEvents().size();
+      eventEnd += contacts->EndEvents().size();
+      sensorBegin += contacts->SensorBeginEvents().size();
+      sensorEnd += contacts->SensorEndEvents().size();
+    });
+  }
+
+  printf("  %d boxes, %zu contacts, %d steps, step %.2f ms\n",
+         k_rainSide * k_rainSide * k_rainLayers, contacts->ContactCount(),
+         k_steps, stepMs / k_steps);
+  printf("  scan   %8.3f ms per step, %zu begin, %zu end\n", scanMs / k_steps,
+         scanBegin, scanEnd);
+  printf("  events %8.3f ms per step, %zu begin, %zu end (%s)\n",
+         eventMs / k_steps, eventBegin, eventEnd,
+         scanBegin == eventBegin && scanEnd == eventEnd ? "same" : "MISMATCH");
+  printf("  sensor %zu begin, %zu end\n", sensorBegin, sensorEnd);
+}
+
+// The box-box query over every contact of a settled pile, one pair at a
+// time with q3BoxtoBox against four lanes at a time with q3BoxtoBoxBatch.
+// Both must build the same manifolds. The axis caches are cleared so every
+// pair runs the full query.
+void BenchBoxSat() {
+  const int k_steps = 30;
+  const int k_runs = 20;
+
+  BenchWorld world;
+  world.AddBox({0, -1, 0}, eStaticBody, {40, 0.5f, 40});
+  for (int i = 0; i < k_layers; ++i) {
+    for (int j = 0; j < k_side; ++j) {
+      for (int k = 0; k < k_side; ++k) {
+        world.AddBox(
+            {0.99f * (j - k_side / 2), 1.01f * i, 0.99f * (k - k_side / 2)},
+            eDynamicBody);
+      }
+    }
+  }
+  for (int i = 0; i < k_steps; ++i)
+    world.Step();
+
+  auto contacts = world.contactManager.get();
+  std::vector<q3Manifold> scalar;
+  for (const q3ContactConstraint &c : *contacts)
+    scalar.push_back(c.manifold);
+  std::vector<q3Manifold> batch = scalar;
+  std::vector<q3Manifold *> pointers;
+  for (q3Manifold &m : batch)
+    pointers.push_back(&m);
+
+  // Outside the timings, which would otherwise differ by a pass over the
+  // batch manifolds
+  auto reset = [](std::vector<q3Manifold> &manifolds) {
+    for (q3Manifold &m : manifolds) {
+      m.contactCount = 0;
+      m.cache = {};
+    }
+  };
+
+  double scalarMs = 0, batchMs = 0;
+  for (int i = 0; i < k_runs; ++i) {
+    reset(scalar);
+    scalarMs += BenchMs([&] {
+      for (q3Manifold &m : scalar) {
+        q3BoxtoBox(&m, std::get<0>(m.A),
+                   static_cast<q3Box *>(std::get<1>(m.A)), std::get<0>(m.B),
+                   static_cast<q3Box *>(std::get<1>(m.B)));
+      }
+    });
+    reset(batch);
+    batchMs += BenchMs(
+        [&] { q3BoxtoBoxBatch(pointers.data(), int(pointers.size())); });
+  }
+
+  bool same = true;
+  int touching = 0;
+  for (size_t i = 0; i < scalar.size(); ++i) {
+    const q3Manifold &a = scalar[i];
+    const q3Manifold &b = batch[i];
+    touching += a.contactCount > 0;
+    same = same && a.contactCount == b.contactCount &&
+           memcmp(&a.normal, &b.normal, sizeof(a.normal)) == 0;
+    for (int j = 0; same && j < a.contactCount; ++j) {
+      same = a.contacts[j].fp.key == b.contacts[j].fp.key &&
+             memcmp(&a.contacts[j].position, &b.contacts[j].position,
+                    sizeof(q3Vec3)) == 0 &&
+             a.contacts[j].penetration == b.contacts[j].penetration;
+    }
+  }
+
+  printf("  %zu pairs, %d touching\n", scalar.size(), touching);
+  printf("  q3BoxtoBox      %8.2f ms\n", scalarMs / k_runs);
+  printf("  q3BoxtoBoxBatch %8.2f ms (%s)\n", batchMs / k_runs,
+         same ? "same" : "MISMATCH");
+}
+
+// The BoxStack demo, counting per step how each tested contact settled its
+// separating axis query: the full query, an axis that still separates, or
+// the reused axis of boxes that barely moved.
+void BenchSatCache() {
+  const int k_steps = 600;
+  const int k_report = 100;
+
+  BenchWorld world;
+  world.AddBox({}, eStaticBody, q3Vec3{25.0f, 0.5f, 25.0f});
+  for (int i = 0; i < 8; ++i) {
+    for (int j = 0; j < 8; ++j) {
+      for (int k = 0; k < 10; ++k) {
+        world.AddBox({-16.0f + 1.0f * j, 1.0f * i + 5.0f, -16.0f + 1.0f * k},
+                     eDynamicBody);
+      }
+    }
+  }
+
+  auto contacts = world.contactManager.get();
+  size_t counts[4] = {};
+  size_t total[4] = {};
+  double stepMs = 0;
+  for (int i = 0; i < k_steps; ++i) {
+    for (q3ContactConstraint &c : *contacts)
+      c.manifold.cache.last = q3SatQuery::eNone;
+    stepMs += BenchMs([&] { world.Step(); });
+    for (const q3ContactConstraint &c : *contacts)
+      ++counts[int(c.manifold.cache.last)];
+
+    if (i % k_report == k_report - 1) {
+      size_t tested = counts[1] + counts[2] + counts[3];
+      printf("  steps %3d-%3d: %7zu tests, %5.1f%% full, %5.1f%% separated, "
+             "%5.1f%% reused\n",
+             i + 1 - k_report, i, tested, 100.0 * counts[1] / tested,
+             100.0 * counts[2] / tested, 100.0 * counts[3] / tested);
+      for (int j = 0; j < 4; ++j) {
+        total[j] += counts[j];
+        counts[j] = 0;
+      }
+    }
+  }
+
+  size_t tested = total[1] + total[2] + total[3];
+  printf("  %zu contacts, step %.2f ms, %.1f%% of %zu queries skipped\n",
+         contacts->ContactCount(), stepMs / k_steps,
+         100.0 * (total[2] + total[3]) / tested, tested);
+}
+
+// Towers of resting boxes and a tumbling pile, solved one constraint at a
+// time and four at a time by the wide solver. Sleeping is off so every step
+// solves every contact. The wide solver visits constraints in another
+// order, so the piles must come to rest alike rather than the same. How far
+// apart they end up after a fixed number of steps is ordering noise, which
+// more iterations shrink for both solvers.
+void BenchWideSolver() {
+  const int k_steps = 300;
+  const int k_iterations[] = {q3Env{}.m_iterations, 3 * q3Env{}.m_iterations};
+
+  struct Scene {
+    const char *name;
+    void (*setup)(BenchWorld &world);
+  } scenes[] = {
+      {"towers",
+       [](BenchWorld &world) {
+         world.AddBox({}, eStaticBody, q3Vec3{25.0f, 0.5f, 25.0f});
+         for (int i = 0; i < 12; ++i) {
+           for (int j = 0; j < 12; ++j) {
+             for (int k = 0; k < 8; ++k) {
+               world.AddBox({1.5f * (i - 6), 1.0f + 1.0f * k, 1.5f * (j - 6)},
+                            eDynamicBody);
+             }
+           }
+         }
+       }},
+      {"pile",
+       [](BenchWorld &world) {
+         world.AddBox({0, -1, 0}, eStaticBody, {40, 0.5f, 40});
+         for (int i = 0; i < 6; ++i) {
+           for (int j = 0; j < 12; ++j) {
+             for (int k = 0; k < 12; ++k) {
+               auto body = world.scene->CreateBody({
+                   .axis = {1.0f, 0.0f, 1.0f},
+                   .angle = 0.3f * float(i + j + k),
+                   .position = {1.2f * (j - 6) + 0.6f * (i & 1),
+                                1.5f + 1.5f * i, 1.2f * (k - 6)},
+                   .bodyType = eDynamicBody,
+               });
+               world.scene->AddBox(body, {.m_e = {0.5f, 0.5f, 0.5f},
+                                          .m_restitution = 0});
+             }
+           }
+         }
+       }},
+  };
+
+  for (const Scene &scene : scenes) {
+    for (int iterations : k_iterations) {
+      for (bool wide : {false, true}) {
+        BenchWorld world;
+        world.env.m_allowSleep = false;
+        world.env.m_wideSolver = wide;
+        world.env.SetIterations(iterations);
+        scene.setup(world);
+
+        double stepMs = 0;
+        for (int i = 0; i < k_steps; ++i)
+          stepMs += BenchMs([&] { world.Step(); });
+
+        int count = 0;
+        double sumY = 0;
+        double sumSpeed = 0;
+        float minY = 1.0e9f;
+        float maxSpeed = 0;
+        for (q3Body *body : *world.scene) {
+          if (body->HasFlag(q3BodyFlags::eStatic))
+            continue;
+          ++count;
+          sumY += body->Transform().position.y;
+          minY = std::min(minY, body->Transform().position.y);
+          float speed = q3Distance(body->VelocityState().linearVelocity, {});
+          sumSpeed += speed;
+          maxSpeed = std::max(maxSpeed, speed);
+        }
+        float deepest = 0;
+        for (const q3ContactConstraint &c : *world.contactManager) {
+          for (int j = 0; j < c.manifold.contactCount; ++j)
+            deepest = std::min(deepest, c.manifold.contacts[j].penetration);
+        }
+
+        printf("  %-6s %-6s %2d it, %zu contacts, step %7.2f ms, y avg %.4f "
+               "min %.4f, deepest %.4f, speed avg %.4f max %.4f\n",
+               scene.name, wide ? "wide" : "scalar", iterations,
+               world.contactManager->ContactCount(), stepMs / k_steps,
+               sumY / count, minY, deepest, sumSpeed / count, maxSpeed);
+      }
+    }
+  }
+}
+
+// Hundreds of small rubble piles and two large piles on one floor, stepped
+// with the islands solved one after another and on a thread pool, with
+// both solvers. Sleeping is on, so piles fall asleep on different steps
+// while sharing the static floor. The runs must stay bit for bit the same.
+void BenchParallelIslands() {
+  const int k_steps = 200;
+  const int k_piles = 16;
+
+  auto setup = [](BenchWorld &world) {
+    world.AddBox({0, -1, 0}, eStaticBody, {50, 0.5f, 50});
+    auto drop = [&world](const q3Vec3 &position, float angle) {
+      auto body = world.scene->CreateBody({
+          .axis = {1.0f, 0.0f, 1.0f},
+          .angle = angle,
+          .position = position,
+          .bodyType = eDynamicBody,
+      });
+      world.scene->AddBox(body, {.m_e = {0.4f, 0.4f, 0.4f},
+                                 .m_restitution = 0});
+    };
+
+    // Rubble: 2 x 2 x 3 boxes, far enough apart to stay islands of their own
+    for (int i = 0; i < k_piles; ++i) {
+      for (int j = 0; j < k_piles; ++j) {
+        q3Vec3 center = {3.5f * (i - k_piles / 2), 0.0f,
+                         3.5f * (j - k_piles / 2)};
+        for (int n = 0; n < 12; ++n) {
+          q3Vec3 offset = {0.9f * (n & 1), 0.5f + 1.0f * (n / 4),
+                           0.9f * ((n >> 1) & 1)};
+          drop(center + offset, 0.2f * float(i + j + n));
+        }
+      }
+    }
+
+    // Two large piles past the rubble
+    for (float x : {-42.0f, 42.0f}) {
+      for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 8; ++j) {
+          for (int k = 0; k < 8; ++k) {
+            drop({x + 0.9f * (j - 4), 0.5f + 1.0f * i, 0.9f * (k - 4)},
+                 0.3f * float(i + j + k));
+          }
+        }
+      }
+    }
+  };
+
+  auto sameState = [](BenchWorld &a, BenchWorld &b) {
+    auto ia = a.scene->begin();
+    for (auto ib = b.scene->begin(); ib != b.scene->end(); ++ia, ++ib) {
+      q3Body *bodyA = *ia;
+      q3Body *bodyB = *ib;
+      q3Transform ta = bodyA->Transform();
+      q3Transform tb = bodyB->Transform();
+      if (memcmp(&ta, &tb, sizeof(ta)) != 0 ||
+          memcmp(&bodyA->VelocityState(), &bodyB->VelocityState(),
+                 sizeof(q3VelocityState)) != 0 ||
+          bodyA->IsAwake() != bodyB->IsAwake())
+        return false;
+    }
+
+    auto &ca = *a.contactManager;
+    auto &cb = *b.contactManager;
+    if (ca.ContactCount() != cb.ContactCount())
+      return false;
+    for (size_t i = 0; i < ca.ContactCount(); ++i) {
+      const q3Manifold &ma = ca.Contact(i).manifold;
+      const q3Manifold &mb = cb.Contact(i).manifold;
+      if (ma.contactCount != mb.contactCount)
+        return false;
+      for (int j = 0; j < ma.contactCount; ++j) {
+        const q3Contact &x = ma.contacts[j];
+        const q3Contact &y = mb.contacts[j];
+        if (x.normalImpulse != y.normalImpulse ||
+            x.tangentImpulse[0] != y.tangentImpulse[0] ||
+            x.tangentImpulse[1] != y.tangentImpulse[1])
+          return false;
+      }
+    }
+    return true;
+  };
+
+  // At least three workers, so the check runs on real threads even on
+  // small machines
+  q3ThreadPool pool(std::max(3, q3ThreadPool::DefaultWorkerCount()));
+  for (bool wide : {false, true}) {
+    BenchWorld serial;
+    BenchWorld parallel;
+    for (BenchWorld *world : {&serial, &parallel}) {
+      world->env.m_wideSolver = wide;
+      setup(*world);
+    }
+    parallel.islandPool = &pool;
+
+    double serialMs = 0;
+    double parallelMs = 0;
+    bool same = true;
+    for (int i = 0; i < k_steps; ++i) {
+      serialMs += BenchMs([&] { serial.Step(); });
+      parallelMs += BenchMs([&] { parallel.Step(); });
+      same = same && sameState(serial, parallel);
+    }
+
+    int awake = 0;
+    for (q3Body *body : *serial.scene)
+      awake += body->IsAwake() && !body->HasFlag(q3BodyFlags::eStatic);
+    printf("  %-6s %zu bodies, %d awake at the end, %zu contacts\n",
+           wide ? "wide" : "scalar", serial.scene->BodyCount() - 1, awake,
+           serial.contactManager->ContactCount());
+    printf("         serial     : step %8.2f ms\n", serialMs / k_steps);
+    printf("         %2d threads : step %8.2f ms (%s)\n", pool.ThreadCount(),
+           parallelMs / k_steps, same ? "identical" : "MISMATCH");
+  }
+}
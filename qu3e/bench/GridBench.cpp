@@ -0,0 +1,110 @@
+#include "Bench.h"
+#include <memory>
+#include <vector>
+
+namespace {
+
+const int k_boxes = 40000;
+const int k_iterations = 30;
+// Far larger than the demo floors, so a bounded grid would need to know it
+const float k_worldSize = 4000.0f;
+
+struct Proxy {
+  std::unique_ptr<q3Body> body;
+  std::unique_ptr<q3Box> box;
+  q3Vec3 position;
+};
+
+q3AABB UnitBox(const q3Vec3 &p) {
+  q3Vec3 e = {0.5f, 0.5f, 0.5f};
+  return {p - e, p + e};
+}
+
+} // namespace
+
+// Insert, update and pair finding of many unit boxes spread over a huge
+// world plus a few large static slabs, for each broadphase backend.
+void BenchHashGrid() {
+  srand(11);
+  std::vector<Proxy> proxies;
+  for (int i = 0; i < k_boxes; ++i) {
+    // Loose clusters, so there are pairs to find
+    q3Vec3 cluster = {float(rand() % 200) * k_worldSize / 200.0f, 0.0f,
+                      float(rand() % 200) * k_worldSize / 200.0f};
+    q3Vec3 p = cluster + q3Vec3{q3RandomFloat(-4.0f, 4.0f),
+                                q3RandomFloat(0.0f, 4.0f),
+                                q3RandomFloat(-4.0f, 4.0f)};
+    proxies.push_back({std::make_unique<q3Body>(
+                           q3BodyDef{.bodyType = eDynamicBody}),
+                       std::make_unique<q3Box>(q3BoxDef{}), p});
+  }
+  std::vector<Proxy> slabs;
+  const int k_slabs = 16;
+  for (int i = 0; i < k_slabs; ++i) {
+    q3Vec3 c = {q3RandomFloat(0.0f, k_worldSize), -1.0f,
+                q3RandomFloat(0.0f, k_worldSize)};
+    slabs.push_back({std::make_unique<q3Body>(q3BodyDef{}),
+                     std::make_unique<q3Box>(q3BoxDef{}), c});
+  }
+
+  // Each iteration a third of the boxes drift far enough to leave their
+  // fat AABB
+  std::vector<std::vector<q3Vec3>> moves(k_iterations);
+  for (int it = 0; it < k_iterations; ++it) {
+    for (int i = 0; i < k_boxes; ++i) {
+      float step = (i + it) % 3 == 0 ? 0.8f : 0.05f;
+      moves[it].push_back({q3RandomFloat(-step, step),
+                           q3RandomFloat(-step, step),
+                           q3RandomFloat(-step, step)});
+    }
+  }
+
+  struct Backend {
+    const char *name;
+    q3BroadPhaseType type;
+  } backends[] = {{"aabb tree", eAABBTreeBroadPhase},
+                  {"sweep and prune", eSweepAndPruneBroadPhase},
+                  {"hash grid", eHashGridBroadPhase}};
+
+  printf("  %d unit boxes over %.0f x %.0f, %d static slabs, %d iterations\n",
+         k_boxes, k_worldSize, k_worldSize, k_slabs, k_iterations);
+  for (auto backend : backends) {
+    q3BroadPhase broadPhase(backend.type);
+    size_t pairs = 0;
+    auto count = [&pairs](q3Body *, q3Shape *, q3Body *, q3Shape *) {
+      ++pairs;
+    };
+
+    double insertMs = BenchMs([&] {
+      q3Vec3 e = {40.0f, 0.5f, 40.0f};
+      for (auto &slab : slabs)
+        broadPhase.InsertBox(slab.body.get(), slab.box.get(),
+                             {slab.position - e, slab.position + e});
+      for (auto &p : proxies)
+        broadPhase.InsertBox(p.body.get(), p.box.get(), UnitBox(p.position));
+      broadPhase.UpdatePairs(count);
+    });
+
+    std::vector<q3Vec3> positions;
+    for (auto &p : proxies)
+      positions.push_back(p.position);
+
+    double updateMs = 0.0;
+    double pairMs = 0.0;
+    pairs = 0;
+    for (int it = 0; it < k_iterations; ++it) {
+      updateMs += BenchMs([&] {
+        for (int i = 0; i < k_boxes; ++i) {
+          positions[i] += moves[it][i];
+          broadPhase.Update(proxies[i].box->BroadPhaseIndex(),
+                            UnitBox(positions[i]));
+        }
+      });
+      pairMs += BenchMs([&] { broadPhase.UpdatePairs(count); });
+    }
+
+    printf("    %-15s: insert %7.2f ms, update %7.2f ms, pairs %7.2f ms "
+           "(%zu pairs)\n",
+           backend.name, insertMs, updateMs, pairMs, pairs);
+  }
+}
@@ -0,0 +1,272 @@
+#include "Bench.h"
+#include <algorithm>
+#include <q3ThreadPool.h>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+const int k_side = 16;  // boxes per pile edge
+const int k_layers = 6; // pile height
+const int k_iterations = 20;
+
+} // namespace
+
+// A packed pile where every box touches up to 26 others. The whole pile
+// shifts back and forth each iteration, so every proxy leaves its fat AABB
+// but all pairs persist. Times UpdatePairs with the contact manager behind
+// it, as q3TimeStep wires them.
+void BenchPairCache() {
+  BenchWorld world;
+  std::vector<q3Body *> bodies;
+  for (int i = 0; i < k_layers; ++i) {
+    for (int j = 0; j < k_side; ++j) {
+      for (int k = 0; k < k_side; ++k) {
+        bodies.push_back(world.AddBox({1.05f * (j - k_side / 2), 1.05f * i,
+                                       1.05f * (k - k_side / 2)},
+                                      eDynamicBody));
+      }
+    }
+  }
+
+  auto contacts = world.contactManager.get();
+  auto beginContact = [contacts](q3Body *bodyA, q3Shape *A, q3Body *bodyB,
+                                 q3Shape *B) {
+    contacts->BeginContact(bodyA, A, bodyB, B);
+  };
+  auto endContact = [contacts](q3Body *bodyA, q3Shape *A, q3Body *bodyB,
+                               q3Shape *B) {
+    contacts->EndContact(bodyA, A, bodyB, B);
+  };
+  double loadMs = BenchMs(
+      [&] { world.broadPhase->UpdatePairs(beginContact, endContact); });
+
+  world.broadPhase->ResetStats();
+  double ms = 0.0;
+  for (int it = 0; it < k_iterations; ++it) {
+    for (auto body : bodies) {
+      q3Transform tx = body->Transform();
+      tx.position.x += (it & 1) ? 0.0f : 0.6f;
+      for (auto box : *body)
+        world.broadPhase->Update(box->BroadPhaseIndex(),
+                                 box->ComputeAABB(tx));
+    }
+    ms += BenchMs(
+        [&] { world.broadPhase->UpdatePairs(beginContact, endContact); });
+  }
+
+  const q3BroadPhaseStats &stats = world.broadPhase->Stats();
+  printf("  %zu boxes, %zu contacts, %d iterations\n", bodies.size(),
+         contacts->ContactCount(), k_iterations);
+  printf("  load %8.2f ms, moved %8.2f ms per iteration\n", loadMs,
+         ms / k_iterations);
+  printf("  per iteration: %d pairs found, %d begun, %d ended\n",
+         stats.pairs / k_iterations, stats.begun / k_iterations,
+         stats.ended / k_iterations);
+}
+
+// Level load and mass wake-ups of a large pile on a floor of static tiles:
+// every dynamic proxy is in the move buffer. Pairs found with one query per
+// moved proxy against descending both trees together.
+void BenchDualTree() {
+  const int k_pileSide = 40;
+  const int k_pileLayers = 10;
+  const int k_floorSide = 60;
+
+  struct Run {
+    BenchWorld world;
+    std::vector<q3Body *> bodies;
+    // Boxes by insertion order, so the runs can be compared
+    std::unordered_map<const q3Shape *, int> index;
+    std::vector<std::pair<int, int>> pairs;
+    double loadMs = 0;
+    double wakeMs = 0;
+  };
+  auto setup = [&](Run &run, float fraction) {
+    run.world.broadPhase->SetDualTreeFraction(fraction);
+    auto add = [&run](const q3Vec3 &position, q3BodyType type) {
+      q3Body *body = run.world.AddBox(position, type);
+      int index = int(run.index.size());
+      run.index[*body->begin()] = index;
+      return body;
+    };
+    for (int j = 0; j < k_floorSide; ++j) {
+      for (int k = 0; k < k_floorSide; ++k) {
+        add({float(j) - k_floorSide / 2, 0.0f, float(k) - k_floorSide / 2},
+            eStaticBody);
+      }
+    }
+    for (int i = 0; i < k_pileLayers; ++i) {
+      for (int j = 0; j < k_pileSide; ++j) {
+        for (int k = 0; k < k_pileSide; ++k) {
+          run.bodies.push_back(add({1.05f * (j - k_pileSide / 2),
+                                    1.05f * (i + 1),
+                                    1.05f * (k - k_pileSide / 2)},
+                                   eDynamicBody));
+        }
+      }
+    }
+  };
+  auto updatePairs = [](Run &run, double &ms) {
+    std::vector<std::pair<const q3Shape *, const q3Shape *>> reported;
+    ms += BenchMs([&] {
+      run.world.broadPhase->UpdatePairs(
+          [&](q3Body *, q3Shape *A, q3Body *, q3Shape *B) {
+            reported.push_back({A, B});
+          });
+    });
+    run.pairs.clear();
+    for (auto [A, B] : reported)
+      run.pairs.push_back({run.index[A], run.index[B]});
+  };
+  // The pile jumps up and back down, every proxy leaves its fat AABB
+  auto wake = [](Run &run, int it) {
+    for (auto body : run.bodies) {
+      q3Transform tx = body->Transform();
+      tx.position.y += (it & 1) ? 0.0f : 1.2f;
+      for (auto box : *body)
+        run.world.broadPhase->Update(box->BroadPhaseIndex(),
+                                     box->ComputeAABB(tx));
+    }
+  };
+
+  Run perProxy;
+  Run dual;
+  setup(perProxy, 2.0f);
+  setup(dual, 0.5f);
+
+  updatePairs(perProxy, perProxy.loadMs);
+  updatePairs(dual, dual.loadMs);
+  bool same = perProxy.pairs == dual.pairs;
+  size_t loadPairs = dual.pairs.size();
+  for (int it = 0; it < k_iterations; ++it) {
+    wake(perProxy, it);
+    wake(dual, it);
+    updatePairs(perProxy, perProxy.wakeMs);
+    updatePairs(dual, dual.wakeMs);
+    same = same && perProxy.pairs == dual.pairs;
+  }
+
+  printf("  %zu dynamic boxes on %d static tiles, %zu pairs at load\n",
+         dual.bodies.size(), k_floorSide * k_floorSide, loadPairs);
+  printf("  per proxy: load %8.2f ms, wake-up %8.2f ms per iteration\n",
+         perProxy.loadMs, perProxy.wakeMs / k_iterations);
+  printf("  dual tree: load %8.2f ms, wake-up %8.2f ms per iteration (%s)\n",
+         dual.loadMs, dual.wakeMs / k_iterations,
+         same ? "same pairs, same order" : "MISMATCH");
+}
+
+// Vehicles of 24 boxes each dropped in layers on a floor of 400 static
+// tiles, with every body as plain boxes and as compounds. Plain boxes put
+// every box in the broadphase and pair up with the boxes of their own body
+// too; compounds have one proxy per body and pair their boxes through the
+// bodies' trees. Queries must see the same boxes either way.
+void BenchCompound() {
+  const int k_vehicleSide = 6;
+  const int k_vehicleLayers = 3;
+  const int k_tileSide = 20;
+  const int k_steps = 200;
+
+  // The batch below runs right after the boxes went in, on real threads, so
+  // the compound trees must already be built when the workers query them
+  q3ThreadPool pool(std::max(3, q3ThreadPool::DefaultWorkerCount()));
+  for (bool compound : {false, true}) {
+    BenchWorld world;
+    auto floor = world.scene->CreateBody({.compound = compound});
+    for (int i = 0; i < k_tileSide; ++i) {
+      for (int j = 0; j < k_tileSide; ++j) {
+        q3Transform tx;
+        tx.position = {2.0f * (i - k_tileSide / 2), -0.25f,
+                       2.0f * (j - k_tileSide / 2)};
+        world.scene->AddBox(floor, {.m_tx = tx, .m_e = {1.0f, 0.25f, 1.0f}});
+      }
+    }
+
+    int boxCount = 0;
+    for (int i = 0; i < k_vehicleLayers; ++i) {
+      for (int j = 0; j < k_vehicleSide; ++j) {
+        for (int k = 0; k < k_vehicleSide; ++k) {
+          auto body = world.scene->CreateBody({
+              .axis = {0.0f, 1.0f, 0.0f},
+              .angle = 0.4f * float(i),
+              .position = {3.0f * (j - k_vehicleSide / 2) + 0.5f * i,
+                           1.0f + 1.5f * i, 3.0f * (k - k_vehicleSide / 2)},
+              .bodyType = eDynamicBody,
+              .compound = compound,
+          });
+          // 2 x 1 x 1.5 made of quarter boxes
+          for (int x = 0; x < 4; ++x) {
+            for (int y = 0; y < 2; ++y) {
+              for (int z = 0; z < 3; ++z) {
+                q3Transform tx;
+                tx.position = {0.5f * x - 0.75f, 0.5f * y - 0.25f,
+                               0.5f * z - 0.5f};
+                world.scene->AddBox(body, {
+                                              .m_tx = tx,
+                                              .m_e = {0.25f, 0.25f, 0.25f},
+                                              .m_restitution = 0,
+                                          });
+                ++boxCount;
+              }
+            }
+          }
+        }
+      }
+    }
+
+    // Queries before anything moves, when both runs hold the same boxes
+    std::vector<q3RaycastData> rays;
+    for (int i = 0; i < 32; ++i) {
+      for (int j = 0; j < 32; ++j) {
+        q3RaycastData ray;
+        ray.Set({0.6f * (i - 16) + 0.1f, 20.0f, 0.6f * (j - 16) + 0.1f},
+                {0.0f, -1.0f, 0.0f}, 40.0f);
+        rays.push_back(ray);
+      }
+    }
+    std::vector<q3RayHit> batchHits;
+    world.broadPhase->RayCastBatch(rays, batchHits, &pool);
+    int rayHits = 0;
+    for (q3RaycastData &ray : rays) {
+      world.broadPhase->RayCast(
+          [&](q3Body *, q3Shape *) {
+            ++rayHits;
+            return true;
+          },
+          ray);
+    }
+    int aabbHits = 0;
+    world.broadPhase->QueryAABB(
+        [&](q3Body *, q3Shape *) {
+          ++aabbHits;
+          return true;
+        },
+        q3AABB{{-4.0f, -1.0f, -4.0f}, {4.0f, 3.0f, 4.0f}});
+
+    world.broadPhase->ResetStats();
+    double stepMs = 0;
+    for (int i = 0; i < k_steps; ++i)
+      stepMs += BenchMs([&] { world.Step(); });
+
+    double sumY = 0;
+    float minY = FLT_MAX;
+    int bodyCount = 0;
+    for (q3Body *body : *world.scene) {
+      if (body == floor)
+        continue;
+      sumY += body->Transform().position.y;
+      minY = std::min(minY, body->Transform().position.y);
+      ++bodyCount;
+    }
+
+    const q3BroadPhaseStats &stats = world.broadPhase->Stats();
+    printf("  %-8s %d boxes, step %7.2f ms, pairs begun %7d, contacts "
+           "created %6zu, alive %5zu\n",
+           compound ? "compound" : "boxes", boxCount, stepMs / k_steps,
+           stats.begun, world.contactManager->CreatedCount(),
+           world.contactManager->ContactCount());
+    printf("           queries: %d ray hits, %zu batch hits, %d in aabb; "
+           "rest y avg %.3f min %.3f\n",
+           rayHits, batchHits.size(), aabbHits, sumY / bodyCount, minY);
+  }
+}
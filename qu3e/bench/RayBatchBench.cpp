@@ -0,0 +1,86 @@
+#include "Bench.h"
+#include <q3ThreadPool.h>
+#include <vector>
+
+namespace {
+
+const int k_floorSide = 100;
+const int k_sensors = 8;
+const int k_raysPerSensor = 1024;
+
+bool SameHits(const std::vector<q3RayHit> &a, const std::vector<q3RayHit> &b) {
+  if (a.size() != b.size())
+    return false;
+  for (int i = 0; i < int(a.size()); ++i) {
+    if (a[i].ray != b[i].ray || a[i].box != b[i].box ||
+        a[i].toi != b[i].toi || a[i].normal.x != b[i].normal.x ||
+        a[i].normal.y != b[i].normal.y || a[i].normal.z != b[i].normal.z)
+      return false;
+  }
+  return true;
+}
+
+} // namespace
+
+// LIDAR style fans of rays over a box field: one RayCast per ray against
+// RayCastBatch, serial and on a thread pool.
+void BenchRayBatch() {
+  srand(1);
+  BenchWorld world;
+  for (int i = 0; i < k_floorSide; ++i) {
+    for (int j = 0; j < k_floorSide; ++j) {
+      world.AddBox({float(i), 0.0f, float(j)}, eStaticBody);
+    }
+  }
+  for (int i = 0; i < 2000; ++i) {
+    world.AddBox({q3RandomFloat(0.0f, float(k_floorSide)),
+                  q3RandomFloat(1.0f, 4.0f),
+                  q3RandomFloat(0.0f, float(k_floorSide))},
+                 eDynamicBody);
+  }
+  world.broadPhase->UpdatePairs(
+      [](q3Body *, q3Shape *, q3Body *, q3Shape *) {});
+
+  std::vector<q3RaycastData> rays;
+  for (int s = 0; s < k_sensors; ++s) {
+    q3Vec3 origin = {q3RandomFloat(10.0f, 90.0f), 3.0f,
+                     q3RandomFloat(10.0f, 90.0f)};
+    for (int i = 0; i < k_raysPerSensor; ++i) {
+      float yaw = 2.0f * q3PI * float(i % 128) / 128.0f;
+      float pitch = -0.4f * float(i / 128) / 8.0f;
+      q3RaycastData ray;
+      ray.Set(origin,
+              q3Vec3{std::cos(yaw), pitch, std::sin(yaw)}.Normalized(), 40.0f);
+      rays.push_back(ray);
+    }
+  }
+
+  std::vector<q3RayHit> single;
+  double singleMs = BenchMs([&] {
+    for (int i = 0; i < int(rays.size()); ++i) {
+      q3RaycastData data = rays[i];
+      world.broadPhase->RayCast(
+          [&](q3Body *body, q3Shape *box) {
+            single.push_back({i, body, box, data.toi, data.normal});
+            return true;
+          },
+          data);
+    }
+  });
+
+  std::vector<q3RayHit> batch;
+  double batchMs =
+      BenchMs([&] { world.broadPhase->RayCastBatch(rays, batch); });
+
+  q3ThreadPool pool;
+  std::vector<q3RayHit> parallel;
+  double parallelMs = BenchMs(
+      [&] { world.broadPhase->RayCastBatch(rays, parallel, &pool); });
+
+  printf("  %zu rays, %zu hits\n", rays.size(), single.size());
+  printf("  RayCast per ray     : %8.2f ms\n", singleMs);
+  printf("  RayCastBatch        : %8.2f ms (%s)\n", batchMs,
+         SameHits(single, batch) ? "matches" : "MISMATCH");
+  printf("  RayCastBatch %2d thr : %8.2f ms (%s)\n", pool.ThreadCount(),
+         parallelMs, SameHits(single, parallel) ? "matches" : "MISMATCH");
+}
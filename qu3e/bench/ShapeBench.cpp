@@ -0,0 +1,110 @@
+#include "Bench.h"
+#include <math/q3Segment.h>
+#include <algorithm>
+#include <vector>
+
+// Debris dropped onto a floor, as unit boxes, as spheres of the same width
+// and as capsules. Each run reports the step and narrowphase times and
+// where the pile came to rest. Rays cast down onto the round shapes must
+// hit their surface.
+void BenchRoundShapes() {
+  const int k_side = 12;
+  const int k_layers = 6;
+  const int k_steps = 300;
+  const int k_tests = 20;
+
+  struct Shape {
+    const char *name;
+    void (*add)(q3Scene *scene, q3Body *body);
+    // World geometry of the round shapes, null for boxes
+    q3SweptSphere (*world)(const q3Shape *shape, const q3Transform &tx);
+  } shapes[] = {
+      {"box",
+       [](q3Scene *scene, q3Body *body) {
+         scene->AddBox(body, {.m_e = {0.5f, 0.5f, 0.5f}, .m_restitution = 0});
+       },
+       nullptr},
+      {"sphere",
+       [](q3Scene *scene, q3Body *body) {
+         scene->AddSphere(body, {.m_radius = 0.5f, .m_restitution = 0});
+       },
+       [](const q3Shape *shape, const q3Transform &tx) {
+         return static_cast<const q3Sphere *>(shape)->World(tx);
+       }},
+      {"capsule",
+       [](q3Scene *scene, q3Body *body) {
+         scene->AddCapsule(body, {.m_radius = 0.3f,
+                                  .m_halfHeight = 0.4f,
+                                  .m_restitution = 0});
+       },
+       [](const q3Shape *shape, const q3Transform &tx) {
+         return static_cast<const q3Capsule *>(shape)->World(tx);
+       }},
+  };
+
+  for (Shape &shape : shapes) {
+    BenchWorld world;
+    world.AddBox({0, -1, 0}, eStaticBody, {40, 0.5f, 40});
+    std::vector<q3Body *> bodies;
+    for (int i = 0; i < k_layers; ++i) {
+      for (int j = 0; j < k_side; ++j) {
+        for (int k = 0; k < k_side; ++k) {
+          // Tilted, and odd layers offset, so the pile tumbles
+          auto body = world.scene->CreateBody({
+              .axis = {1.0f, 0.0f, 1.0f},
+              .angle = 0.3f * float(i + j + k),
+              .position = {1.2f * (j - k_side / 2) + 0.6f * (i & 1),
+                           1.5f + 1.5f * i, 1.2f * (k - k_side / 2)},
+              .bodyType = eDynamicBody,
+          });
+          shape.add(world.scene.get(), body);
+          bodies.push_back(body);
+        }
+      }
+    }
+
+    double stepMs = 0;
+    for (int i = 0; i < k_steps; ++i)
+      stepMs += BenchMs([&] { world.Step(); });
+    double testMs = 0;
+    for (int i = 0; i < k_tests; ++i)
+      testMs += BenchMs([&] { world.contactManager->TestCollisions(); });
+
+    float minY = bodies[0]->Transform().position.y;
+    double sumY = 0;
+    for (q3Body *body : bodies) {
+      minY = std::min(minY, body->Transform().position.y);
+      sumY += body->Transform().position.y;
+    }
+
+    printf("  %-7s %zu bodies, %6zu contacts, step %7.2f ms, narrowphase "
+           "%6.2f ms, y avg %.3f min %.3f\n",
+           shape.name, bodies.size(), world.contactManager->ContactCount(),
+           stepMs / k_steps, testMs / k_tests, sumY / bodies.size(), minY);
+
+    if (!shape.world)
+      continue;
+
+    // Straight down through each center, from above the pile
+    int hits = 0;
+    float maxError = 0;
+    for (q3Body *body : bodies) {
+      const q3Shape *round = *body->begin();
+      q3Vec3 c = body->Transform().position;
+      q3RaycastData ray;
+      ray.Set({c.x, 50.0f, c.z}, {0.0f, -1.0f, 0.0f}, 100.0f);
+      if (!round->Raycast(body->Transform(), &ray))
+        continue;
+
+      ++hits;
+      q3SweptSphere capsule = shape.world(round, body->Transform());
+      q3Vec3 p = ray.GetImpactPoint();
+      float surface =
+          q3Distance(p, q3ClosestPointOnSegment(capsule.a, capsule.b, p)) -
+          capsule.radius;
+      maxError = std::max(maxError, std::abs(surface));
+    }
+    printf("          rays: %d of %zu hit, surface error %.2e\n", hits,
+           bodies.size(), maxError);
+  }
+}
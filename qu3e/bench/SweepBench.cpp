@@ -0,0 +1,200 @@
+#include "Bench.h"
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// Same bodies as the BoxStack demo
+void BoxStack(BenchWorld &world, int step) {
+  if (step != 0)
+    return;
+
+  world.AddBox({}, eStaticBody, q3Vec3{25.0f, 0.5f, 25.0f});
+  for (int i = 0; i < 8; ++i) {
+    for (int j = 0; j < 8; ++j) {
+      for (int k = 0; k < 10; ++k) {
+        world.AddBox({-16.0f + 1.0f * j, 1.0f * i + 5.0f, -16.0f + 1.0f * k},
+                     eDynamicBody);
+      }
+    }
+  }
+}
+
+// Same bodies as the DropBoxes demo, which throws in a box every second
+void DropBoxes(BenchWorld &world, int step) {
+  if (step == 0) {
+    world.AddBox({}, eStaticBody, q3Vec3{25.0f, 0.5f, 25.0f});
+    for (int i = 0; i < 10; ++i) {
+      world.AddBox({0.0f, 1.2f * (i + 1), 0.0f}, eDynamicBody);
+    }
+  }
+
+  if (step % 60 != 59)
+    return;
+
+  auto body = world.scene->CreateBody({
+      .axis = {q3RandomFloat(-1.0f, 1.0f), q3RandomFloat(-1.0f, 1.0f),
+               q3RandomFloat(-1.0f, 1.0f)},
+      .angle = q3PI * q3RandomFloat(-1.0f, 1.0f),
+      .position = {0.0f, 3.0f, 0.0f},
+      .linearVelocity = q3Vec3{q3RandomFloat(1.0f, 3.0f),
+                               q3RandomFloat(1.0f, 3.0f),
+                               q3RandomFloat(1.0f, 3.0f)} *
+                        q3Sign(q3RandomFloat(-1.0f, 1.0f)),
+      .angularVelocity = q3Vec3{q3RandomFloat(1.0f, 3.0f),
+                                q3RandomFloat(1.0f, 3.0f),
+                                q3RandomFloat(1.0f, 3.0f)} *
+                         q3Sign(q3RandomFloat(-1.0f, 1.0f)),
+      .bodyType = eDynamicBody,
+  });
+  world.scene->AddBox(body, {
+                                .m_tx = {},
+                                .m_e = q3Vec3{1.0f, 1.0f, 1.0f} * 0.5f,
+                                .m_aabbMargin = world.aabbMargin,
+                            });
+}
+
+// AABBs of every box after each step, boxes numbered by first appearance
+struct Recording {
+  std::vector<bool> isStatic;
+  std::vector<std::vector<q3AABB>> steps;
+};
+
+// Runs the scene to completion and returns the total step time
+double RunScene(void (*scene)(BenchWorld &, int), int steps,
+                q3BroadPhaseType type, Recording *recording,
+                size_t *contacts) {
+  srand(7);
+  BenchWorld world(type);
+  std::unordered_map<const q3Shape *, int> index;
+  double ms = 0.0;
+  for (int step = 0; step < steps; ++step) {
+    scene(world, step);
+    ms += BenchMs([&] { world.Step(); });
+
+    if (!recording)
+      continue;
+
+    auto &aabbs = recording->steps.emplace_back();
+    for (auto body : *world.scene) {
+      for (auto box : *body) {
+        auto [it, added] = index.try_emplace(box, int(index.size()));
+        if (added)
+          recording->isStatic.push_back(body->HasFlag(q3BodyFlags::eStatic));
+        if (int(aabbs.size()) <= it->second)
+          aabbs.resize(it->second + 1);
+        aabbs[it->second] = box->ComputeAABB(body->Transform());
+      }
+    }
+  }
+  *contacts = world.contactManager->ContactCount();
+  return ms;
+}
+
+// Feeds the recorded AABBs to a bare broadphase, so only proxy updates and
+// pair finding are timed
+double Replay(const Recording &recording, q3BroadPhaseType type,
+              size_t *pairs) {
+  q3BroadPhase broadPhase(type);
+  std::vector<std::unique_ptr<q3Body>> bodies;
+  std::vector<std::unique_ptr<q3Box>> boxes;
+  for (bool isStatic : recording.isStatic) {
+    bodies.emplace_back(
+        new q3Body({.bodyType = isStatic ? eStaticBody : eDynamicBody}));
+    boxes.emplace_back(new q3Box({}));
+  }
+
+  *pairs = 0;
+  auto count = [pairs](q3Body *, q3Shape *, q3Body *, q3Shape *) { ++*pairs; };
+  return BenchMs([&] {
+    int inserted = 0;
+    for (auto &aabbs : recording.steps) {
+      for (int i = 0; i < int(aabbs.size()); ++i) {
+        if (i < inserted)
+          broadPhase.Update(boxes[i]->BroadPhaseIndex(), aabbs[i]);
+        else
+          broadPhase.InsertBox(bodies[i].get(), boxes[i].get(), aabbs[i]);
+      }
+      inserted = int(aabbs.size());
+      broadPhase.UpdatePairs(count);
+    }
+  });
+}
+
+} // namespace
+
+// Whole steps and broadphase-only replays of the BoxStack and DropBoxes
+// demo scenes with each broadphase backend.
+void BenchSweepAndPrune() {
+  struct Scene {
+    const char *name;
+    void (*init)(BenchWorld &, int);
+    int steps;
+  } scenes[] = {{"BoxStack", BoxStack, 180}, {"DropBoxes", DropBoxes, 1200}};
+
+  struct Backend {
+    const char *name;
+    q3BroadPhaseType type;
+  } backends[] = {{"aabb tree", eAABBTreeBroadPhase},
+                  {"sweep and prune", eSweepAndPruneBroadPhase},
+                  {"hash grid", eHashGridBroadPhase}};
+
+  for (auto scene : scenes) {
+    // The tree run is recorded for the broadphase-only replays
+    Recording recording;
+    size_t contacts;
+    double treeStepMs = RunScene(scene.init, scene.steps, eAABBTreeBroadPhase,
+                                 &recording, &contacts);
+
+    printf("  %s: %zu boxes, %d steps\n", scene.name,
+           recording.isStatic.size(), scene.steps);
+    for (auto backend : backends) {
+      double stepMs = treeStepMs;
+      if (backend.type != eAABBTreeBroadPhase) {
+        stepMs = RunScene(scene.init, scene.steps, backend.type, nullptr,
+                          &contacts);
+      }
+
+      size_t pairs;
+      double ms = Replay(recording, backend.type, &pairs);
+      printf("    %-15s: steps %8.2f ms (%zu contacts), broadphase %7.2f ms "
+             "(%zu pairs)\n",
+             backend.name, stepMs, contacts, ms, pairs);
+    }
+  }
+}
+
+// Proxy reinsertions and pair churn on the DropBoxes scene, for fixed and
+// displacement-predicted fat AABBs with different margins.
+void BenchFatMargins() {
+  const int k_steps = 1200;
+
+  struct Config {
+    float margin;
+    float predictionScale;
+  } configs[] = {{0.5f, 0.0f}, {0.5f, 4.0f}, {0.1f, 0.0f},
+                 {0.1f, 4.0f}, {0.05f, 4.0f}};
+
+  printf("  DropBoxes, %d steps, per step averages\n", k_steps);
+  for (auto config : configs) {
+    srand(7);
+    BenchWorld world;
+    world.aabbMargin = config.margin;
+    world.broadPhase->SetPredictionScale(config.predictionScale);
+
+    double ms = 0.0;
+    for (int step = 0; step < k_steps; ++step) {
+      DropBoxes(world, step);
+      ms += BenchMs([&] { world.Step(); });
+    }
+
+    const q3BroadPhaseStats &stats = world.broadPhase->Stats();
+    auto &contacts = *world.contactManager;
+    printf("    margin %.2f prediction %.0f: reinsertions %6.2f, pairs %6.2f, "
+           "churn %5.2f (created %zu removed %zu), %7.2f ms\n",
+           config.margin, config.predictionScale,
+           double(stats.reinsertions) / k_steps, double(stats.pairs) / k_steps,
+           double(contacts.CreatedCount() + contacts.RemovedCount()) / k_steps,
+           contacts.CreatedCount(), contacts.RemovedCount(), ms);
+  }
+}
@@ -0,0 +1,313 @@
+#include "Bench.h"
+#include <functional>
+#include <stdint.h>
+#include <tuple>
+#include <vector>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const int k_proxies = 100000;
+const int k_queries = 20000;
+const float k_worldSize = 400.0f;
+
+q3AABB RandomBox(float halfExtent) {
+  q3Vec3 c = {q3RandomFloat(0.0f, k_worldSize), q3RandomFloat(0.0f, 40.0f),
+              q3RandomFloat(0.0f, k_worldSize)};
+  q3Vec3 e = {halfExtent, halfExtent, halfExtent};
+  return {c - e, c + e};
+}
+
+// L1 data and last level cache read misses of the calling thread, where the
+// kernel exposes hardware counters. Misses read -1 otherwise.
+class CacheMisses {
+  int m_fds[2] = {-1, -1};
+
+public:
+  CacheMisses() {
+#ifdef __linux__
+    const uint64_t caches[2] = {PERF_COUNT_HW_CACHE_L1D,
+                                PERF_COUNT_HW_CACHE_LL};
+    for (int i = 0; i < 2; ++i) {
+      perf_event_attr attr = {};
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config = caches[i] | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                    PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      m_fds[i] = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+#endif
+  }
+
+  ~CacheMisses() {
+#ifdef __linux__
+    for (int fd : m_fds) {
+      if (fd != -1)
+        close(fd);
+    }
+#endif
+  }
+
+  // Runs f and returns its misses per level
+  template <typename F> std::tuple<long long, long long> Count(F &&f) {
+    long long misses[2] = {-1, -1};
+#ifdef __linux__
+    for (int fd : m_fds) {
+      if (fd != -1) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+    f();
+    for (int i = 0; i < 2; ++i) {
+      if (m_fds[i] == -1)
+        continue;
+      ioctl(m_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+      if (read(m_fds[i], &misses[i], sizeof(misses[i])) != sizeof(misses[i]))
+        misses[i] = -1;
+    }
+#else
+    f();
+#endif
+    return {misses[0], misses[1]};
+  }
+};
+
+} // namespace
+
+// AABB and ray query throughput of the binary tree and its collapsed
+// 4-wide SIMD layout over the same proxies.
+void BenchTreeLayouts() {
+  srand(1);
+  q3DynamicAABBTree<int> tree;
+  for (int i = 0; i < k_proxies; ++i) {
+    tree.Insert(RandomBox(0.5f), i);
+  }
+
+  std::vector<q3AABB> boxes;
+  std::vector<q3RaycastData> rays;
+  for (int i = 0; i < k_queries; ++i) {
+    boxes.push_back(RandomBox(2.0f));
+    q3RaycastData ray;
+    ray.Set(RandomBox(0.0f).min,
+            q3Vec3{q3RandomFloat(-1.0f, 1.0f), q3RandomFloat(-1.0f, 1.0f),
+                   q3RandomFloat(-1.0f, 1.0f)}
+                .Normalized(),
+            30.0f);
+    rays.push_back(ray);
+  }
+
+  auto run = [&](const char *name) {
+    size_t aabbHits = 0;
+    double aabbMs = BenchMs([&] {
+      for (auto &aabb : boxes) {
+        tree.QueryAABB(
+            [&aabbHits](int) {
+              ++aabbHits;
+              return true;
+            },
+            aabb);
+      }
+    });
+    size_t rayHits = 0;
+    double rayMs = BenchMs([&] {
+      for (auto &ray : rays) {
+        tree.QueryRay(
+            [&rayHits](int) {
+              ++rayHits;
+              return true;
+            },
+            ray);
+      }
+    });
+    printf("  %-6s: aabb %8.0f queries/s (%zu hits), ray %8.0f queries/s "
+           "(%zu hits)\n",
+           name, k_queries / (aabbMs / 1000.0), aabbHits,
+           k_queries / (rayMs / 1000.0), rayHits);
+  };
+
+  printf("  %d proxies, %d queries each\n", k_proxies, k_queries);
+  run("binary");
+  double collapseMs = BenchMs([&] { tree.Collapse(); });
+  run("wide4");
+  printf("  collapse: %.2f ms\n", collapseMs);
+}
+
+// SAH cost, height and AABB query throughput of an incrementally built tree
+// before and after churn, against a SAH rebuild and a bulk insert.
+void BenchTreeQuality() {
+  srand(2);
+  std::vector<q3AABB> proxies;
+  std::vector<int> userData;
+  for (int i = 0; i < k_proxies; ++i) {
+    proxies.push_back(RandomBox(0.5f));
+    userData.push_back(i);
+  }
+  std::vector<q3AABB> boxes;
+  for (int i = 0; i < k_queries; ++i) {
+    boxes.push_back(RandomBox(2.0f));
+  }
+
+  auto report = [&](const char *name, const q3DynamicAABBTree<int> &tree,
+                    double buildMs) {
+    size_t hits = 0;
+    double ms = BenchMs([&] {
+      for (auto &aabb : boxes) {
+        tree.QueryAABB(
+            [&hits](int) {
+              ++hits;
+              return true;
+            },
+            aabb);
+      }
+    });
+    printf("  %-12s: build %7.2f ms, cost %6.2f, height %3d, aabb %8.0f "
+           "queries/s (%zu hits)\n",
+           name, buildMs, tree.Cost(), tree.Height(),
+           k_queries / (ms / 1000.0), hits);
+  };
+
+  printf("  %d proxies, %d queries\n", k_proxies, k_queries);
+
+  q3DynamicAABBTree<int> tree;
+  std::vector<int> ids(k_proxies);
+  double insertMs = BenchMs([&] {
+    for (int i = 0; i < k_proxies; ++i) {
+      ids[i] = tree.Insert(proxies[i], i);
+    }
+  });
+  report("incremental", tree, insertMs);
+
+  // Scatter a third of the proxies a few times, like bodies flying around
+  for (int round = 0; round < 4; ++round) {
+    for (int i = round; i < k_proxies; i += 3) {
+      tree.Update(ids[i], RandomBox(0.5f));
+    }
+  }
+  report("churned", tree, 0.0);
+
+  double rebuildMs = BenchMs([&] { tree.Rebuild(); });
+  report("rebuilt", tree, rebuildMs);
+
+  q3DynamicAABBTree<int> bulk;
+  std::vector<float> margins(k_proxies, k_aabbMargin);
+  double bulkMs =
+      BenchMs([&] { bulk.BulkInsert(proxies, userData, margins, ids); });
+  report("bulk insert", bulk, bulkMs);
+}
+
+// Per leaf cost of a query callback passed as std::function, the way the
+// query API used to take it, against a lambda the templated queries inline.
+void BenchQueryVisitor() {
+  srand(3);
+  q3DynamicAABBTree<int> tree;
+  for (int i = 0; i < k_proxies; ++i) {
+    tree.Insert(RandomBox(0.5f), i);
+  }
+
+  // Large queries so the leaf callbacks dominate the walk
+  std::vector<q3AABB> boxes;
+  for (int i = 0; i < 200; ++i) {
+    boxes.push_back(RandomBox(40.0f));
+  }
+
+  auto run = [&](const char *name, const auto &cb, const size_t &leaves) {
+    double ms = BenchMs([&] {
+      for (auto &aabb : boxes) {
+        tree.QueryAABB(cb, aabb);
+      }
+    });
+    printf("    %-14s: %7.2f ms, %5.2f ns/leaf (%zu leaves)\n", name, ms,
+           ms * 1.0e6 / double(leaves), leaves);
+  };
+
+  size_t leaves = 0;
+  std::function<bool(int)> erased = [&leaves](int) {
+    ++leaves;
+    return true;
+  };
+  auto inlined = [&leaves](int) {
+    ++leaves;
+    return true;
+  };
+
+  for (const char *layout : {"binary", "wide4"}) {
+    if (layout[0] == 'w')
+      tree.Collapse();
+    printf("  %s\n", layout);
+    leaves = 0;
+    run("std::function", erased, leaves);
+    leaves = 0;
+    run("lambda", inlined, leaves);
+  }
+}
+
+// Binary tree walks over 100k incrementally inserted proxies carrying the
+// broadphase payload, which is what the node layout affects: small AABB
+// queries, rays, and one query per proxy over its own fat AABB the way pair
+// finding does it. Reports time and cache misses per query.
+void BenchNodeLayout() {
+  srand(4);
+  using Payload = std::tuple<q3Body *, q3Shape *>;
+  q3DynamicAABBTree<Payload> tree;
+  std::vector<int> ids;
+  for (int i = 0; i < k_proxies; ++i) {
+    ids.push_back(tree.Insert(RandomBox(0.5f), {}));
+  }
+
+  std::vector<q3AABB> boxes;
+  std::vector<q3RaycastData> rays;
+  for (int i = 0; i < k_queries; ++i) {
+    boxes.push_back(RandomBox(2.0f));
+    q3RaycastData ray;
+    ray.Set(RandomBox(0.0f).min,
+            q3Vec3{q3RandomFloat(-1.0f, 1.0f), q3RandomFloat(-1.0f, 1.0f),
+                   q3RandomFloat(-1.0f, 1.0f)}
+                .Normalized(),
+            30.0f);
+    rays.push_back(ray);
+  }
+
+  CacheMisses counters;
+  size_t hits = 0;
+  auto cb = [&hits](int) {
+    ++hits;
+    return true;
+  };
+
+  auto run = [&](const char *name, int queries, const auto &f) {
+    hits = 0;
+    double ms = 0.0;
+    auto [l1, ll] = counters.Count([&] { ms = BenchMs(f); });
+    printf("    %-5s: %7.2f ms, %6.1f ns/query (%zu hits)", name, ms,
+           ms * 1.0e6 / queries, hits);
+    if (l1 >= 0 && ll >= 0)
+      printf(", L1d %6.1f, LLC %5.2f misses/query", double(l1) / queries,
+             double(ll) / queries);
+    printf("\n");
+  };
+
+  printf("  %d proxies\n", k_proxies);
+  run("aabb", k_queries, [&] {
+    for (auto &aabb : boxes)
+      tree.QueryAABB(cb, aabb);
+  });
+  run("ray", k_queries, [&] {
+    for (auto &ray : rays)
+      tree.QueryRay(cb, ray);
+  });
+  run("pairs", k_proxies, [&] {
+    for (int id : ids)
+      tree.QueryAABB(cb, tree.GetFatAABB(id));
+  });
+  if (std::get<0>(counters.Count([] {})) < 0)
+    printf("  hardware cache counters unavailable\n");
+}
@@ -0,0 +1,53 @@
+#include "Bench.h"
+#include <string.h>
+
+struct BenchEntry {
+  const char *name;
+  void (*run)();
+};
+
+static const BenchEntry g_benches[] = {
+    {"static_floor", BenchStaticFloor},
+    {"parallel_pairs", BenchParallelPairs},
+    {"bulk_sync", BenchBulkSync},
+    {"sweep_box", BenchSweepBox},
+    {"nearest", BenchNearest},
+    {"tree_layouts", BenchTreeLayouts},
+    {"tree_quality", BenchTreeQuality},
+    {"node_layout", BenchNodeLayout},
+    {"query_visitor", BenchQueryVisitor},
+    {"sweep_and_prune", BenchSweepAndPrune},
+    {"fat_margins", BenchFatMargins},
+    {"pair_cache", BenchPairCache},
+    {"dual_tree", BenchDualTree},
+    {"hash_grid", BenchHashGrid},
+    {"ray_batch", BenchRayBatch},
+    {"contact_storage", BenchContactStorage},
+    {"island_build", BenchIslandBuild},
+    {"parallel_narrowphase", BenchParallelNarrowphase},
+    {"contact_events", BenchContactEvents},
+    {"box_sat", BenchBoxSat},
+    {"sat_cache", BenchSatCache},
+    {"round_shapes", BenchRoundShapes},
+    {"compound", BenchCompound},
+    {"wide_solver", BenchWideSolver},
+    {"parallel_islands", BenchParallelIslands},
+};
+
+// Usage: q3bench [name...]
+// Runs every benchmark when no name is given.
+int main(int argc, char **argv) {
+  for (auto &bench : g_benches) {
+    bool selected = argc < 2;
+    for (int i = 1; i < argc; ++i) {
+      if (strcmp(argv[i], bench.name) == 0)
+        selected = true;
+    }
+    if (!selected)
+      continue;
+
+    printf("[%s]\n", bench.name);
+    bench.run();
+  }
+  return 0;
+}
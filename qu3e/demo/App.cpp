@@ -58,21 +58,25 @@ App::App(GLFWwindow *window) {
                                         broadPhase_.get()](q3Body *body) {
     broadphase->SynchronizeProxies(body);
   };
+  scene_->OnTransformsUpdated =
+      [broadphase = broadPhase_.get()](std::span<q3Body *const> bodies) {
+        broadphase->SynchronizeProxies(bodies);
+      };
   scene_->OnBoxAdd = [broadphase = broadPhase_.get()](q3Body *body,
-                                                      q3Box *box) {
+                                                      q3Shape *box) {
     broadphase->InsertBox(body, box, box->ComputeAABB(body->Transform()));
   };
   scene_->OnBoxRemove =
-      [broadphase = broadPhase_.get(),
-       contactManager = contactManager_.get()](q3Body *body, const q3Box *box) {
+      [broadphase = broadPhase_.get(), contactManager = contactManager_.get()](
+          q3Body *body, const q3Shape *box) {
         // Remove all contacts associated with this shape
-        for (q3ContactEdge *edge = contactManager->ContactEdge(body); edge;) {
-          auto constraint = edge->constraint;
-          edge = edge->next;
-          if (box == constraint->A || box == constraint->B) {
-            contactManager->RemoveContact(constraint);
-          }
-        }
+        contactManager->ForEachContact(
+            body, [&](q3ContactHandle handle, const q3ContactConstraint &contact,
+                      q3Body *) {
+              if (box == contact.A || box == contact.B) {
+                contactManager->RemoveContact(handle);
+              }
+            });
         broadphase->RemoveBox(box);
       };
 
@@ -221,6 +225,7 @@ void App::Frame(int w, int h) {
       ImGui::Checkbox("Single Step", &singleStep_);
     ImGui::Checkbox("Sleeping", &env_.m_allowSleep);
     ImGui::Checkbox("Friction", &env_.m_enableFriction);
+    ImGui::Checkbox("Wide Solver", &env_.m_wideSolver);
     ImGui::SliderInt("Iterations", &env_.m_iterations, 1, 50);
     int flags = (1 << 0) | (1 << 1) | (1 << 2);
     ImGui::InputText("Dump File Name", sceneFileName_,
@@ -34,7 +34,7 @@ public:
   q3Vec3 nfinal;
   q3Body *impactBody;
 
-  bool ReportShape(q3Body *body, q3Box *shape) {
+  bool ReportShape(q3Body *body, q3Shape *shape) {
     if (data.toi < tfinal) {
       tfinal = data.toi;
       nfinal = data.normal;
@@ -25,23 +25,117 @@ distribution.
 */
 
 #include "q3BroadPhase.h"
+#include "../math/q3Math.h"
+#include "../q3ThreadPool.h"
 #include "../scene/q3Body.h"
-#include "../scene/q3Box.h"
+#include "../scene/q3Shape.h"
 #include <Remotery.h>
 #include <algorithm>
 
-q3BroadPhase::q3BroadPhase() {}
+q3BroadPhase::q3BroadPhase(q3BroadPhaseType type) : m_type(type) {}
 
 q3BroadPhase::~q3BroadPhase() {}
 
-void q3BroadPhase::InsertBox(q3Body *body, q3Box *box, const q3AABB &aabb) {
-  int id = m_tree.Insert(aabb, {body, box});
-  box->SetBroadPhaseIndex(id);
+void q3BroadPhase::InsertBox(q3Body *body, q3Shape *box, const q3AABB &aabb) {
+  if (body->HasFlag(q3BodyFlags::eCompound)) {
+    InsertCompoundBox(body, box);
+    return;
+  }
+
+  if (m_bulkInsert && m_type == eAABBTreeBroadPhase) {
+    m_pending.push_back({body, box, aabb});
+    return;
+  }
+
+  box->SetBroadPhaseIndex(InsertProxy(body, box, aabb, box->AABBMargin()));
+}
+
+int q3BroadPhase::InsertProxy(q3Body *body, q3Shape *box, const q3AABB &aabb,
+                              float margin) {
+  if (m_type != eAABBTreeBroadPhase) {
+    // Neither backend gains from deferring inserts, so bulk inserts go
+    // straight through
+    bool isStatic = body->HasFlag(q3BodyFlags::eStatic);
+    int node = WithProxyList([&](auto &list) {
+      return list.Insert(aabb, {body, box}, isStatic, margin);
+    });
+    int id = isStatic ? StaticProxy(node) : DynamicProxy(node);
+    ClaimProxy(id);
+    return id;
+  }
+
+  if (body->HasFlag(q3BodyFlags::eStatic)) {
+    int id = StaticProxy(m_staticTree.Insert(aabb, {body, box}, margin));
+    ClaimProxy(id);
+    BufferTouching(id);
+    return id;
+  }
+
+  int id = DynamicProxy(m_dynamicTree.Insert(aabb, {body, box}, margin));
+  ClaimProxy(id);
   BufferMove(id);
+  return id;
+}
+
+void q3BroadPhase::InsertCompoundBox(q3Body *body, q3Shape *box) {
+  q3CompoundTree &tree = m_compounds[body];
+  tree.Add(box);
+  m_changedCompounds.push_back(body);
+
+  // The first box makes the proxy, the others grow it
+  q3AABB aabb = tree.ComputeAABB(body->Transform());
+  int id = tree.Boxes()[0]->BroadPhaseIndex();
+  if (tree.Boxes().size() == 1)
+    id = InsertProxy(body, nullptr, aabb, tree.Margin());
+  else
+    Update(id, aabb);
+  box->SetBroadPhaseIndex(id);
 }
 
-void q3BroadPhase::RemoveBox(const q3Box *box) {
-  m_tree.Remove(box->BroadPhaseIndex());
+void q3BroadPhase::RemoveBox(const q3Shape *box) {
+  int id = box->BroadPhaseIndex();
+  auto [body, proxyBox] = GetUserData(id);
+  if (!proxyBox) {
+    RemoveCompoundBox(body, box);
+    return;
+  }
+
+  RemoveProxy(id);
+}
+
+void q3BroadPhase::RemoveProxy(int id) {
+  AddProxyEvent(id, eRemoved);
+  if (m_type != eAABBTreeBroadPhase) {
+    WithProxyList([id](auto &list) { list.Remove(ProxyNode(id)); });
+    return;
+  }
+
+  if (!IsStaticProxy(id)) {
+    UnBufferMove(id);
+  }
+  ProxyTree(id).Remove(ProxyNode(id));
+}
+
+void q3BroadPhase::RemoveCompoundBox(const q3Body *body, const q3Shape *box) {
+  int id = box->BroadPhaseIndex();
+  q3CompoundTree &tree = m_compounds.at(body);
+  tree.Remove(box);
+  if (tree.Empty()) {
+    m_compounds.erase(body);
+    std::erase(m_changedCompounds, body);
+    RemoveProxy(id);
+    return;
+  }
+
+  // The box's contacts go with it, so its pairs are dropped without an end.
+  // The proxy shrinks with the next SynchronizeProxies.
+  for (auto &[key, pairs] : m_compoundPairs) {
+    if (key.first == id || key.second == id) {
+      std::erase_if(pairs, [box](const BoxPair &pair) {
+        return pair.A == box || pair.B == box;
+      });
+    }
+  }
 }
 
 void q3BroadPhase::RemoveBody(q3Body *body) {
@@ -50,58 +144,99 @@ void q3BroadPhase::RemoveBody(q3Body *body) {
   }
 }
 
-inline bool ContactPairSort(const q3ContactPair &lhs,
-                            const q3ContactPair &rhs) {
-  if (lhs.A < rhs.A)
-    return true;
+void q3BroadPhase::BeginBulkInsert() {
+  assert(!m_bulkInsert);
+  m_bulkInsert = true;
+}
 
-  if (lhs.A == rhs.A)
-    return lhs.B < rhs.B;
+void q3BroadPhase::EndBulkInsert() {
+  assert(m_bulkInsert);
+  m_bulkInsert = false;
 
-  return false;
+  // Both trees get rebuilt, so gather each side's new boxes in one pass
+  std::vector<q3AABB> aabbs;
+  std::vector<Payload> payloads;
+  std::vector<float> margins;
+  std::vector<int> ids;
+  for (bool isStatic : {true, false}) {
+    aabbs.clear();
+    payloads.clear();
+    margins.clear();
+    for (const PendingBox &p : m_pending) {
+      if (p.body->HasFlag(q3BodyFlags::eStatic) == isStatic) {
+        aabbs.push_back(p.aabb);
+        payloads.push_back({p.body, p.box});
+        margins.push_back(p.box->AABBMargin());
+      }
+    }
+
+    ids.resize(aabbs.size());
+    (isStatic ? m_staticTree : m_dynamicTree)
+        .BulkInsert(aabbs, payloads, margins, ids);
+
+    for (int i = 0; i < int(ids.size()); ++i) {
+      q3Shape *box = std::get<1>(payloads[i]);
+      ClaimProxy(isStatic ? StaticProxy(ids[i]) : DynamicProxy(ids[i]));
+      if (isStatic) {
+        box->SetBroadPhaseIndex(StaticProxy(ids[i]));
+        BufferTouching(StaticProxy(ids[i]));
+      } else {
+        box->SetBroadPhaseIndex(DynamicProxy(ids[i]));
+        BufferMove(DynamicProxy(ids[i]));
+      }
+    }
+  }
+
+  m_pending.clear();
 }
 
-void q3BroadPhase::UpdatePairs(
-    const std::function<void(q3Body *bodyA, q3Box *A, q3Body *bodyB, q3Box *B)>
-        &addContact) {
+// A lambda rather than a function, so std::sort inlines the comparison.
+// Ids are never negative, so this orders by A, then by B.
+const auto ContactPairSort = [](const q3ContactPair &lhs,
+                                const q3ContactPair &rhs) {
+  return (uint64_t(lhs.A) << 32 | uint32_t(lhs.B)) <
+         (uint64_t(rhs.A) << 32 | uint32_t(rhs.B));
+};
+
+void q3BroadPhase::UpdatePairs(const q3PairCallback &beginPair,
+                               const q3PairCallback &endPair) {
   rmt_ScopedCPUSample(q3BroadPhaseUpdatePairs, 0);
 
+  BuildCompoundTrees();
+
   m_pairBuffer.clear();
 
-  // Query the tree with all moving boxs
-  for (int i = 0; i < m_moveBuffer.size(); ++i) {
-    m_currentIndex = m_moveBuffer[i];
-    q3AABB aabb = m_tree.GetFatAABB(m_currentIndex);
+  if (m_type != eAABBTreeBroadPhase)
+    FindListPairs();
+  else
+    FindTreePairs();
 
-    // @TODO: Use a static and non-static tree and query one against the other.
-    //        This will potentially prevent (gotta think about this more) time
-    //        wasted with queries of static bodies against static bodies, and
-    //        kinematic to kinematic.
-    m_tree.QueryAABB(
-        std::bind(&q3BroadPhase::TreeCallBack, this, std::placeholders::_1),
-        aabb);
-  }
+  EndPairs(endPair);
+  UpdateCompoundPairs(beginPair, endPair);
 
-  // Reset the move buffer
-  m_moveBuffer.clear();
-
-  // Sort pairs to expose duplicates
-  std::sort(m_pairBuffer.begin(), m_pairBuffer.end(), ContactPairSort);
-
-  // Queue manifolds for solving
+  // Report the pairs that were not overlapping before
   {
     int i = 0;
-    while (i < m_pairBuffer.size()) {
-      // Add contact to manager
+    while (i < int(m_pairBuffer.size())) {
       q3ContactPair *pair = &m_pairBuffer[i];
-      auto [bodyA, A] = m_tree.GetUserData(pair->A);
-      auto [bodyB, B] = m_tree.GetUserData(pair->B);
-      addContact(bodyA, A, bodyB, B);
+      ++m_stats.pairs;
+      if (!HasPair(pair->A, pair->B)) {
+        m_proxyPairs[pair->A].push_back(pair->B);
+        m_proxyPairs[pair->B].push_back(pair->A);
+        auto [bodyA, A] = GetUserData(pair->A);
+        auto [bodyB, B] = GetUserData(pair->B);
+        if (A && B) {
+          beginPair(bodyA, A, bodyB, B);
+          ++m_stats.begun;
+        } else {
+          BeginCompoundPair(pair->A, pair->B, beginPair);
+        }
+      }
 
       ++i;
 
       // Skip duplicate pairs by iterating i until we find a unique pair
-      while (i < m_pairBuffer.size()) {
+      while (i < int(m_pairBuffer.size())) {
         q3ContactPair *potentialDup = &m_pairBuffer[i];
 
         if (pair->A != potentialDup->A || pair->B != potentialDup->B)
@@ -112,87 +247,868 @@ void q3BroadPhase::UpdatePairs(
     }
   }
 
-  m_tree.Validate();
+  m_staticTree.Validate();
+  m_dynamicTree.Validate();
 }
 
-void q3BroadPhase::Update(int id, const q3AABB &aabb) {
-  if (m_tree.Update(id, aabb))
-    BufferMove(id);
+void q3BroadPhase::ClaimProxy(int id) {
+  if (id >= int(m_proxyEvents.size())) {
+    m_proxyEvents.resize(id + 1);
+    m_proxyPairs.resize(id + 1);
+  } else if (m_proxyEvents[id] & eRemoved) {
+    DropRemovedPairs(id);
+  }
+}
+
+void q3BroadPhase::AddProxyEvent(int id, ProxyEvent event) {
+  assert(id < int(m_proxyEvents.size()));
+  if (m_proxyEvents[id] == 0)
+    m_eventProxies.push_back(id);
+  m_proxyEvents[id] |= event;
+}
+
+bool q3BroadPhase::HasPair(int a, int b) const {
+  const std::vector<int> &othersA = m_proxyPairs[a];
+  const std::vector<int> &othersB = m_proxyPairs[b];
+  if (othersB.size() < othersA.size())
+    return std::find(othersB.begin(), othersB.end(), a) != othersB.end();
+  return std::find(othersA.begin(), othersA.end(), b) != othersA.end();
+}
+
+void q3BroadPhase::RemovePair(int a, int b) {
+  for (auto [id, other] : {std::pair{a, b}, std::pair{b, a}}) {
+    std::vector<int> &others = m_proxyPairs[id];
+    auto it = std::find(others.begin(), others.end(), other);
+    *it = others.back();
+    others.pop_back();
+  }
+}
+
+void q3BroadPhase::DropRemovedPairs(int id) {
+  std::vector<int> &others = m_proxyPairs[id];
+  while (!others.empty()) {
+    int other = others.back();
+    q3ContactPair pair = {std::min(id, other), std::max(id, other)};
+    RemovePair(pair.A, pair.B);
+    m_compoundPairs.erase({pair.A, pair.B});
+  }
+  m_proxyEvents[id] &= ~eRemoved;
+}
+
+void q3BroadPhase::EndPairs(const q3PairCallback &endPair) {
+  if (m_eventProxies.empty())
+    return;
+
+  // Pairs of proxies without events keep their fat AABBs, so they still
+  // overlap and need no test. A pair of two proxies with events is visited
+  // from the lower id only.
+  std::vector<q3ContactPair> removed;
+  std::vector<q3ContactPair> ended;
+  for (int id : m_eventProxies) {
+    for (int other : m_proxyPairs[id]) {
+      if (m_proxyEvents[other] && other < id)
+        continue;
+      q3ContactPair pair = {std::min(id, other), std::max(id, other)};
+      uint8_t events = m_proxyEvents[id] | m_proxyEvents[other];
+      if (events & eRemoved)
+        removed.push_back(pair);
+      else if (!TestOverlap(pair.A, pair.B))
+        ended.push_back(pair);
+    }
+  }
+
+  for (int id : m_eventProxies)
+    m_proxyEvents[id] = 0;
+  m_eventProxies.clear();
+
+  for (auto pair : removed) {
+    RemovePair(pair.A, pair.B);
+    m_compoundPairs.erase({pair.A, pair.B});
+  }
+
+  std::sort(ended.begin(), ended.end(), ContactPairSort);
+  for (auto pair : ended) {
+    RemovePair(pair.A, pair.B);
+    auto [bodyA, A] = GetUserData(pair.A);
+    auto [bodyB, B] = GetUserData(pair.B);
+    if (!A || !B) {
+      // All box pairs of the two bodies end with them
+      auto it = m_compoundPairs.find({pair.A, pair.B});
+      for (const BoxPair &boxes : it->second) {
+        if (endPair)
+          endPair(bodyA, boxes.A, bodyB, boxes.B);
+        ++m_stats.ended;
+      }
+      m_compoundPairs.erase(it);
+      continue;
+    }
+
+    if (endPair)
+      endPair(bodyA, A, bodyB, B);
+    ++m_stats.ended;
+  }
+}
+
+// Box pairs of compounds begin once the boxes' bounds touch and end once they
+// are apart by more than a quarter of their margins. They are checked every
+// step against the positions the narrowphase sees next, so unlike proxies
+// they need no room for motion, only enough to not flicker.
+const float k_boxPairBeginScale = float(0.0);
+const float k_boxPairEndScale = float(0.25);
+
+void q3BroadPhase::FindBoxPairs(int a, int b, std::vector<BoxPair> &pairs,
+                                float scale) const {
+  auto [bodyA, A] = GetUserData(a);
+  auto [bodyB, B] = GetUserData(b);
+  // Such pairs never make contacts, so they are not broken down
+  if (!bodyA->CanCollide(bodyB))
+    return;
+
+  if (A || B) {
+    // One box against the tree of the other body, A first either way
+    bool first = A != nullptr;
+    q3Body *single = first ? bodyA : bodyB;
+    q3Shape *box = first ? A : B;
+    q3Body *compound = first ? bodyB : bodyA;
+    const q3CompoundTree &tree = m_compounds.at(compound);
+    float margin = box->AABBMargin() + tree.Margin();
+    tree.QueryGaps(
+        [&](q3Shape *other, float gap) {
+          if (first)
+            pairs.push_back({box, other, gap / margin});
+          else
+            pairs.push_back({other, box, gap / margin});
+          return true;
+        },
+        compound->Transform(), box->ComputeAABB(single->Transform()),
+        margin * scale);
+    return;
+  }
+
+  const q3CompoundTree &treeA = m_compounds.at(bodyA);
+  const q3CompoundTree &treeB = m_compounds.at(bodyB);
+  float margin = treeA.Margin() + treeB.Margin();
+  treeA.QueryOverlaps(
+      [&](q3Shape *boxA, q3Shape *boxB, float gap) {
+        pairs.push_back({boxA, boxB, gap / margin});
+      },
+      bodyA->Transform(), treeB, bodyB->Transform(), margin * scale);
+}
+
+void q3BroadPhase::BeginCompoundPair(int a, int b,
+                                     const q3PairCallback &beginPair) {
+  std::vector<BoxPair> &pairs = m_compoundPairs[{a, b}];
+  FindBoxPairs(a, b, pairs, k_boxPairBeginScale);
+
+  q3Body *bodyA = std::get<0>(GetUserData(a));
+  q3Body *bodyB = std::get<0>(GetUserData(b));
+  for (const BoxPair &boxes : pairs) {
+    beginPair(bodyA, boxes.A, bodyB, boxes.B);
+    ++m_stats.begun;
+  }
+}
+
+void q3BroadPhase::UpdateCompoundPairs(const q3PairCallback &beginPair,
+                                       const q3PairCallback &endPair) {
+  // Sleeping and static bodies stay put, so their box pairs can only change
+  // with the boxes of a compound
+  auto moved = [this](const q3Body *body) {
+    if (body->IsAwake() && !body->HasFlag(q3BodyFlags::eStatic))
+      return true;
+    return std::find(m_changedCompounds.begin(), m_changedCompounds.end(),
+                     body) != m_changedCompounds.end();
+  };
+  auto less = [](const BoxPair &x, const BoxPair &y) {
+    return x.A < y.A || (x.A == y.A && x.B < y.B);
+  };
+
+  for (auto &[key, pairs] : m_compoundPairs) {
+    q3Body *bodyA = std::get<0>(GetUserData(key.first));
+    q3Body *bodyB = std::get<0>(GetUserData(key.second));
+    if (!moved(bodyA) && !moved(bodyB))
+      continue;
+
+    // Candidates that may persist, the new ones among them must also be
+    // close enough to begin
+    m_boxPairs.clear();
+    FindBoxPairs(key.first, key.second, m_boxPairs, k_boxPairEndScale);
+
+    // Both lists are in walk order, which is the order pairs are reported
+    // in; the sorted copies only answer which pairs are in the other list
+    m_sortedBoxPairs = m_boxPairs;
+    std::sort(m_sortedBoxPairs.begin(), m_sortedBoxPairs.end(), less);
+    for (const BoxPair &boxes : pairs) {
+      if (!std::binary_search(m_sortedBoxPairs.begin(), m_sortedBoxPairs.end(),
+                              boxes, less)) {
+        if (endPair)
+          endPair(bodyA, boxes.A, bodyB, boxes.B);
+        ++m_stats.ended;
+      }
+    }
+
+    m_sortedBoxPairs = pairs;
+    std::sort(m_sortedBoxPairs.begin(), m_sortedBoxPairs.end(), less);
+    pairs.clear();
+    for (const BoxPair &boxes : m_boxPairs) {
+      if (std::binary_search(m_sortedBoxPairs.begin(), m_sortedBoxPairs.end(),
+                             boxes, less)) {
+        pairs.push_back(boxes);
+      } else if (boxes.scale <= k_boxPairBeginScale) {
+        beginPair(bodyA, boxes.A, bodyB, boxes.B);
+        ++m_stats.begun;
+        pairs.push_back(boxes);
+      }
+    }
+  }
+
+  m_changedCompounds.clear();
+}
+
+void q3BroadPhase::BuildCompoundTrees() const {
+  for (const q3Body *body : m_changedCompounds)
+    m_compounds.at(body).Build();
+}
+
+void q3BroadPhase::FindTreePairs() {
+  if (m_rebuildThreshold > float(0.0)) {
+    m_staticTree.RebuildIfDegraded(m_rebuildThreshold);
+    m_dynamicTree.RebuildIfDegraded(m_rebuildThreshold);
+  }
+
+  // Refresh the wide query layouts after this step's proxy updates
+  if (!m_staticTree.IsCollapsed())
+    m_staticTree.Collapse();
+  if (m_collapseDynamicTree && !m_dynamicTree.IsCollapsed())
+    m_dynamicTree.Collapse();
+
+  if (FindDualTreePairs()) {
+    std::sort(m_pairBuffer.begin(), m_pairBuffer.end(), ContactPairSort);
+    m_moveBuffer.clear();
+    return;
+  }
+
+  // Query both trees with all moving boxes. Static boxes are never in the
+  // move buffer, so static vs static pairs are never visited.
+  const int k_chunkSize = 64;
+  int chunkCount = int((m_moveBuffer.size() + k_chunkSize - 1) / k_chunkSize);
+  if (m_pool && chunkCount > 1) {
+    // Tree queries are read-only; only the pair buffers are per thread
+    m_threadPairs.resize(m_pool->ThreadCount());
+    for (auto &pairs : m_threadPairs)
+      pairs.clear();
+
+    m_pool->ParallelFor(chunkCount, [this](int chunk, int thread) {
+      int end = std::min(int(m_moveBuffer.size()), (chunk + 1) * k_chunkSize);
+      for (int i = chunk * k_chunkSize; i < end; ++i) {
+        if (m_moveBuffer[i] != Null)
+          QueryPairs(m_moveBuffer[i], m_threadPairs[thread]);
+      }
+    });
+
+    // Sort each thread's pairs, then merge. The merged buffer is in the
+    // same order a single sort of all pairs produces.
+    m_pool->ParallelFor(int(m_threadPairs.size()), [this](int i, int) {
+      std::sort(m_threadPairs[i].begin(), m_threadPairs[i].end(),
+                ContactPairSort);
+    });
+    for (auto &pairs : m_threadPairs) {
+      size_t middle = m_pairBuffer.size();
+      m_pairBuffer.insert(m_pairBuffer.end(), pairs.begin(), pairs.end());
+      std::inplace_merge(m_pairBuffer.begin(), m_pairBuffer.begin() + middle,
+                         m_pairBuffer.end(), ContactPairSort);
+    }
+  } else {
+    for (int i = 0; i < int(m_moveBuffer.size()); ++i) {
+      if (m_moveBuffer[i] != Null)
+        QueryPairs(m_moveBuffer[i], m_pairBuffer);
+    }
+
+    // Sort pairs to expose duplicates
+    std::sort(m_pairBuffer.begin(), m_pairBuffer.end(), ContactPairSort);
+  }
+
+  // Reset the move buffer
+  m_moveBuffer.clear();
+}
+
+bool q3BroadPhase::FindDualTreePairs() {
+  // The move buffer may list a proxy twice, count each node once
+  int moved = 0;
+  m_movedNodes.clear();
+  for (int id : m_moveBuffer) {
+    if (id == Null)
+      continue;
+
+    int node = ProxyNode(id);
+    if (node >= int(m_movedNodes.size()))
+      m_movedNodes.resize(node + 1);
+    if (!m_movedNodes[node]) {
+      m_movedNodes[node] = 1;
+      ++moved;
+    }
+  }
+
+  int threadCount = m_pool ? m_pool->ThreadCount() : 1;
+  if (moved <= m_dualTreeFraction * float(threadCount) *
+                   float(m_dynamicTree.LeafCount()))
+    return false;
+
+  // Keep only pairs with a moved proxy, the same pairs the per proxy
+  // queries find, minus their duplicates
+  auto isMoved = [this](int node) {
+    return node < int(m_movedNodes.size()) && m_movedNodes[node];
+  };
+  m_dynamicTree.QuerySelfOverlaps([&](int a, int b) {
+    if (isMoved(a) || isMoved(b)) {
+      m_pairBuffer.push_back({
+          .A = DynamicProxy(std::min(a, b)),
+          .B = DynamicProxy(std::max(a, b)),
+      });
+    }
+  });
+  m_dynamicTree.QueryOverlaps(
+      [&](int a, int b) {
+        if (isMoved(a)) {
+          int idA = DynamicProxy(a);
+          int idB = StaticProxy(b);
+          m_pairBuffer.push_back({
+              .A = std::min(idA, idB),
+              .B = std::max(idA, idB),
+          });
+        }
+      },
+      m_staticTree);
+  return true;
+}
+
+void q3BroadPhase::FindListPairs() {
+  WithProxyList([this](auto &list) {
+    list.FindPairs([this, &list](int a, int b) {
+      // Encode like InsertBox did, then order the pair as the trees do
+      int idA = list.IsStatic(a) ? StaticProxy(a) : DynamicProxy(a);
+      int idB = list.IsStatic(b) ? StaticProxy(b) : DynamicProxy(b);
+      m_pairBuffer.push_back({
+          .A = std::min(idA, idB),
+          .B = std::max(idA, idB),
+      });
+    });
+  });
+
+  std::sort(m_pairBuffer.begin(), m_pairBuffer.end(), ContactPairSort);
+}
+
+void q3BroadPhase::Update(int id, const q3AABB &aabb,
+                          const q3Vec3 &displacement) {
+  if (m_type != eAABBTreeBroadPhase) {
+    bool moved = WithProxyList([&](auto &list) {
+      return list.Update(ProxyNode(id), aabb, displacement);
+    });
+    if (moved) {
+      ++m_stats.reinsertions;
+      AddProxyEvent(id, eRefattened);
+    }
+    return;
+  }
+
+  if (ProxyTree(id).Update(ProxyNode(id), aabb, displacement)) {
+    ++m_stats.reinsertions;
+    AddProxyEvent(id, eRefattened);
+    if (IsStaticProxy(id))
+      BufferTouching(id);
+    else
+      BufferMove(id);
+  }
 }
 
 bool q3BroadPhase::TestOverlap(int A, int B) const {
-  return m_tree.GetFatAABB(A).IsOverlapped(m_tree.GetFatAABB(B));
+  return GetFatAABB(A).IsOverlapped(GetFatAABB(B));
 }
 
 void q3BroadPhase::SynchronizeProxies(q3Body *body) {
+  // The transform still holds last step's position until UpdatePosition
+  q3Vec3 previous = body->Transform().position;
   auto m_tx = body->UpdatePosition();
+  q3Vec3 displacement = (m_tx.position - previous) * m_predictionScale;
+
+  if (body->HasFlag(q3BodyFlags::eCompound)) {
+    auto it = m_compounds.find(body);
+    if (it != m_compounds.end()) {
+      Update((*body->begin())->BroadPhaseIndex(),
+             it->second.ComputeAABB(m_tx), displacement);
+    }
+    return;
+  }
 
   for (auto box : *body) {
-    Update(box->BroadPhaseIndex(), box->ComputeAABB(m_tx));
+    Update(box->BroadPhaseIndex(), box->ComputeAABB(m_tx), displacement);
   }
 }
 
+void q3BroadPhase::SynchronizeProxies(std::span<q3Body *const> bodies) {
+  rmt_ScopedCPUSample(q3BroadPhaseSynchronizeProxies, 0);
+
+  // Lay the proxies of all bodies out flat: one per box, or one for all
+  // boxes of a compound
+  m_syncOffsets.resize(bodies.size() + 1);
+  int count = 0;
+  for (int i = 0; i < int(bodies.size()); ++i) {
+    m_syncOffsets[i] = count;
+    if (bodies[i]->HasFlag(q3BodyFlags::eCompound))
+      count += m_compounds.contains(bodies[i]) ? 1 : 0;
+    else
+      count += int(std::distance(bodies[i]->begin(), bodies[i]->end()));
+  }
+  m_syncOffsets[bodies.size()] = count;
+  m_syncIds.resize(count);
+  m_syncAABBs.resize(count);
+  m_syncDisplacements.resize(count);
+
+  // Bodies only touch their own transform and boxes
+  auto computeAABBs = [this, bodies](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      q3Body *body = bodies[i];
+      q3Vec3 previous = body->Transform().position;
+      auto tx = body->UpdatePosition();
+      q3Vec3 displacement = (tx.position - previous) * m_predictionScale;
+
+      int index = m_syncOffsets[i];
+      if (body->HasFlag(q3BodyFlags::eCompound)) {
+        if (index < m_syncOffsets[i + 1]) {
+          m_syncIds[index] = (*body->begin())->BroadPhaseIndex();
+          m_syncAABBs[index] = m_compounds.at(body).ComputeAABB(tx);
+          m_syncDisplacements[index] = displacement;
+        }
+        continue;
+      }
+      for (auto box : *body) {
+        m_syncIds[index] = box->BroadPhaseIndex();
+        m_syncAABBs[index] = box->ComputeAABB(tx);
+        m_syncDisplacements[index] = displacement;
+        ++index;
+      }
+    }
+  };
+  const int k_chunkSize = 64;
+  int chunkCount = int((bodies.size() + k_chunkSize - 1) / k_chunkSize);
+  if (m_pool && chunkCount > 1) {
+    m_pool->ParallelFor(chunkCount, [&](int chunk, int) {
+      computeAABBs(chunk * k_chunkSize,
+                   std::min(int(bodies.size()), (chunk + 1) * k_chunkSize));
+    });
+  } else {
+    computeAABBs(0, int(bodies.size()));
+  }
+
+  if (m_type != eAABBTreeBroadPhase) {
+    for (int i = 0; i < count; ++i)
+      Update(m_syncIds[i], m_syncAABBs[i], m_syncDisplacements[i]);
+    return;
+  }
+
+  // Keep the dynamic proxies in place and turn their ids into tree nodes.
+  // Static ones are rare here and go through Update once the dynamic tree
+  // is current, since they query it.
+  struct StaticSync {
+    int id;
+    q3AABB aabb;
+    q3Vec3 displacement;
+  };
+  std::vector<StaticSync> statics;
+  int dynamicCount = 0;
+  for (int i = 0; i < count; ++i) {
+    if (IsStaticProxy(m_syncIds[i])) {
+      statics.push_back({m_syncIds[i], m_syncAABBs[i], m_syncDisplacements[i]});
+      continue;
+    }
+    m_syncIds[dynamicCount] = ProxyNode(m_syncIds[i]);
+    m_syncAABBs[dynamicCount] = m_syncAABBs[i];
+    m_syncDisplacements[dynamicCount] = m_syncDisplacements[i];
+    ++dynamicCount;
+  }
+
+  m_syncMoved.clear();
+  m_dynamicTree.UpdateBulk(
+      std::span(m_syncIds).first(dynamicCount),
+      std::span(m_syncAABBs).first(dynamicCount),
+      std::span(m_syncDisplacements).first(dynamicCount), m_syncMoved);
+  for (int i : m_syncMoved) {
+    int id = DynamicProxy(m_syncIds[i]);
+    ++m_stats.reinsertions;
+    AddProxyEvent(id, eRefattened);
+    BufferMove(id);
+  }
+
+  for (auto &sync : statics)
+    Update(sync.id, sync.aabb, sync.displacement);
+}
+
 void q3BroadPhase::BufferMove(int id) { m_moveBuffer.push_back(id); }
 
-bool q3BroadPhase::TreeCallBack(int index) {
-  // Cannot collide with self
-  if (index == m_currentIndex)
-    return true;
+void q3BroadPhase::UnBufferMove(int id) {
+  for (auto &moved : m_moveBuffer) {
+    if (moved == id)
+      moved = Null;
+  }
+}
 
-  int iA = std::min(index, m_currentIndex);
-  int iB = std::max(index, m_currentIndex);
+void q3BroadPhase::BufferTouching(int staticId) {
+  m_dynamicTree.QueryAABB(
+      [this](int node) {
+        BufferMove(DynamicProxy(node));
+        return true;
+      },
+      GetFatAABB(staticId));
+}
 
-  m_pairBuffer.push_back({
-      .A = iA,
-      .B = iB,
-  });
+void q3BroadPhase::QueryPairs(int id, std::vector<q3ContactPair> &pairs) const {
+  auto addPair = [id, &pairs](int index) {
+    // Cannot collide with self
+    if (index == id)
+      return true;
 
-  return true;
+    pairs.push_back({
+        .A = std::min(index, id),
+        .B = std::max(index, id),
+    });
+
+    return true;
+  };
+
+  q3AABB aabb = GetFatAABB(id);
+  m_dynamicTree.QueryAABB(
+      [&addPair](int node) { return addPair(DynamicProxy(node)); }, aabb);
+  m_staticTree.QueryAABB(
+      [&addPair](int node) { return addPair(StaticProxy(node)); }, aabb);
 }
 
 void q3BroadPhase::QueryAABB(
-    const std::function<bool(q3Body *body, q3Box *box)> &cb,
+    const std::function<bool(q3Body *body, q3Shape *box)> &cb,
     const q3AABB &aabb) const {
-  m_tree.QueryAABB(
-      [broadPhase = this, cb, m_aabb = aabb](int id) {
-        auto [body, box] = broadPhase->m_tree.GetUserData(id);
-        if (m_aabb.IsOverlapped(box->ComputeAABB(body->Transform()))) {
-          return cb(body, box);
-        }
-        return true;
-      },
-      aabb);
+  QueryAABB<decltype(cb)>(cb, aabb);
 }
 
 void q3BroadPhase::QueryPoint(
-    const std::function<bool(q3Body *body, q3Box *box)> &cb,
+    const std::function<bool(q3Body *body, q3Shape *box)> &cb,
     const q3Vec3 &point) const {
-  const float k_fattener = float(0.5);
-  q3Vec3 v{k_fattener, k_fattener, k_fattener};
-  q3AABB aabb;
-  aabb.min = point - v;
-  aabb.max = point + v;
-  m_tree.QueryAABB(
-      [broadPhase = this, m_point = point, cb](int id) {
-        auto [body, box] = broadPhase->m_tree.GetUserData(id);
-        if (box->TestPoint(body->Transform(), m_point)) {
-          cb(body, box);
-        }
-        return true;
-      },
-      aabb);
+  QueryPoint<decltype(cb)>(cb, point);
 }
 
 void q3BroadPhase::RayCast(
-    const std::function<bool(q3Body *body, q3Box *box)> &cb,
+    const std::function<bool(q3Body *body, q3Shape *box)> &cb,
     q3RaycastData &rayCast) const {
-  m_tree.QueryRay(
-      [m_rayCast = &rayCast, broadPhase = this, cb](int id) {
-        auto [body, box] = broadPhase->m_tree.GetUserData(id);
-        if (box->Raycast(body->Transform(), m_rayCast)) {
-          return cb(body, box);
+  RayCast<decltype(cb)>(cb, rayCast);
+}
+
+void q3BroadPhase::QueryKNearest(const q3Vec3 &point, int k,
+                                 std::vector<q3NearestHit> &hits,
+                                 float maxDistance) const {
+  rmt_ScopedCPUSample(q3BroadPhaseQueryKNearest, 0);
+
+  hits.clear();
+  if (k <= 0)
+    return;
+
+  // hits is a max heap on distance while searching, so its front is the
+  // k-th nearest box once k are found
+  auto farther = [](const q3NearestHit &a, const q3NearestHit &b) {
+    return a.distance < b.distance;
+  };
+  float maxDistanceSq = maxDistance * maxDistance;
+  auto bound = [&] {
+    if (int(hits.size()) < k)
+      return maxDistanceSq;
+    return hits.front().distance * hits.front().distance;
+  };
+  auto testBox = [&](q3Body *body, q3Shape *box) {
+    float distance = box->Distance(body->Transform(), point);
+    if (distance > maxDistance)
+      return;
+
+    if (int(hits.size()) < k) {
+      hits.push_back({body, box, distance});
+      std::push_heap(hits.begin(), hits.end(), farther);
+    } else if (distance < hits.front().distance) {
+      std::pop_heap(hits.begin(), hits.end(), farther);
+      hits.back() = {body, box, distance};
+      std::push_heap(hits.begin(), hits.end(), farther);
+    }
+  };
+  // Every box of a compound, its proxy's distance bounds them all
+  auto test = [&](const Payload &payload) {
+    auto [body, box] = payload;
+    if (box) {
+      testBox(body, box);
+      return;
+    }
+    for (q3Shape *box : m_compounds.at(body).Boxes())
+      testBox(body, box);
+  };
+
+  if (m_type != eAABBTreeBroadPhase) {
+    WithProxyList([&](const auto &list) {
+      list.ForEach([&](int id) {
+        if (list.GetFatAABB(id).DistanceSq(point) <= bound())
+          test(list.GetUserData(id));
+      });
+    });
+  } else {
+    for (auto tree : {&m_dynamicTree, &m_staticTree}) {
+      tree->QueryNearest(
+          [&](int id, float) {
+            test(tree->GetUserData(id));
+            return bound();
+          },
+          point, bound());
+    }
+  }
+
+  std::sort_heap(hits.begin(), hits.end(), farther);
+}
+
+q3NearestHit q3BroadPhase::QueryClosest(const q3Vec3 &point,
+                                        float maxDistance) const {
+  std::vector<q3NearestHit> hits;
+  QueryKNearest(point, 1, hits, maxDistance);
+  if (hits.empty())
+    return {nullptr, nullptr, maxDistance};
+  return hits[0];
+}
+
+// Time at which a box with the given center and half extents, moving along
+// dir, first touches aabb within [0, t]. Ray vs AABB grown by the extents.
+static bool q3SweepAABB(const q3AABB &aabb, const q3Vec3 &center,
+                        const q3Vec3 &extent, const q3Vec3 &dir, float t,
+                        float *toi) {
+  float tmin = float(0.0);
+  float tmax = t;
+  for (int i = 0; i < 3; ++i) {
+    float min = aabb.min[i] - extent[i];
+    float max = aabb.max[i] + extent[i];
+    if (std::abs(dir[i]) < float(1.0e-8)) {
+      if (center[i] < min || center[i] > max)
+        return false;
+      continue;
+    }
+
+    float d0 = float(1.0) / dir[i];
+    float t0 = (min - center[i]) * d0;
+    float t1 = (max - center[i]) * d0;
+    if (t0 > t1)
+      std::swap(t0, t1);
+    tmin = std::max(tmin, t0);
+    tmax = std::min(tmax, t1);
+    if (tmin > tmax)
+      return false;
+  }
+
+  *toi = tmin;
+  return true;
+}
+
+std::tuple<q3Body *, q3Shape *> q3BroadPhase::SweepBox(
+    q3SweepData &sweep,
+    const std::function<bool(q3Body *body, q3Shape *box)> &filter) const {
+  rmt_ScopedCPUSample(q3BroadPhaseSweepBox, 0);
+
+  // Bounds of the box at the start of the path, then of the whole path
+  const q3Mat3 &r = sweep.tx.rotation;
+  q3Vec3 extent;
+  for (int i = 0; i < 3; ++i) {
+    extent[i] = std::abs(r.ex[i]) * sweep.e.x + std::abs(r.ey[i]) * sweep.e.y +
+                std::abs(r.ez[i]) * sweep.e.z;
+  }
+  q3AABB start = {sweep.tx.position - extent, sweep.tx.position + extent};
+  q3Vec3 move = sweep.dir * sweep.t;
+  q3AABB bounds = start.Combine({start.min + move, start.max + move});
+
+  // A long diagonal path has large bounds, so candidates are ordered by when
+  // the box's AABB reaches their fat AABB. Once that is past the best hit,
+  // no later candidate can do better.
+  struct Candidate {
+    float toi;
+    q3Body *body;
+    q3Shape *box;
+  };
+  std::vector<Candidate> candidates;
+  auto query = [&](const auto &tree) {
+    tree.QueryAABB(
+        [&](int id) {
+          float toi;
+          if (q3SweepAABB(tree.GetFatAABB(id), sweep.tx.position, extent,
+                          sweep.dir, sweep.t, &toi)) {
+            q3Body *body = std::get<0>(tree.GetUserData(id));
+            ForEachBox(tree.GetUserData(id), bounds, [&](q3Shape *box) {
+              // The compound's toi is only a bound for its boxes
+              float boxToi = toi;
+              if (!std::get<1>(tree.GetUserData(id))) {
+                q3AABB aabb = box->ComputeAABB(body->Transform());
+                if (!q3SweepAABB(aabb, sweep.tx.position, extent, sweep.dir,
+                                 sweep.t, &boxToi))
+                  return true;
+              }
+              if (!filter || filter(body, box))
+                candidates.push_back({boxToi, body, box});
+              return true;
+            });
+          }
+          return true;
+        },
+        bounds);
+  };
+  if (m_type != eAABBTreeBroadPhase) {
+    WithProxyList(query);
+  } else {
+    query(m_dynamicTree);
+    query(m_staticTree);
+  }
+
+  // Ties keep the box found first
+  std::stable_sort(candidates.begin(), candidates.end(),
+                   [](const Candidate &a, const Candidate &b) {
+                     return a.toi < b.toi;
+                   });
+
+  // Shortening the sweep to the best hit so far lets the exact test reject
+  // farther boxes early
+  q3SweepData test = sweep;
+  Payload hit = {nullptr, nullptr};
+  for (const Candidate &c : candidates) {
+    if (std::get<1>(hit) && c.toi >= sweep.toi)
+      break;
+
+    if (c.box->Sweep(c.body->Transform(), &test) &&
+        (!std::get<1>(hit) || test.toi < sweep.toi)) {
+      hit = {c.body, c.box};
+      sweep.toi = test.toi;
+      sweep.normal = test.normal;
+      test.t = test.toi;
+    }
+  }
+
+  return hit;
+}
+
+// Sort key that keeps rays with the same direction octant and nearby
+// origins next to each other: octant bits above a 30 bit Morton code.
+static uint64_t q3RayCoherenceKey(const q3RaycastData &ray,
+                                  const q3AABB &bounds) {
+  q3Vec3 size = bounds.max - bounds.min;
+  uint64_t key = 0;
+  for (int i = 0; i < 3; ++i) {
+    float t = size[i] > float(0.0) ? (ray.start[i] - bounds.min[i]) / size[i]
+                                   : float(0.0);
+    uint32_t cell = uint32_t(q3Clamp01(t) * float(1023.0));
+    for (int bit = 0; bit < 10; ++bit) {
+      key |= uint64_t((cell >> bit) & 1) << (bit * 3 + i);
+    }
+    if (ray.dir[i] < float(0.0))
+      key |= uint64_t(1) << (30 + i);
+  }
+  return key;
+}
+
+void q3BroadPhase::RayCastBatch(std::span<const q3RaycastData> rays,
+                                std::vector<q3RayHit> &hits,
+                                q3ThreadPool *pool) const {
+  rmt_ScopedCPUSample(q3BroadPhaseRayCastBatch, 0);
+
+  hits.clear();
+  if (rays.empty())
+    return;
+
+  if (pool)
+    BuildCompoundTrees();
+
+  // Group coherent rays into packets
+  q3AABB bounds = {rays[0].start, rays[0].start};
+  for (auto &ray : rays) {
+    bounds = bounds.Combine({ray.start, ray.start});
+  }
+  std::vector<std::pair<uint64_t, int>> order(rays.size());
+  for (int i = 0; i < int(rays.size()); ++i) {
+    order[i] = {q3RayCoherenceKey(rays[i], bounds), i};
+  }
+  std::sort(order.begin(), order.end());
+
+  const int k_packetSize = q3DynamicAABBTree<Payload>::k_rayPacketSize;
+  int packetCount = int((rays.size() + k_packetSize - 1) / k_packetSize);
+  int threadCount = pool ? pool->ThreadCount() : 1;
+  std::vector<std::vector<q3RayHit>> threadHits(threadCount);
+
+  auto castPacket = [&](int packet, int thread) {
+    q3RaycastData packetRays[k_packetSize];
+    int rayIndex[k_packetSize];
+    int count = 0;
+    for (int i = packet * k_packetSize;
+         i < int(rays.size()) && count < k_packetSize; ++i, ++count) {
+      rayIndex[count] = order[i].second;
+      packetRays[count] = rays[order[i].second];
+    }
+
+    // Same tree order as RayCast: dynamic boxes, then static boxes
+    auto &out = threadHits[thread];
+    auto castBox = [&](int r, const Payload &payload) {
+      q3Body *body = std::get<0>(payload);
+      ForEachRayBox(payload, packetRays[r], [&](q3Shape *box) {
+        q3RaycastData data = packetRays[r];
+        if (box->Raycast(body->Transform(), &data)) {
+          out.push_back({
+              .ray = rayIndex[r],
+              .body = body,
+              .box = box,
+              .toi = data.toi,
+              .normal = data.normal,
+          });
         }
         return true;
-      },
-      rayCast);
+      });
+    };
+    auto cast = [&](const q3DynamicAABBTree<Payload> &tree) {
+      tree.QueryRayPacket(
+          [&](int r, int id) {
+            castBox(r, tree.GetUserData(id));
+            return true;
+          },
+          packetRays, count);
+    };
+    if (m_type != eAABBTreeBroadPhase) {
+      // No packet walk here, each ray queries on its own
+      WithProxyList([&](const auto &list) {
+        for (int r = 0; r < count; ++r) {
+          list.QueryRay(
+              [&](int id) {
+                castBox(r, list.GetUserData(id));
+                return true;
+              },
+              packetRays[r]);
+        }
+      });
+      return;
+    }
+    cast(m_dynamicTree);
+    cast(m_staticTree);
+  };
+
+  if (pool) {
+    pool->ParallelFor(packetCount, castPacket);
+  } else {
+    for (int i = 0; i < packetCount; ++i)
+      castPacket(i, 0);
+  }
+
+  // Flatten into ray order. Each ray was cast by a single packet, so a
+  // stable scatter keeps its hits in traversal order.
+  std::vector<int> offsets(rays.size() + 1, 0);
+  for (auto &out : threadHits) {
+    for (auto &hit : out)
+      ++offsets[hit.ray + 1];
+  }
+  for (int i = 0; i < int(rays.size()); ++i) {
+    offsets[i + 1] += offsets[i];
+  }
+  hits.resize(offsets.back());
+  for (auto &out : threadHits) {
+    for (auto &hit : out)
+      hits[offsets[hit.ray]++] = hit;
+  }
 }
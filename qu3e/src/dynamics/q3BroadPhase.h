@@ -28,7 +28,15 @@ distribution.
 #ifndef Q3BROADPHASE_H
 #define Q3BROADPHASE_H
 
+#include "../scene/q3Body.h"
+#include "../scene/q3Shape.h"
+#include "q3CompoundTree.h"
 #include "q3DynamicAABBTree.h"
+#include "q3HashGrid.h"
+#include "q3SweepAndPrune.h"
+#include <map>
+#include <span>
+#include <unordered_map>
 #include <vector>
 
 //--------------------------------------------------------------------------------------------------
@@ -36,7 +44,8 @@ distribution.
 //--------------------------------------------------------------------------------------------------
 class q3ContactManager;
 class q3Body;
-class q3Box;
+class q3Shape;
+class q3ThreadPool;
 struct q3Transform;
 struct q3AABB;
 
@@ -45,52 +54,457 @@ struct q3ContactPair {
   int B;
 };
 
+// One box hit by one ray of a RayCastBatch
+struct q3RayHit {
+  int ray; // Index of the ray in the batch
+  q3Body *body;
+  q3Shape *box;
+  float toi;     // Time of impact along the ray
+  q3Vec3 normal; // Surface normal at impact
+};
+
+// One box found by QueryKNearest or QueryClosest
+struct q3NearestHit {
+  q3Body *body;
+  q3Shape *box;
+  float distance; // From the query point to the box, zero inside it
+};
+
+// Counters accumulated since the last ResetStats, to tune margins and
+// prediction
+struct q3BroadPhaseStats {
+  int reinsertions = 0; // Proxies that got a new fat AABB
+  int pairs = 0;        // Unique pairs found for moved proxies
+  int begun = 0;        // Pairs reported as begun
+  int ended = 0;        // Pairs reported as ended
+};
+
+using q3PairCallback =
+    std::function<void(q3Body *bodyA, q3Shape *A, q3Body *bodyB, q3Shape *B)>;
+
+// Pair finding backend, chosen when the broadphase is constructed
+enum q3BroadPhaseType {
+  // Static and dynamic AABB trees. Good all round, and the only backend with
+  // fast queries.
+  eAABBTreeBroadPhase,
+  // Sort and sweep along one axis. Suits dense piles of boxes that mostly
+  // rest; queries fall back to testing every box.
+  eSweepAndPruneBroadPhase,
+  // Uniform hash grid sized for unit boxes, unbounded. Constant time proxy
+  // updates; boxes much larger than a cell are tested against everything.
+  eHashGridBroadPhase,
+};
+
+// Proxy ids handed out by the broadphase encode which tree owns the leaf in
+// the lowest bit, so a single int still identifies a box. All boxes of a
+// compound body share one proxy, whose box is null, and its box pairs are
+// found through the body's q3CompoundTree.
 class q3BroadPhase {
+  q3BroadPhaseType m_type;
+
   std::vector<q3ContactPair> m_pairBuffer;
   std::vector<int> m_moveBuffer;
 
-  int m_currentIndex = -1;
+  // Optional workers for UpdatePairs, each with its own pair buffer
+  q3ThreadPool *m_pool = nullptr;
+  std::vector<std::vector<q3ContactPair>> m_threadPairs;
+
+  using Payload = std::tuple<q3Body *, q3Shape *>;
+  // Static level geometry never moves and never pairs with itself, so it is
+  // kept apart from the boxes that move. Only dynamic proxies are buffered.
+  q3DynamicAABBTree<Payload> m_staticTree;
+  q3DynamicAABBTree<Payload> m_dynamicTree;
+  // Hold all proxies instead of the trees for the other backends. Both
+  // share one interface, see WithProxyList.
+  q3SweepAndPrune<Payload> m_sweep;
+  q3HashGrid<Payload> m_grid;
 
-  using Payload = std::tuple<q3Body *, q3Box *>;
-  q3DynamicAABBTree<Payload> m_tree;
+  static const int Null = -1;
+
+  // The static tree is collapsed into its wide query layout whenever it
+  // changed. The dynamic tree changes every step, so by default it is only
+  // collapsed on demand.
+  bool m_collapseDynamicTree = false;
+
+  // Boxes inserted between BeginBulkInsert and EndBulkInsert
+  struct PendingBox {
+    q3Body *body;
+    q3Shape *box;
+    q3AABB aabb;
+  };
+  std::vector<PendingBox> m_pending;
+  bool m_bulkInsert = false;
+
+  // Rebuild a tree in UpdatePairs once its cost grows past this factor of
+  // its cost after the last build. Zero disables the check.
+  float m_rebuildThreshold = float(0.0);
+
+  // SynchronizeProxies stretches fat AABBs by this many times the distance
+  // a body moved in its last step, as Box2D does
+  float m_predictionScale = float(4.0);
+
+  // Once more than this fraction of the dynamic proxies is in the move
+  // buffer, as after level load or a mass wake-up, pairs are found by
+  // descending the trees together instead of one query per moved proxy.
+  // The walk runs on one thread while a pool spreads the queries over all of
+  // its threads, so with a pool the fraction is scaled by their count.
+  float m_dualTreeFraction = float(0.5);
+  std::vector<uint8_t> m_movedNodes; // Dynamic tree nodes in the move buffer
+
+  q3BroadPhaseStats m_stats;
+
+  // Pairs that began and have not ended yet, as the partners of each proxy
+  // by proxy id. A proxy only pairs with its neighbours, so the lists stay
+  // short and are searched rather than hashed.
+  std::vector<std::vector<int>> m_proxyPairs;
+  // What happened to a proxy since the last UpdatePairs, by proxy id. Only
+  // pairs of refattened proxies can end; pairs of removed proxies are
+  // dropped without an end.
+  enum ProxyEvent : uint8_t {
+    eRefattened = 1,
+    eRemoved = 2,
+  };
+  std::vector<uint8_t> m_proxyEvents;
+  std::vector<int> m_eventProxies; // Proxies with a non-zero event
+
+  // Scratch of the bulk SynchronizeProxies, one entry per box
+  std::vector<int> m_syncOffsets; // First box of each body
+  std::vector<int> m_syncIds;
+  std::vector<q3AABB> m_syncAABBs;
+  std::vector<q3Vec3> m_syncDisplacements;
+  std::vector<int> m_syncMoved;
+
+  // Trees of the compound bodies, with at least one box each
+  std::unordered_map<const q3Body *, q3CompoundTree> m_compounds;
+  // Compounds whose boxes changed since the last UpdatePairs
+  std::vector<const q3Body *> m_changedCompounds;
+  // A proxy pair with a compound is reported as the pairs of its boxes that
+  // are close, see k_boxPairBeginScale. Those are kept here by proxy pair,
+  // in the order they began, and checked again every UpdatePairs while
+  // either body moves.
+  struct BoxPair {
+    q3Shape *A;
+    q3Shape *B;
+    // Gap between the boxes' bounds over their margins, negative when they
+    // overlap
+    float scale;
+  };
+  std::map<std::pair<int, int>, std::vector<BoxPair>> m_compoundPairs;
+  std::vector<BoxPair> m_boxPairs; // Scratch of UpdateCompoundPairs
+  std::vector<BoxPair> m_sortedBoxPairs;
 
 public:
-  q3BroadPhase();
+  q3BroadPhase(q3BroadPhaseType type = eAABBTreeBroadPhase);
   ~q3BroadPhase();
 
-  void InsertBox(q3Body *body, q3Box *shape, const q3AABB &aabb);
-  void RemoveBox(const q3Box *shape);
+  // Boxes of compound bodies are not deferred by BeginBulkInsert, and aabb
+  // is not used for them
+  void InsertBox(q3Body *body, q3Shape *shape, const q3AABB &aabb);
+  void RemoveBox(const q3Shape *shape);
   void RemoveBody(q3Body *body);
 
-  // Generates the contact list. All previous contacts are returned to the
-  // allocator before generation occurs.
-  void
-  UpdatePairs(const std::function<void(q3Body *bodyA, q3Box *A, q3Body *bodyB,
-                                       q3Box *B)> &addContact);
+  // Defer InsertBox calls until EndBulkInsert, which builds both trees from
+  // scratch with a SAH build. Meant for level load; the boxes have no
+  // broadphase index until EndBulkInsert returns.
+  void BeginBulkInsert();
+  void EndBulkInsert();
+
+  // Find the pairs whose fat AABBs started overlapping since the last call
+  // and report them to beginPair, then report the pairs that stopped
+  // overlapping to endPair. Pairs that persist cost nothing. Each batch is
+  // reported in proxy id order.
+  void UpdatePairs(const q3PairCallback &beginPair,
+                   const q3PairCallback &endPair = {});
+
+  // Move a proxy to a new tight AABB, see q3DynamicAABBTree::Update
+  void Update(int id, const q3AABB &aabb, const q3Vec3 &displacement = {});
 
-  void Update(int id, const q3AABB &aabb);
+  // Split the move buffer of UpdatePairs across the pool's threads. The
+  // contacts reported are the same, in the same order, as without a pool.
+  // Pass nullptr to go back to serial pair finding.
+  void SetThreadPool(q3ThreadPool *pool) { m_pool = pool; }
 
   bool TestOverlap(int A, int B) const;
   void SynchronizeProxies(q3Body *body);
+  // Same as calling SynchronizeProxies for each body, in one pass. New box
+  // AABBs are computed across the thread pool, if one is set, and the
+  // dynamic tree is updated with q3DynamicAABBTree::UpdateBulk.
+  void SynchronizeProxies(std::span<q3Body *const> bodies);
+
+  // See m_dualTreeFraction. Above 1 always queries per moved proxy.
+  void SetDualTreeFraction(float fraction) { m_dualTreeFraction = fraction; }
+
+  // See m_predictionScale. Zero pads fat AABBs by their margin only.
+  void SetPredictionScale(float scale) { m_predictionScale = scale; }
+
+  const q3BroadPhaseStats &Stats() const { return m_stats; }
+  void ResetStats() { m_stats = {}; }
 
   // Query the world to find any shapes that can potentially intersect
   // the provided AABB. This works by querying the broadphase with an
   // AAABB -- only *potential* intersections are reported. Perhaps the
   // user might use lmDistance as fine-grained collision detection.
-  void QueryAABB(const std::function<bool(q3Body *body, q3Box *box)> &cb,
-                 const q3AABB &aabb) const;
+  template <typename F> void QueryAABB(F &&cb, const q3AABB &aabb) const;
   // Query the world to find any shapes intersecting a world space point.
-  void QueryPoint(const std::function<bool(q3Body *body, q3Box *box)> &cb,
-                  const q3Vec3 &point) const;
+  template <typename F> void QueryPoint(F &&cb, const q3Vec3 &point) const;
   // Query the world to find any shapes intersecting a ray.
-  void RayCast(const std::function<bool(q3Body *body, q3Box *box)> &cb,
+  template <typename F> void RayCast(F &&cb, q3RaycastData &rayCast) const;
+
+  // The templates above inline cb( body, box ) into the tree walk. These
+  // overloads keep a non-template entry point for std::function callbacks.
+  void QueryAABB(const std::function<bool(q3Body *body, q3Shape *box)> &cb,
+                 const q3AABB &aabb) const;
+  void QueryPoint(const std::function<bool(q3Body *body, q3Shape *box)> &cb,
+                  const q3Vec3 &point) const;
+  void RayCast(const std::function<bool(q3Body *body, q3Shape *box)> &cb,
                q3RaycastData &rayCast) const;
+  // The k boxes nearest to point by exact point to box distance, nearest
+  // first, within maxDistance. The trees are walked best first by fat AABB
+  // distance, which never exceeds the box distance, so the walk stops once
+  // no box left can beat the k found. The list backends test every box.
+  void QueryKNearest(const q3Vec3 &point, int k,
+                     std::vector<q3NearestHit> &hits,
+                     float maxDistance = FLT_MAX) const;
+  // The box nearest to point. Body and box are null when there is none
+  // within maxDistance.
+  q3NearestHit QueryClosest(const q3Vec3 &point,
+                            float maxDistance = FLT_MAX) const;
+
+  // Cast a box along a path, without turning it, and find the first box it
+  // hits. Candidates are the proxies overlapping the AABB of the whole path;
+  // each is tested exactly with its shape's Sweep. On a hit, sweep.toi and
+  // sweep.normal describe the first impact and the hit box is returned,
+  // otherwise both pointers are null. filter( body, box ) returning false
+  // skips a box, e.g. one of the caster's own.
+  std::tuple<q3Body *, q3Shape *>
+  SweepBox(q3SweepData &sweep,
+           const std::function<bool(q3Body *body, q3Shape *box)> &filter = {})
+      const;
+  // Cast many rays at once. Every box a ray hits is written to hits, grouped
+  // by ray in batch order. Within one ray the hits come in the same order,
+  // with the same toi and normal, as RayCast reports them. Coherent rays are
+  // grouped into packets that share one tree walk; packets are spread over
+  // the pool when one is given.
+  void RayCastBatch(std::span<const q3RaycastData> rays,
+                    std::vector<q3RayHit> &hits,
+                    q3ThreadPool *pool = nullptr) const;
+
+  // Collapse both trees into their wide SIMD layout now, e.g. right before
+  // a burst of queries. Stays valid until a proxy is inserted, removed or
+  // leaves its fat AABB.
+  void CollapseTrees() {
+    m_staticTree.Collapse();
+    m_dynamicTree.Collapse();
+  }
+  // Also collapse the dynamic tree at the start of every UpdatePairs
+  void SetCollapseDynamicTree(bool collapse) {
+    m_collapseDynamicTree = collapse;
+  }
+
+  // Rebuild both trees with a SAH build. Broadphase indices stay valid.
+  void RebuildTrees() {
+    m_staticTree.Rebuild();
+    m_dynamicTree.Rebuild();
+  }
+  // See m_rebuildThreshold, e.g. 1.5 rebuilds a tree that got 50% worse
+  void SetRebuildThreshold(float threshold) { m_rebuildThreshold = threshold; }
 
-  void Render(q3Render *renderer) const { m_tree.Render(renderer); }
+  // Tree quality, for monitoring. See q3DynamicAABBTree::Cost.
+  float StaticTreeCost() const { return m_staticTree.Cost(); }
+  float DynamicTreeCost() const { return m_dynamicTree.Cost(); }
+  int StaticTreeHeight() const { return m_staticTree.Height(); }
+  int DynamicTreeHeight() const { return m_dynamicTree.Height(); }
+
+  void Render(q3Render *renderer) const {
+    m_staticTree.Render(renderer);
+    m_dynamicTree.Render(renderer);
+    m_sweep.Render(renderer);
+    m_grid.Render(renderer);
+  }
+
+  q3BroadPhaseType Type() const { return m_type; }
+
+  static bool IsStaticProxy(int id) { return (id & 1) != 0; }
 
 private:
+  static int StaticProxy(int node) { return (node << 1) | 1; }
+  static int DynamicProxy(int node) { return node << 1; }
+  static int ProxyNode(int id) { return id >> 1; }
+
+  const q3DynamicAABBTree<Payload> &ProxyTree(int id) const {
+    return IsStaticProxy(id) ? m_staticTree : m_dynamicTree;
+  }
+  q3DynamicAABBTree<Payload> &ProxyTree(int id) {
+    return IsStaticProxy(id) ? m_staticTree : m_dynamicTree;
+  }
+  // Call f with whichever of m_sweep and m_grid is in use
+  template <typename F> decltype(auto) WithProxyList(F &&f) {
+    if (m_type == eHashGridBroadPhase)
+      return f(m_grid);
+    return f(m_sweep);
+  }
+  template <typename F> decltype(auto) WithProxyList(F &&f) const {
+    if (m_type == eHashGridBroadPhase)
+      return f(m_grid);
+    return f(m_sweep);
+  }
+  const q3AABB &GetFatAABB(int id) const {
+    if (m_type != eAABBTreeBroadPhase)
+      return WithProxyList([id](auto &list) -> const q3AABB & {
+        return list.GetFatAABB(ProxyNode(id));
+      });
+    return ProxyTree(id).GetFatAABB(ProxyNode(id));
+  }
+  Payload GetUserData(int id) const {
+    if (m_type != eAABBTreeBroadPhase)
+      return WithProxyList(
+          [id](auto &list) { return list.GetUserData(ProxyNode(id)); });
+    return ProxyTree(id).GetUserData(ProxyNode(id));
+  }
+
+  int InsertProxy(q3Body *body, q3Shape *box, const q3AABB &aabb, float margin);
+  void RemoveProxy(int id);
+  void InsertCompoundBox(q3Body *body, q3Shape *box);
+  void RemoveCompoundBox(const q3Body *body, const q3Shape *box);
+
+  // f( box ) for the box of a proxy, or for the boxes of a compound proxy
+  // whose leaves may overlap aabb or the ray. Returns false once f does.
+  template <typename F>
+  bool ForEachBox(const Payload &payload, const q3AABB &aabb, F &&f) const {
+    auto [body, box] = payload;
+    if (box)
+      return f(box);
+    return m_compounds.at(body).QueryAABB(f, body->Transform(), aabb);
+  }
+  template <typename F>
+  bool ForEachRayBox(const Payload &payload, const q3RaycastData &rayCast,
+                     F &&f) const {
+    auto [body, box] = payload;
+    if (box)
+      return f(box);
+    return m_compounds.at(body).QueryRay(f, body->Transform(), rayCast);
+  }
+
   void BufferMove(int id);
-  bool TreeCallBack(int index);
+  void UnBufferMove(int id);
+  // A static proxy that appears or moves wakes up pair finding for the
+  // dynamic proxies it touches, since it never queries on its own.
+  void BufferTouching(int staticId);
+  // Append the pairs of one moved proxy against both trees
+  void QueryPairs(int id, std::vector<q3ContactPair> &pairs) const;
+  // Fill m_pairBuffer, sorted, from the move buffer and the trees
+  void FindTreePairs();
+  // Fill m_pairBuffer, unsorted, with the tree pairs of moved proxies by
+  // descending the trees together. Returns false, leaving the buffer
+  // alone, when too few proxies moved for that to pay off.
+  bool FindDualTreePairs();
+  // Fill m_pairBuffer, sorted, from the sweep and prune or hash grid
+  void FindListPairs();
+  void AddProxyEvent(int id, ProxyEvent event);
+  // A new proxy may take the id of one removed since the last UpdatePairs,
+  // whose pairs must be gone before the new proxy pairs up
+  void ClaimProxy(int id);
+  void DropRemovedPairs(int id);
+  bool HasPair(int a, int b) const;
+  // Forget the pair of proxies a < b
+  void RemovePair(int a, int b);
+  // Report and forget the pairs of refattened proxies that stopped
+  // overlapping
+  void EndPairs(const q3PairCallback &endPair);
+  // The box pairs of proxies a and b, at least one of them a compound, whose
+  // bounds are at most scale times their margins apart
+  void FindBoxPairs(int a, int b, std::vector<BoxPair> &pairs,
+                    float scale) const;
+  void BeginCompoundPair(int a, int b, const q3PairCallback &beginPair);
+  // Report the box pairs that began or ended within the proxy pairs that
+  // persist
+  void UpdateCompoundPairs(const q3PairCallback &beginPair,
+                           const q3PairCallback &endPair);
+  // Compound trees build on first query. Build the changed ones up front,
+  // before queries that may run on a thread pool only read them.
+  void BuildCompoundTrees() const;
 };
 
+template <typename F>
+void q3BroadPhase::QueryAABB(F &&cb, const q3AABB &aabb) const {
+  bool stop = false;
+  auto query = [this, &cb, &aabb, &stop](const auto &tree) {
+    tree.QueryAABB(
+        [&](int id) {
+          q3Body *body = std::get<0>(tree.GetUserData(id));
+          return ForEachBox(tree.GetUserData(id), aabb, [&](q3Shape *box) {
+            if (aabb.IsOverlapped(box->ComputeAABB(body->Transform()))) {
+              stop = !cb(body, box);
+              return !stop;
+            }
+            return true;
+          });
+        },
+        aabb);
+  };
+  if (m_type != eAABBTreeBroadPhase) {
+    WithProxyList(query);
+    return;
+  }
+  query(m_dynamicTree);
+  if (!stop)
+    query(m_staticTree);
+}
+
+template <typename F>
+void q3BroadPhase::QueryPoint(F &&cb, const q3Vec3 &point) const {
+  const float k_fattener = float(0.5);
+  q3Vec3 v{k_fattener, k_fattener, k_fattener};
+  q3AABB aabb;
+  aabb.min = point - v;
+  aabb.max = point + v;
+  auto query = [this, &cb, &point, &aabb](const auto &tree) {
+    tree.QueryAABB(
+        [&](int id) {
+          q3Body *body = std::get<0>(tree.GetUserData(id));
+          ForEachBox(tree.GetUserData(id), aabb, [&](q3Shape *box) {
+            if (box->TestPoint(body->Transform(), point)) {
+              cb(body, box);
+            }
+            return true;
+          });
+          return true;
+        },
+        aabb);
+  };
+  if (m_type != eAABBTreeBroadPhase) {
+    WithProxyList(query);
+    return;
+  }
+  query(m_dynamicTree);
+  query(m_staticTree);
+}
+
+template <typename F>
+void q3BroadPhase::RayCast(F &&cb, q3RaycastData &rayCast) const {
+  bool stop = false;
+  auto query = [this, &cb, &rayCast, &stop](const auto &tree) {
+    tree.QueryRay(
+        [&](int id) {
+          q3Body *body = std::get<0>(tree.GetUserData(id));
+          return ForEachRayBox(
+              tree.GetUserData(id), rayCast, [&](q3Shape *box) {
+                if (box->Raycast(body->Transform(), &rayCast)) {
+                  stop = !cb(body, box);
+                  return !stop;
+                }
+                return true;
+              });
+        },
+        rayCast);
+  };
+  if (m_type != eAABBTreeBroadPhase) {
+    WithProxyList(query);
+    return;
+  }
+  query(m_dynamicTree);
+  if (!stop)
+    query(m_staticTree);
+}
+
 #endif // Q3BROADPHASE_H
@@ -0,0 +1,277 @@
+#include "q3Magnifold.h"
+#include "../math/q3Segment.h"
+
+//--------------------------------------------------------------------------------------------------
+// Closed form contacts for spheres and capsules. Penetrations are negative
+// where the shapes overlap, as for boxes, and contact points lie halfway
+// between the two surfaces. Feature keys only need to stay the same from
+// one step to the next for warm starting.
+//--------------------------------------------------------------------------------------------------
+static void q3AddContact(q3Manifold *m, int key, const q3Vec3 &position,
+                         float penetration) {
+  q3Contact *c = m->contacts + m->contactCount++;
+  c->fp.key = key;
+  c->position = position;
+  c->penetration = penetration;
+}
+
+// Spheres around ca and cb, the normal from A to B
+static void q3SphereContact(q3Manifold *m, int key, const q3Vec3 &ca, float ra,
+                            const q3Vec3 &cb, float rb) {
+  q3Vec3 d = cb - ca;
+  float r = ra + rb;
+  float distanceSq = q3Dot(d, d);
+  if (distanceSq > r * r)
+    return;
+
+  float distance = std::sqrt(distanceSq);
+  q3Vec3 n = distance > float(1.0e-6) ? d * (float(1.0) / distance)
+                                      : q3Vec3{float(0.0), float(1.0), float(0.0)};
+  m->normal = n;
+  q3Vec3 onA = ca + n * ra;
+  q3Vec3 onB = cb - n * rb;
+  q3AddContact(m, key, (onA + onB) * float(0.5), distance - r);
+}
+
+// Sphere around the point p of the box's space, against the box with half
+// extents e. Fills in the normal out of the box, the contact point and the
+// penetration, all in the box's space.
+static bool q3BoxSphereContact(const q3Vec3 &e, const q3Vec3 &p, float r,
+                               q3Vec3 *normal, q3Vec3 *position,
+                               float *penetration) {
+  q3Vec3 q = q3ClampToBox(p, e);
+  q3Vec3 d = p - q;
+  float distanceSq = q3Dot(d, d);
+  if (distanceSq > r * r)
+    return false;
+
+  if (distanceSq > float(1.0e-12)) {
+    float distance = std::sqrt(distanceSq);
+    *normal = d * (float(1.0) / distance);
+    *penetration = distance - r;
+  } else {
+    // Center inside the box, push out through the nearest face
+    int axis = 0;
+    float depth = e[0] - std::abs(p[0]);
+    for (int i = 1; i < 3; ++i) {
+      float di = e[i] - std::abs(p[i]);
+      if (di < depth) {
+        depth = di;
+        axis = i;
+      }
+    }
+    *normal = {};
+    (*normal)[axis] = p[axis] < float(0.0) ? -float(1.0) : float(1.0);
+    q[axis] = (*normal)[axis] * e[axis];
+    *penetration = -depth - r;
+  }
+
+  *position = (q + p - *normal * r) * float(0.5);
+  return true;
+}
+
+void q3SpheretoSphere(q3Manifold *m, q3Body *a_body, q3Sphere *a,
+                      q3Body *b_body, q3Sphere *b) {
+  q3SphereContact(m, 0, a->Center(a_body->Transform()), a->Radius(),
+                  b->Center(b_body->Transform()), b->Radius());
+}
+
+void q3BoxtoSphere(q3Manifold *m, q3Body *a_body, q3Box *a, q3Body *b_body,
+                   q3Sphere *b) {
+  q3Transform tx = a_body->Transform() * a->Local();
+  q3Vec3 p = tx.rotation.Transposed() *
+             (b->Center(b_body->Transform()) - tx.position);
+  q3Vec3 n;
+  q3Vec3 position;
+  float penetration;
+  if (!q3BoxSphereContact(a->Extent(), p, b->Radius(), &n, &position,
+                          &penetration))
+    return;
+
+  m->normal = tx.rotation * n;
+  q3AddContact(m, 0, tx * position, penetration);
+}
+
+void q3SpheretoCapsule(q3Manifold *m, q3Body *a_body, q3Sphere *a,
+                       q3Body *b_body, q3Capsule *b) {
+  q3Vec3 c = a->Center(a_body->Transform());
+  q3SweptSphere capsule = b->World(b_body->Transform());
+  q3SphereContact(m, 0, c, a->Radius(),
+                  q3ClosestPointOnSegment(capsule.a, capsule.b, c),
+                  capsule.radius);
+}
+
+// Crossing capsules touch at the closest points of their segments. Nearly
+// parallel ones get a contact at each end of the overlap of the segments,
+// so a capsule lying on another does not rock on a single point.
+void q3CapsuletoCapsule(q3Manifold *m, q3Body *a_body, q3Capsule *a,
+                        q3Body *b_body, q3Capsule *b) {
+  q3SweptSphere A = a->World(a_body->Transform());
+  q3SweptSphere B = b->World(b_body->Transform());
+  q3Vec3 dA = A.b - A.a;
+  q3Vec3 dB = B.b - B.a;
+  float lengthSqA = q3Dot(dA, dA);
+  float lengthSqB = q3Dot(dB, dB);
+
+  const float kParallelTol = float(1.0e-3);
+  q3Vec3 cross = q3Cross(dA, dB);
+  if (q3Dot(cross, cross) <=
+      kParallelTol * kParallelTol * lengthSqA * lengthSqB) {
+    // Overlap of B's segment projected onto A's
+    float t0 = q3Dot(B.a - A.a, dA) / lengthSqA;
+    float t1 = q3Dot(B.b - A.a, dA) / lengthSqA;
+    if (t0 > t1)
+      std::swap(t0, t1);
+    t0 = std::max(t0, float(0.0));
+    t1 = std::min(t1, float(1.0));
+    if (t1 - t0 > float(1.0e-3)) {
+      for (int i = 0; i < 2; ++i) {
+        q3Vec3 pA = A.a + dA * (i ? t1 : t0);
+        q3Vec3 pB = q3ClosestPointOnSegment(B.a, B.b, pA);
+        q3SphereContact(m, 1 + i, pA, A.radius, pB, B.radius);
+      }
+      return;
+    }
+  }
+
+  q3Vec3 cA;
+  q3Vec3 cB;
+  q3ClosestSegmentPoints(A.a, A.b, B.a, B.b, &cA, &cB);
+  q3SphereContact(m, 0, cA, A.radius, cB, B.radius);
+}
+
+// The closest points of the segment and the box give the normal. When it
+// is close to a face normal, the segment is clipped to the side planes of
+// that face and each end of the clipped part that reaches the face gets a
+// contact, like the clipped incident face of two boxes.
+void q3BoxtoCapsule(q3Manifold *m, q3Body *a_body, q3Box *a, q3Body *b_body,
+                    q3Capsule *b) {
+  q3Transform tx = a_body->Transform() * a->Local();
+  q3Mat3 inv = tx.rotation.Transposed();
+  q3SweptSphere capsule = b->World(b_body->Transform());
+  q3Vec3 la = inv * (capsule.a - tx.position);
+  q3Vec3 lb = inv * (capsule.b - tx.position);
+  float r = capsule.radius;
+  const q3Vec3 &e = a->Extent();
+
+  q3Vec3 onSegment;
+  q3Vec3 onBox;
+  float distance = q3SegmentBoxClosest(la, lb, e, &onSegment, &onBox);
+  if (distance > r)
+    return;
+
+  q3Vec3 n;
+  float penetration;
+  q3Vec3 position;
+  if (distance > float(1.0e-6)) {
+    n = (onSegment - onBox) * (float(1.0) / distance);
+    penetration = distance - r;
+    position = (onBox + onSegment - n * r) * float(0.5);
+  } else {
+    // The segment runs through the box, its middle there is pushed out
+    q3BoxSphereContact(e, onSegment, r, &n, &position, &penetration);
+  }
+
+  int axis = 0;
+  for (int i = 1; i < 3; ++i) {
+    if (std::abs(n[i]) > std::abs(n[axis]))
+      axis = i;
+  }
+
+  const float kFaceTol = float(0.99);
+  if (std::abs(n[axis]) >= kFaceTol) {
+    float sign = n[axis] < float(0.0) ? -float(1.0) : float(1.0);
+    q3Vec3 faceNormal = {};
+    faceNormal[axis] = sign;
+
+    // Parameters of the segment over the face
+    q3Vec3 d = lb - la;
+    float t0 = float(0.0);
+    float t1 = float(1.0);
+    for (int i = 0; i < 3; ++i) {
+      if (i == axis)
+        continue;
+      if (std::abs(d[i]) < float(1.0e-8)) {
+        if (std::abs(la[i]) > e[i])
+          t1 = -float(1.0);
+        continue;
+      }
+      float s0 = (-e[i] - la[i]) / d[i];
+      float s1 = (e[i] - la[i]) / d[i];
+      if (s0 > s1)
+        std::swap(s0, s1);
+      t0 = std::max(t0, s0);
+      t1 = std::min(t1, s1);
+    }
+
+    if (t0 <= t1) {
+      m->normal = tx.rotation * faceNormal;
+      for (int i = 0; i < 2; ++i) {
+        if (i == 1 && t1 - t0 < float(1.0e-3))
+          break;
+
+        q3Vec3 p = la + d * (i ? t1 : t0);
+        float height = sign * p[axis] - e[axis];
+        if (height > r)
+          continue;
+
+        q3Vec3 q = p;
+        q[axis] = sign * e[axis];
+        q3AddContact(m, 1 + i, tx * ((q + p - faceNormal * r) * float(0.5)),
+                     height - r);
+      }
+      if (m->contactCount)
+        return;
+    }
+  }
+
+  m->normal = tx.rotation * n;
+  q3AddContact(m, 0, tx * position, penetration);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Dispatch
+//--------------------------------------------------------------------------------------------------
+// Each routine takes its own shape types; the table entries turn the shapes
+// back into them. Pairs in the other order run the routine with A and B
+// swapped.
+template <typename A, typename B,
+          void (*F)(q3Manifold *, q3Body *, A *, q3Body *, B *)>
+static void q3Dispatch(q3Manifold *m, q3Body *a_body, q3Shape *a,
+                       q3Body *b_body, q3Shape *b) {
+  F(m, a_body, static_cast<A *>(a), b_body, static_cast<B *>(b));
+}
+
+template <typename A, typename B,
+          void (*F)(q3Manifold *, q3Body *, A *, q3Body *, B *)>
+static void q3Flipped(q3Manifold *m, q3Body *a_body, q3Shape *a,
+                      q3Body *b_body, q3Shape *b) {
+  F(m, b_body, static_cast<A *>(b), a_body, static_cast<B *>(a));
+  if (m->contactCount)
+    m->normal = -m->normal;
+}
+
+// Indexed by the q3ShapeType of A and B
+static const q3CollideFn
+    q3CollideTable[int(q3ShapeType::eCount)][int(q3ShapeType::eCount)] = {
+        {
+            q3Dispatch<q3Box, q3Box, q3BoxtoBox>,
+            q3Dispatch<q3Box, q3Sphere, q3BoxtoSphere>,
+            q3Dispatch<q3Box, q3Capsule, q3BoxtoCapsule>,
+        },
+        {
+            q3Flipped<q3Box, q3Sphere, q3BoxtoSphere>,
+            q3Dispatch<q3Sphere, q3Sphere, q3SpheretoSphere>,
+            q3Dispatch<q3Sphere, q3Capsule, q3SpheretoCapsule>,
+        },
+        {
+            q3Flipped<q3Box, q3Capsule, q3BoxtoCapsule>,
+            q3Flipped<q3Sphere, q3Capsule, q3SpheretoCapsule>,
+            q3Dispatch<q3Capsule, q3Capsule, q3CapsuletoCapsule>,
+        },
+};
+
+void q3Collide(q3Manifold *m, q3Body *a_body, q3Shape *a, q3Body *b_body,
+               q3Shape *b) {
+  q3CollideTable[int(a->Type())][int(b->Type())](m, a_body, a, b_body, b);
+}
@@ -0,0 +1,333 @@
+#pragma once
+#include "../math/q3AABB.h"
+#include "../math/q3Raycast.h"
+#include "../math/q3Transform.h"
+#include "../scene/q3Shape.h"
+#include <algorithm>
+#include <assert.h>
+#include <span>
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------
+// q3CompoundTree
+//--------------------------------------------------------------------------------------------------
+// AABB tree over the boxes of one compound body, in the body's space. Boxes
+// never move relative to their body, so the tree is never refit; queries
+// carry the body's transform instead. Adding or removing boxes only marks the
+// tree stale, and the next query or Build rebuilds it, so filling a compound
+// costs one build. That lazy build is not thread safe: whoever queries from
+// several threads builds first.
+// Bounds from another space are turned into this one conservatively, so
+// queries may report boxes that are a little farther than asked.
+class q3CompoundTree {
+  struct Node {
+    q3AABB aabb;
+    int left; // Null for leaves
+    int right;
+    int box; // Index into m_boxes, leaves only
+
+    bool IsLeaf() const { return left == Null; }
+  };
+
+  static const int Null = -1;
+
+  mutable std::vector<Node> m_nodes; // Root first
+  mutable bool m_stale = false;
+  std::vector<q3Shape *> m_boxes;
+  // Union of the boxes' bounds and their largest margin. Kept up on Add,
+  // and only shrunk again by the rebuild after a Remove.
+  mutable q3AABB m_bounds;
+  mutable float m_margin = float(0.0);
+
+public:
+  void Add(q3Shape *box) {
+    q3AABB aabb = box->ComputeAABB({});
+    m_bounds = m_boxes.empty() ? aabb : m_bounds.Combine(aabb);
+    m_margin = std::max(m_margin, box->AABBMargin());
+    m_boxes.push_back(box);
+    m_stale = true;
+  }
+  void Remove(const q3Shape *box) {
+    auto it = std::find(m_boxes.begin(), m_boxes.end(), box);
+    assert(it != m_boxes.end());
+    m_boxes.erase(it);
+    m_stale = true;
+  }
+
+  // Rebuild the tree if boxes changed since the last build
+  void Build() const {
+    if (m_stale)
+      Rebuild();
+  }
+
+  bool Empty() const { return m_boxes.empty(); }
+  std::span<q3Shape *const> Boxes() const { return m_boxes; }
+  float Margin() const { return m_margin; }
+  int Height() const {
+    Build();
+    return Height(0);
+  }
+
+  // World bounds of all boxes of a body at tx, their union turned with the
+  // body rather than the union of each box's
+  q3AABB ComputeAABB(const q3Transform &tx) const {
+    assert(!m_boxes.empty());
+    return Transformed(tx.rotation, tx.position, m_bounds);
+  }
+
+  // cb( box ) for the boxes that may overlap the world space aabb, with the
+  // body at tx. Returning false stops the walk, and the query returns false
+  // too.
+  template <typename F>
+  bool QueryAABB(F &&cb, const q3Transform &tx, const q3AABB &aabb) const {
+    return QueryGaps([&cb](q3Shape *box, float) { return cb(box); }, tx, aabb,
+                     float(0.0));
+  }
+
+  // cb( box, gap ) for the boxes within pad of the world space aabb, where
+  // gap is the largest distance between the two along an axis of the body,
+  // negative when they overlap. Same stopping rule as QueryAABB.
+  template <typename F>
+  bool QueryGaps(F &&cb, const q3Transform &tx, const q3AABB &aabb,
+                 float pad) const {
+    Build();
+    if (m_nodes.empty())
+      return true;
+
+    // The query's bounds in body space
+    q3Mat3 r = tx.rotation.Transposed();
+    q3AABB local = Transformed(r, r * -tx.position, aabb);
+
+    const int k_stackCapacity = 64;
+    int stack[k_stackCapacity];
+    int sp = 1;
+    *stack = 0;
+    while (sp) {
+      // k_stackCapacity too small
+      assert(sp + 2 <= k_stackCapacity);
+
+      const Node &n = m_nodes[stack[--sp]];
+      float gap = Gap(n.aabb, local);
+      if (gap > pad)
+        continue;
+
+      if (n.IsLeaf()) {
+        if (!cb(m_boxes[n.box], gap))
+          return false;
+      } else {
+        stack[sp++] = n.right;
+        stack[sp++] = n.left;
+      }
+    }
+    return true;
+  }
+
+  // cb( box ) for the boxes whose leaf bounds the segment of the ray, from
+  // start to start + dir * t, passes through. Same stopping rule as
+  // QueryAABB.
+  template <typename F>
+  bool QueryRay(F &&cb, const q3Transform &tx,
+                const q3RaycastData &rayCast) const {
+    Build();
+    if (m_nodes.empty())
+      return true;
+
+    q3Mat3 r = tx.rotation.Transposed();
+    q3Vec3 start = r * (rayCast.start - tx.position);
+    q3Vec3 dir = r * rayCast.dir;
+
+    const int k_stackCapacity = 64;
+    int stack[k_stackCapacity];
+    int sp = 1;
+    *stack = 0;
+    while (sp) {
+      // k_stackCapacity too small
+      assert(sp + 2 <= k_stackCapacity);
+
+      const Node &n = m_nodes[stack[--sp]];
+      if (!SegmentOverlaps(n.aabb, start, dir, rayCast.t))
+        continue;
+
+      if (n.IsLeaf()) {
+        if (!cb(m_boxes[n.box]))
+          return false;
+      } else {
+        stack[sp++] = n.right;
+        stack[sp++] = n.left;
+      }
+    }
+    return true;
+  }
+
+  // cb( box, otherBox, gap ) for the pairs of boxes, one from each tree,
+  // within pad of each other with this body at tx and the other at otherTx.
+  // gap is as for QueryGaps, along the axes of this body. Both trees are
+  // descended together in this tree's space, opening the larger node of a
+  // pair first, like q3DynamicAABBTree::QueryOverlaps.
+  template <typename F>
+  void QueryOverlaps(F &&cb, const q3Transform &tx,
+                     const q3CompoundTree &other, const q3Transform &otherTx,
+                     float pad) const {
+    Build();
+    other.Build();
+    if (m_nodes.empty() || other.m_nodes.empty())
+      return;
+
+    // The other tree's space to this one's
+    q3Mat3 inv = tx.rotation.Transposed();
+    q3Mat3 r = inv * otherTx.rotation;
+    q3Vec3 p = inv * (otherTx.position - tx.position);
+
+    const int k_stackCapacity = 128;
+    struct Entry {
+      int a;
+      int b;
+    };
+    Entry stack[k_stackCapacity];
+    int sp = 1;
+    *stack = {0, 0};
+    while (sp) {
+      // k_stackCapacity too small
+      assert(sp + 2 <= k_stackCapacity);
+
+      Entry e = stack[--sp];
+      const Node &a = m_nodes[e.a];
+      const Node &b = other.m_nodes[e.b];
+      q3AABB bounds = Transformed(r, p, b.aabb);
+      float gap = Gap(a.aabb, bounds);
+      if (gap > pad)
+        continue;
+
+      if (a.IsLeaf() && b.IsLeaf()) {
+        cb(m_boxes[a.box], other.m_boxes[b.box], gap);
+        continue;
+      }
+
+      bool openA = b.IsLeaf() || (!a.IsLeaf() && a.aabb.SurfaceArea() >
+                                                     bounds.SurfaceArea());
+      if (openA) {
+        stack[sp++] = {a.right, e.b};
+        stack[sp++] = {a.left, e.b};
+      } else {
+        stack[sp++] = {e.a, b.right};
+        stack[sp++] = {e.a, b.left};
+      }
+    }
+  }
+
+private:
+  // Bounds of aabb turned by r, then moved by p
+  static q3AABB Transformed(const q3Mat3 &r, const q3Vec3 &p,
+                            const q3AABB &aabb) {
+    q3Vec3 c = (aabb.min + aabb.max) * float(0.5);
+    q3Vec3 e = (aabb.max - aabb.min) * float(0.5);
+    q3Vec3 center = r * c + p;
+    q3Vec3 extent;
+    for (int i = 0; i < 3; ++i) {
+      extent[i] = std::abs(r.ex[i]) * e.x + std::abs(r.ey[i]) * e.y +
+                  std::abs(r.ez[i]) * e.z;
+    }
+    return {center - extent, center + extent};
+  }
+
+  static float Gap(const q3AABB &a, const q3AABB &b) {
+    float gap = std::max(a.min.x - b.max.x, b.min.x - a.max.x);
+    gap = std::max(gap, std::max(a.min.y - b.max.y, b.min.y - a.max.y));
+    return std::max(gap, std::max(a.min.z - b.max.z, b.min.z - a.max.z));
+  }
+
+  // Slab test of the segment from start to start + dir * t
+  static bool SegmentOverlaps(const q3AABB &aabb, const q3Vec3 &start,
+                              const q3Vec3 &dir, float t) {
+    float tmin = float(0.0);
+    float tmax = t;
+    for (int i = 0; i < 3; ++i) {
+      if (std::abs(dir[i]) < float(1.0e-8)) {
+        if (start[i] < aabb.min[i] || start[i] > aabb.max[i])
+          return false;
+        continue;
+      }
+
+      float d0 = float(1.0) / dir[i];
+      float t0 = (aabb.min[i] - start[i]) * d0;
+      float t1 = (aabb.max[i] - start[i]) * d0;
+      if (t0 > t1)
+        std::swap(t0, t1);
+      tmin = std::max(tmin, t0);
+      tmax = std::min(tmax, t1);
+      if (tmin > tmax)
+        return false;
+    }
+    return true;
+  }
+
+  int Height(int index) const {
+    if (m_nodes.empty())
+      return 0;
+    const Node &n = m_nodes[index];
+    if (n.IsLeaf())
+      return 1;
+    return 1 + std::max(Height(n.left), Height(n.right));
+  }
+
+  // Top down, splitting at the median center along the longest axis of the
+  // centers, so the height stays at log2 of the box count
+  void Rebuild() const {
+    m_stale = false;
+    m_nodes.clear();
+    m_margin = float(0.0);
+    if (m_boxes.empty())
+      return;
+
+    std::vector<q3AABB> leaves(m_boxes.size());
+    std::vector<int> order(m_boxes.size());
+    for (int i = 0; i < int(m_boxes.size()); ++i) {
+      leaves[i] = m_boxes[i]->ComputeAABB({});
+      order[i] = i;
+      m_margin = std::max(m_margin, m_boxes[i]->AABBMargin());
+    }
+
+    m_nodes.reserve(2 * m_boxes.size() - 1);
+    BuildNode(leaves, order.data(), int(order.size()));
+    m_bounds = m_nodes[0].aabb;
+  }
+
+  int BuildNode(const std::vector<q3AABB> &leaves, int *order,
+                int count) const {
+    int index = int(m_nodes.size());
+    m_nodes.push_back({});
+    if (count == 1) {
+      m_nodes[index] = {leaves[*order], Null, Null, *order};
+      return index;
+    }
+
+    q3AABB aabb = leaves[order[0]];
+    q3Vec3 center = (aabb.min + aabb.max) * float(0.5);
+    q3AABB centers = {center, center};
+    for (int i = 1; i < count; ++i) {
+      const q3AABB &leaf = leaves[order[i]];
+      aabb = aabb.Combine(leaf);
+      center = (leaf.min + leaf.max) * float(0.5);
+      centers = centers.Combine({center, center});
+    }
+
+    q3Vec3 size = centers.max - centers.min;
+    int axis = 0;
+    if (size.y > size[axis])
+      axis = 1;
+    if (size.z > size[axis])
+      axis = 2;
+
+    int half = count / 2;
+    std::nth_element(order, order + half, order + count,
+                     [&leaves, axis](int a, int b) {
+                       return leaves[a].min[axis] + leaves[a].max[axis] <
+                              leaves[b].min[axis] + leaves[b].max[axis];
+                     });
+
+    int left = BuildNode(leaves, order, half);
+    int right = BuildNode(leaves, order + half, count - half);
+    m_nodes[index] = {aabb, left, right, Null};
+    return index;
+  }
+};
@@ -2,17 +2,17 @@
 
 // Restitution mixing. The idea is to use the maximum bounciness, so bouncy
 // objects will never not bounce during collisions.
-static float q3MixRestitution(const q3Box *A, const q3Box *B) {
+static float q3MixRestitution(const q3Shape *A, const q3Shape *B) {
   return std::max(A->Restitution(), B->Restitution());
 }
 
 // Friction mixing. The idea is to allow a very low friction value to
 // drive down the mixing result. Example: anything slides on ice.
-static float q3MixFriction(const q3Box *A, const q3Box *B) {
+static float q3MixFriction(const q3Shape *A, const q3Shape *B) {
   return std::sqrt(A->Friction() * B->Friction());
 }
 
-q3ContactConstraint::q3ContactConstraint(q3Box *A, q3Body *bodyA, q3Box *B,
+q3ContactConstraint::q3ContactConstraint(q3Shape *A, q3Body *bodyA, q3Shape *B,
                                          q3Body *bodyB)
     : A(A), B(B), bodyA(bodyA), bodyB(bodyB) {
   friction = q3MixFriction(A, B);
@@ -24,32 +24,43 @@ q3ContactConstraint::q3ContactConstraint(q3Box *A, q3Body *bodyA, q3Box *B,
     manifold.contacts[i].warmStarted = 0;
 }
 
-bool q3ContactConstraint::Test(
-    const std::function<bool(q3Box *, q3Box *)> &testOverlap) {
-  // auto constraint = *it;
+bool q3ContactConstraint::Test() {
+  q3Manifold oldManifold;
+  switch (BeginTest(&oldManifold)) {
+  case q3ContactTest::eKeep:
+    return true;
+  case q3ContactTest::eRemove:
+    return false;
+  case q3ContactTest::eCollide:
+    break;
+  }
+
+  q3Collide(&manifold, bodyA, A, bodyB, B);
+  EndTest(oldManifold);
+  return true;
+}
+
+q3ContactTest q3ContactConstraint::BeginTest(q3Manifold *oldManifold) {
   this->RemoveFlag(q3ContactConstraintFlags::eIsland);
 
   if (!bodyA->IsAwake() && !bodyB->IsAwake()) {
-    return true;
+    return q3ContactTest::eKeep;
   }
 
   if (!bodyA->CanCollide(bodyB)) {
-    return false;
+    return q3ContactTest::eRemove;
   }
 
-  // Check if contact should persist
-  if (!testOverlap(A, B)) {
-    return false;
-  }
+  *oldManifold = this->manifold;
+  this->manifold.contactCount = 0;
+  return q3ContactTest::eCollide;
+}
 
+void q3ContactConstraint::EndTest(const q3Manifold &oldManifold) {
   // Solves contact manifolds
   q3Manifold *manifold = &this->manifold;
-  q3Manifold oldManifold = this->manifold;
   q3Vec3 ot0 = oldManifold.tangentVectors[0];
   q3Vec3 ot1 = oldManifold.tangentVectors[1];
-  manifold->contactCount = 0;
-
-  q3BoxtoBox(manifold, bodyA, A, bodyB, B);
 
   if (manifold->contactCount > 0) {
     if (this->HasFlag(q3ContactConstraintFlags::eColliding)) {
@@ -65,7 +76,6 @@ bool q3ContactConstraint::Test(
       this->RemoveFlag(q3ContactConstraintFlags::eWasColliding);
     }
   }
-  // }
 
   q3ComputeBasis(manifold->normal, manifold->tangentVectors,
                  manifold->tangentVectors + 1);
@@ -77,7 +87,7 @@ bool q3ContactConstraint::Test(
     c->warmStarted = uint8_t(0);
 
     for (int j = 0; j < oldManifold.contactCount; ++j) {
-      q3Contact *oc = oldManifold.contacts + j;
+      const q3Contact *oc = oldManifold.contacts + j;
       if (c->fp.key == oc->fp.key) {
         c->normalImpulse = oc->normalImpulse;
 
@@ -91,6 +101,4 @@ bool q3ContactConstraint::Test(
       }
     }
   }
-
-  return true;
 }
@@ -1,8 +1,7 @@
 #pragma once
-#include "../scene/q3Box.h"
+#include "../scene/q3Shape.h"
 #include "q3ContactEdge.h"
 #include "q3Magnifold.h"
-#include <memory>
 
 enum class q3ContactConstraintFlags {
   eNone = 0,
@@ -11,9 +10,16 @@ enum class q3ContactConstraintFlags {
   eIsland = 0x00000004,       // For internal marking during island forming
 };
 
+// What q3ContactConstraint::BeginTest asks of the narrowphase
+enum class q3ContactTest {
+  eKeep,    // Both bodies sleep, the manifold stays as it is
+  eRemove,  // The bodies cannot collide anymore
+  eCollide, // Run the narrowphase, then EndTest
+};
+
 struct q3ContactConstraint {
-  q3Box *A;
-  q3Box *B;
+  q3Shape *A;
+  q3Shape *B;
   q3Body *bodyA;
   q3Body *bodyB;
   q3ContactEdge edgeA;
@@ -23,9 +29,11 @@ struct q3ContactConstraint {
   q3Manifold manifold;
   q3ContactConstraintFlags m_flags = {};
 
-  q3ContactConstraint(q3Box *A, q3Body *bodyA, q3Box *B, q3Body *bodyB);
+  q3ContactConstraint(q3Shape *A, q3Body *bodyA, q3Shape *B, q3Body *bodyB);
   q3ContactConstraint(const q3ContactConstraint &) = delete;
   q3ContactConstraint &operator=(const q3ContactConstraint &) = delete;
+  q3ContactConstraint(q3ContactConstraint &&) = default;
+  q3ContactConstraint &operator=(q3ContactConstraint &&) = default;
 
   bool HasFlag(q3ContactConstraintFlags flag) const {
     return ((int)m_flags & (int)flag) != 0;
@@ -36,6 +44,17 @@ struct q3ContactConstraint {
   void RemoveFlag(q3ContactConstraintFlags flag) {
     m_flags = (q3ContactConstraintFlags)((int)m_flags & ~(int)flag);
   }
-  bool Test(const std::function<bool(q3Box *, q3Box *)> &testOverlap);
+  // Update the manifold. Returns false when the contact should go away.
+  // Contacts whose fat AABBs stopped overlapping are ended by the
+  // broadphase instead.
+  bool Test();
+
+  // Test split around q3Collide, so the narrowphase can run the box-box
+  // queries of several contacts as one batch. BeginTest saves the manifold
+  // EndTest needs for warm starting.
+  q3ContactTest BeginTest(q3Manifold *oldManifold);
+  void EndTest(const q3Manifold &oldManifold);
 };
-using q3ContactConstraintPtr = std::shared_ptr<q3ContactConstraint>;
\ No newline at end of file
+// Contacts live in the q3ContactManager slot map. Pointers stay valid until
+// the next contact is added or removed.
+using q3ContactConstraintPtr = q3ContactConstraint *;
\ No newline at end of file
@@ -1,9 +1,12 @@
 #pragma once
-#include <memory>
 
+// One end of a contact in the contact list of a body. Edges link through
+// the slot of their contact, as slot << 1 | side with side 1 for edgeB, so
+// the links stay valid while contacts move around the slot map.
 struct q3ContactEdge {
   class q3Body *other;
-  std::shared_ptr<struct q3ContactConstraint> constraint;
-  q3ContactEdge *next;
-  q3ContactEdge *prev;
+  int next;
+  int prev;
+
+  static const int Null = -1;
 };
@@ -0,0 +1,24 @@
+#pragma once
+#include "../math/q3Vec3.h"
+
+// Touching boxes reported by q3ContactManager. Sensors are reported apart,
+// as q3SensorEvent.
+struct q3ContactEvent {
+  class q3Body *bodyA;
+  class q3Shape *A;
+  class q3Body *bodyB;
+  class q3Shape *B;
+  q3Vec3 normal; // From A to B
+  // Speed at which the boxes close along the normal, negative when they
+  // separate. Taken at the fastest contact point, or at the body centers
+  // once the boxes stopped touching.
+  float approachSpeed;
+};
+
+// A box overlapping a sensor box
+struct q3SensorEvent {
+  class q3Body *sensorBody;
+  class q3Shape *sensor;
+  class q3Body *visitorBody;
+  class q3Shape *visitor;
+};
@@ -29,115 +29,294 @@ distribution.
 #include "q3Contact.h"
 #include "q3ContactConstraint.h"
 #include "q3Magnifold.h"
+#include "../q3ThreadPool.h"
 #include <q3Render.h>
 
 #include <Remotery.h>
+#include <algorithm>
+#include <float.h>
 
 q3ContactManager::q3ContactManager() {}
 
-void q3ContactManager::AddContact(q3Body *bodyA, q3Box *A, q3Body *bodyB,
-                                  q3Box *B) {
+void q3ContactManager::TestCollisions() {
+  // Each test only writes its own manifold and flags
+  m_changes.clear();
+  const int k_chunkSize = 64;
+  int count = int(m_contacts.Size());
+  int chunkCount = (count + k_chunkSize - 1) / k_chunkSize;
+  if (m_pool && chunkCount > 1) {
+    m_threadChanges.resize(m_pool->ThreadCount());
+    for (auto &changes : m_threadChanges)
+      changes.clear();
+
+    m_pool->ParallelFor(chunkCount, [this, count](int chunk, int thread) {
+      int end = std::min(count, (chunk + 1) * k_chunkSize);
+      TestRange(chunk * k_chunkSize, end, m_threadChanges[thread]);
+    });
+
+    for (auto &changes : m_threadChanges)
+      m_changes.insert(m_changes.end(), changes.begin(), changes.end());
+  } else {
+    TestRange(0, count, m_changes);
+  }
+
+  // Batches report their changes after the removals found next to them
+  std::sort(m_changes.begin(), m_changes.end(),
+            [](const IndexedChange &a, const IndexedChange &b) {
+              return a.index < b.index;
+            });
+
+  for (const IndexedChange &c : m_changes) {
+    if (c.change != Change::eDead)
+      ReportEvent(c.change, m_contacts[c.index]);
+  }
+
+  // From the back, so the contacts moved into the holes are all alive
+  for (auto it = m_changes.rbegin(); it != m_changes.rend(); ++it) {
+    if (it->change == Change::eDead)
+      RemoveContact(m_contacts.HandleAt(it->index));
+  }
+}
+
+void q3ContactManager::TestRange(int begin, int end,
+                                 std::vector<IndexedChange> &changes) {
+  // Box-box queries go to q3BoxtoBoxBatch in groups of this size
+  const int k_batchSize = 16;
+  int indices[k_batchSize];
+  bool wasTouching[k_batchSize];
+  q3Manifold *manifolds[k_batchSize];
+  q3Manifold oldManifolds[k_batchSize];
+  int batchCount = 0;
+
+  auto endTest = [&](int i, const q3Manifold &oldManifold, bool wasTouching) {
+    q3ContactConstraint &contact = m_contacts[i];
+    contact.EndTest(oldManifold);
+
+    bool touching = contact.HasFlag(q3ContactConstraintFlags::eColliding);
+    if (touching != wasTouching)
+      changes.push_back({i, touching ? Change::eBegin : Change::eEnd});
+    else if (touching && m_reportPersist && !contact.manifold.sensor)
+      changes.push_back({i, Change::ePersist});
+  };
+  auto flush = [&]() {
+    q3BoxtoBoxBatch(manifolds, batchCount);
+    for (int j = 0; j < batchCount; ++j)
+      endTest(indices[j], oldManifolds[j], wasTouching[j]);
+    batchCount = 0;
+  };
+
+  for (int i = begin; i < end; ++i) {
+    q3ContactConstraint &contact = m_contacts[i];
+    bool touching = contact.HasFlag(q3ContactConstraintFlags::eColliding);
+
+    // Contacts between sleeping bodies stay as they are
+    switch (contact.BeginTest(oldManifolds + batchCount)) {
+    case q3ContactTest::eKeep:
+      continue;
+    case q3ContactTest::eRemove:
+      changes.push_back({i, Change::eDead});
+      continue;
+    case q3ContactTest::eCollide:
+      break;
+    }
+
+    // Spheres and capsules have their own closed form routines
+    if (contact.A->Type() != q3ShapeType::eBox ||
+        contact.B->Type() != q3ShapeType::eBox) {
+      q3Collide(&contact.manifold, contact.bodyA, contact.A, contact.bodyB,
+                contact.B);
+      endTest(i, oldManifolds[batchCount], touching);
+      continue;
+    }
+
+    indices[batchCount] = i;
+    wasTouching[batchCount] = touching;
+    manifolds[batchCount] = &contact.manifold;
+    if (++batchCount == k_batchSize)
+      flush();
+  }
+  flush();
+}
+
+void q3ContactManager::ReportEvent(Change change,
+                                   const q3ContactConstraint &contact) {
+  if (contact.manifold.sensor) {
+    // The sensor goes first, even when it is B
+    bool flip = !contact.A->Sensor();
+    q3SensorEvent event = {
+        .sensorBody = flip ? contact.bodyB : contact.bodyA,
+        .sensor = flip ? contact.B : contact.A,
+        .visitorBody = flip ? contact.bodyA : contact.bodyB,
+        .visitor = flip ? contact.A : contact.B,
+    };
+    if (change == Change::eBegin)
+      m_sensorBeginEvents.push_back(event);
+    else if (change == Change::eEnd)
+      m_sensorEndEvents.push_back(event);
+    return;
+  }
+
+  // The manifold keeps the last normal once the boxes stop touching
+  const q3Manifold &m = contact.manifold;
+  float approachSpeed = -FLT_MAX;
+  for (int i = 0; i < m.contactCount; ++i) {
+    const q3Vec3 &p = m.contacts[i].position;
+    q3Vec3 dv = contact.bodyA->VelocityAtWorldPoint(p) -
+                contact.bodyB->VelocityAtWorldPoint(p);
+    approachSpeed = std::max(approachSpeed, q3Dot(dv, m.normal));
+  }
+  if (m.contactCount == 0) {
+    const q3Body *A = contact.bodyA;
+    const q3Body *B = contact.bodyB;
+    q3Vec3 dv = A->VelocityAtWorldPoint(A->State().m_worldCenter) -
+                B->VelocityAtWorldPoint(B->State().m_worldCenter);
+    approachSpeed = q3Dot(dv, m.normal);
+  }
+
+  q3ContactEvent event = {
+      .bodyA = contact.bodyA,
+      .A = contact.A,
+      .bodyB = contact.bodyB,
+      .B = contact.B,
+      .normal = m.normal,
+      .approachSpeed = approachSpeed,
+  };
+  switch (change) {
+  case Change::eBegin:
+    m_beginEvents.push_back(event);
+    break;
+  case Change::ePersist:
+    m_persistEvents.push_back(event);
+    break;
+  case Change::eEnd:
+    m_endEvents.push_back(event);
+    break;
+  case Change::eDead:
+    break;
+  }
+}
+
+void q3ContactManager::ClearEvents() {
+  m_beginEvents.clear();
+  m_persistEvents.clear();
+  m_endEvents.clear();
+  m_sensorBeginEvents.clear();
+  m_sensorEndEvents.clear();
+}
+
+void q3ContactManager::AddContact(q3Body *bodyA, q3Shape *A, q3Body *bodyB,
+                                  q3Shape *B) {
   if (!bodyA->CanCollide(bodyB))
     return;
 
   // Search for existing matching contact
   // Return if found duplicate to avoid duplicate constraints
   // Mark pre-existing duplicates as active
-  for (q3ContactEdge *edge = ContactEdge(bodyA); edge; edge = edge->next) {
-    if (edge->other == bodyB) {
+  for (int key = bodyA->ContactEdge(); key != q3ContactEdge::Null;
+       key = Edge(key).next) {
+    if (Edge(key).other == bodyB) {
       // @TODO: Verify this against Box2D; not sure if this is all we need here
-      if ((A == edge->constraint->A) && (B == edge->constraint->B))
+      const q3ContactConstraint &contact = m_contacts.AtSlot(key >> 1);
+      if ((A == contact.A) && (B == contact.B))
         return;
     }
   }
 
+  BeginContact(bodyA, A, bodyB, B);
+}
+
+void q3ContactManager::BeginContact(q3Body *bodyA, q3Shape *A, q3Body *bodyB,
+                                    q3Shape *B) {
+  if (!bodyA->CanCollide(bodyB))
+    return;
+
   // Create new contact
-  auto contact = std::make_shared<q3ContactConstraint>(A, bodyA, B, bodyB);
-  m_contactList.push_back(contact);
-
-  // Connect A
-  auto edgeA = ContactEdge(bodyA);
-  contact->edgeA = {
-      .other = bodyB,
-      .constraint = contact,
-      .next = edgeA,
-      .prev = NULL,
-  };
-  if (edgeA) {
-    edgeA->prev = &contact->edgeA;
-  }
-  m_edgeMap[bodyA] = &contact->edgeA;
-
-  // Connect B
-  auto edgeB = ContactEdge(bodyB);
-  contact->edgeB = {
-      .other = bodyA,
-      .constraint = contact,
-      .next = edgeB,
-      .prev = NULL,
-  };
-  if (edgeB) {
-    edgeB->prev = &contact->edgeB;
-  }
-  m_edgeMap[bodyB] = &contact->edgeB;
+  q3ContactHandle handle = m_contacts.Emplace(A, bodyA, B, bodyB);
+  ++m_createdCount;
+
+  // Connect A and B
+  int key = int(handle.index) << 1;
+  LinkEdge(key, bodyA, bodyB);
+  LinkEdge(key | 1, bodyB, bodyA);
 
   bodyA->SetToAwake();
   bodyB->SetToAwake();
 }
 
-std::list<q3ContactConstraintPtr>::iterator
-q3ContactManager::RemoveContact(q3ContactConstraintPtr contact) {
-  q3Body *A = contact->bodyA;
-  q3Body *B = contact->bodyB;
-
-  // Remove from A
-  if (contact->edgeA.prev)
-    contact->edgeA.prev->next = contact->edgeA.next;
-
-  if (contact->edgeA.next)
-    contact->edgeA.next->prev = contact->edgeA.prev;
-
-  if (&contact->edgeA == ContactEdge(A)) {
-    m_edgeMap[A] = contact->edgeA.next;
+void q3ContactManager::EndContact(q3Body *bodyA, q3Shape *A, q3Body *bodyB,
+                                  q3Shape *B) {
+  // The contact may be gone already, e.g. when the bodies cannot collide
+  for (int key = bodyA->ContactEdge(); key != q3ContactEdge::Null;
+       key = Edge(key).next) {
+    const q3ContactConstraint &contact = m_contacts.AtSlot(key >> 1);
+    if ((A == contact.A && B == contact.B) ||
+        (A == contact.B && B == contact.A)) {
+      RemoveContact(m_contacts.SlotHandle(key >> 1));
+      return;
+    }
   }
+}
 
-  // Remove from B
-  if (contact->edgeB.prev)
-    contact->edgeB.prev->next = contact->edgeB.next;
+void q3ContactManager::RemoveContact(q3ContactHandle handle) {
+  q3ContactConstraint *contact = m_contacts.Get(handle);
+  assert(contact);
+  q3Body *A = contact->bodyA;
+  q3Body *B = contact->bodyB;
 
-  if (contact->edgeB.next)
-    contact->edgeB.next->prev = contact->edgeB.prev;
+  if (contact->HasFlag(q3ContactConstraintFlags::eColliding))
+    ReportEvent(Change::eEnd, *contact);
 
-  if (&contact->edgeB == ContactEdge(B))
-    m_edgeMap[B] = contact->edgeB.next;
+  int key = int(handle.index) << 1;
+  UnlinkEdge(key, A);
+  UnlinkEdge(key | 1, B);
 
   A->SetToAwake();
   B->SetToAwake();
 
   // Remove contact from the manager
-  auto it = std::find(m_contactList.begin(), m_contactList.end(), contact);
-  assert(it != m_contactList.end());
-  it = m_contactList.erase(it);
-  return it;
+  m_contacts.Remove(handle);
+  ++m_removedCount;
 }
 
 //--------------------------------------------------------------------------------------------------
 void q3ContactManager::RemoveContactsFromBody(q3Body *body) {
-  q3ContactEdge *edge = ContactEdge(body);
+  ForEachContact(body, [this](q3ContactHandle handle,
+                              const q3ContactConstraint &, q3Body *) {
+    RemoveContact(handle);
+  });
+}
 
-  while (edge) {
-    q3ContactEdge *next = edge->next;
-    RemoveContact(edge->constraint);
-    edge = next;
+//--------------------------------------------------------------------------------------------------
+void q3ContactManager::LinkEdge(int key, q3Body *body, q3Body *other) {
+  int head = body->ContactEdge();
+  Edge(key) = {
+      .other = other,
+      .next = head,
+      .prev = q3ContactEdge::Null,
+  };
+  if (head != q3ContactEdge::Null) {
+    Edge(head).prev = key;
   }
+  body->SetContactEdge(key);
+}
+
+void q3ContactManager::UnlinkEdge(int key, q3Body *body) {
+  const q3ContactEdge &edge = Edge(key);
+  if (edge.prev != q3ContactEdge::Null)
+    Edge(edge.prev).next = edge.next;
+  else
+    body->SetContactEdge(edge.next);
+
+  if (edge.next != q3ContactEdge::Null)
+    Edge(edge.next).prev = edge.prev;
 }
 
 //--------------------------------------------------------------------------------------------------
 void q3ContactManager::Render(q3Render *render) const {
-  for (auto contact : m_contactList) {
-    const q3Manifold *m = &contact->manifold;
+  for (const q3ContactConstraint &contact : m_contacts) {
+    const q3Manifold *m = &contact.manifold;
 
-    if (!contact->HasFlag(q3ContactConstraintFlags::eColliding)) {
+    if (!contact.HasFlag(q3ContactConstraintFlags::eColliding)) {
       continue;
     }
 
@@ -27,48 +27,145 @@ distribution.
 
 #pragma once
 #include "q3ContactConstraint.h"
-#include <functional>
-#include <list>
-#include <memory>
-#include <unordered_map>
-class q3Box;
+#include "q3ContactEvent.h"
+#include "q3SlotMap.h"
+#include <span>
+#include <vector>
+class q3Shape;
 class q3Body;
 class q3Render;
 class q3Stack;
+class q3ThreadPool;
+
+using q3ContactHandle = q3SlotHandle;
 
 class q3ContactManager {
-  std::list<q3ContactConstraintPtr> m_contactList;
+  // Contacts are packed in one array for the narrowphase loop. Handles and
+  // edge links go through the stable slots.
+  q3SlotMap<q3ContactConstraint> m_contacts;
+
+  // What a contact test left for the serial pass after it: an event to
+  // report or a contact to remove
+  enum class Change {
+    eBegin,
+    ePersist,
+    eEnd,
+    eDead,
+  };
+  struct IndexedChange {
+    int index;
+    Change change;
+  };
+
+  // Optional workers for TestCollisions, each with its own change list
+  q3ThreadPool *m_pool = nullptr;
+  std::vector<std::vector<IndexedChange>> m_threadChanges;
+  std::vector<IndexedChange> m_changes;
 
-  std::unordered_map<class q3Body *, struct q3ContactEdge *> m_edgeMap;
+  // Events since the last ClearEvents
+  std::vector<q3ContactEvent> m_beginEvents;
+  std::vector<q3ContactEvent> m_persistEvents;
+  std::vector<q3ContactEvent> m_endEvents;
+  std::vector<q3SensorEvent> m_sensorBeginEvents;
+  std::vector<q3SensorEvent> m_sensorEndEvents;
+  bool m_reportPersist = false;
+
+  // Pair churn: contacts created and removed since construction
+  size_t m_createdCount = 0;
+  size_t m_removedCount = 0;
 
 public:
   q3ContactManager();
-  std::list<q3ContactConstraintPtr>::iterator begin() {
-    return m_contactList.begin();
-  }
-  std::list<q3ContactConstraintPtr>::iterator end() {
-    return m_contactList.end();
+  auto begin() { return m_contacts.begin(); }
+  auto end() { return m_contacts.end(); }
+  auto begin() const { return m_contacts.begin(); }
+  auto end() const { return m_contacts.end(); }
+  size_t ContactCount() const { return m_contacts.Size(); }
+  size_t CreatedCount() const { return m_createdCount; }
+  size_t RemovedCount() const { return m_removedCount; }
+
+  // Contact at a position of the packed array, from 0 to ContactCount()
+  q3ContactConstraint &Contact(size_t i) { return m_contacts[i]; }
+  q3ContactHandle HandleAt(size_t i) const { return m_contacts.HandleAt(i); }
+
+  // Null once the contact was removed
+  q3ContactConstraint *GetContact(q3ContactHandle handle) {
+    return m_contacts.Get(handle);
   }
-  size_t ContactCount() const { return m_contactList.size(); }
 
-  struct q3ContactEdge *ContactEdge(q3Body *body) {
-    auto found = m_edgeMap.find(body);
-    if (found == m_edgeMap.end()) {
-      return nullptr;
+  // Calls f( handle, contact, other ) for every contact of the body, where
+  // other is the body on the other side. f may remove the contact it is
+  // given, but no other.
+  template <typename F> void ForEachContact(q3Body *body, F &&f) {
+    for (int key = body->ContactEdge(); key != q3ContactEdge::Null;) {
+      q3ContactConstraint &contact = m_contacts.AtSlot(key >> 1);
+      const q3ContactEdge &edge = key & 1 ? contact.edgeB : contact.edgeA;
+      int next = edge.next;
+      f(m_contacts.SlotHandle(key >> 1), contact, edge.other);
+      key = next;
     }
-    return found->second;
   }
 
+  // Split TestCollisions across the pool's threads. Pass nullptr to go back
+  // to testing on the calling thread.
+  void SetThreadPool(q3ThreadPool *pool) { m_pool = pool; }
+
+  // Update the manifold of every contact, then remove the contacts whose
+  // bodies cannot collide anymore. All tests run before the first removal
+  // wakes any body, so the outcome does not depend on the thread count.
+  // Fills the event buffers in contact order.
+  void TestCollisions();
+
+  // Boxes that started touching, kept touching or stopped touching. Begin
+  // and persist events come from TestCollisions; end events also come from
+  // removing a touching contact. Contacts between sleeping bodies report
+  // nothing. The buffers are cleared by q3TimeStep when it starts.
+  std::span<const q3ContactEvent> BeginEvents() const { return m_beginEvents; }
+  std::span<const q3ContactEvent> PersistEvents() const {
+    return m_persistEvents;
+  }
+  std::span<const q3ContactEvent> EndEvents() const { return m_endEvents; }
+
+  // Sensor overlaps start and end the same way, they never persist
+  std::span<const q3SensorEvent> SensorBeginEvents() const {
+    return m_sensorBeginEvents;
+  }
+  std::span<const q3SensorEvent> SensorEndEvents() const {
+    return m_sensorEndEvents;
+  }
+
+  // Persist events cost one entry per resting contact per step, so they are
+  // off unless asked for
+  void SetReportPersist(bool report) { m_reportPersist = report; }
+  void ClearEvents();
+
   // Add a new contact constraint for a pair of objects
   // unless the contact constraint already exists
-  void AddContact(q3Body *bodyA, q3Box *A, q3Body *bodyB, q3Box *B);
+  void AddContact(q3Body *bodyA, q3Shape *A, q3Body *bodyB, q3Shape *B);
 
-  // Remove a specific contact
-  std::list<q3ContactConstraintPtr>::iterator
-  RemoveContact(q3ContactConstraintPtr contact);
+  // Pair deltas from q3BroadPhase::UpdatePairs. The broadphase reports a
+  // pair once when it begins, so BeginContact skips the duplicate search.
+  void BeginContact(q3Body *bodyA, q3Shape *A, q3Body *bodyB, q3Shape *B);
+  void EndContact(q3Body *bodyA, q3Shape *A, q3Body *bodyB, q3Shape *B);
+
+  // Remove a specific contact. The last contact of the packed array moves
+  // into its place.
+  void RemoveContact(q3ContactHandle handle);
 
   // Remove all contacts from a body
   void RemoveContactsFromBody(q3Body *body);
 
   void Render(q3Render *debugDrawer) const;
+
+private:
+  q3ContactEdge &Edge(int key) {
+    q3ContactConstraint &contact = m_contacts.AtSlot(key >> 1);
+    return key & 1 ? contact.edgeB : contact.edgeA;
+  }
+
+  void TestRange(int begin, int end, std::vector<IndexedChange> &changes);
+  void ReportEvent(Change change, const q3ContactConstraint &contact);
+
+  void LinkEdge(int key, q3Body *body, q3Body *other);
+  void UnlinkEdge(int key, q3Body *body);
 };
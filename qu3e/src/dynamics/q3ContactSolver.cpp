@@ -29,13 +29,25 @@ distribution.
 #include "../math/q3Math.h"
 #include "../scene/q3Env.h"
 #include "q3Contact.h"
+#include "../math/q3Simd.h"
 
 #include <Remotery.h>
+#include <algorithm>
+#include <vector>
 
 #define Q3_BAUMGARTE float(0.2)
 #define Q3_PENETRATION_SLOP float(0.05)
 #define Q3_SLEEP_TIME float(0.5)
 
+// Static bodies keep their zero velocity and may be in other islands solved
+// at the same time, so only the others are written
+static void q3StoreVelocity(q3Body *body, const q3Vec3 &v, const q3Vec3 &w) {
+  if (body->HasFlag(q3BodyFlags::eStatic))
+    return;
+  body->VelocityState().linearVelocity = v;
+  body->VelocityState().angularVelocity = w;
+}
+
 struct q3ContactSolver {
   bool m_enableFriction;
   std::span<std::tuple<q3ContactConstraintPtr, q3ContactConstraintState>>
@@ -112,10 +124,8 @@ q3ContactSolver::q3ContactSolver(
         c->bias += -(cs.restitution) * dv;
     }
 
-    cs.A->VelocityState().linearVelocity = vA;
-    cs.A->VelocityState().angularVelocity = wA;
-    cs.B->VelocityState().linearVelocity = vB;
-    cs.B->VelocityState().angularVelocity = wB;
+    q3StoreVelocity(cs.A, vA, wA);
+    q3StoreVelocity(cs.B, vB, wB);
   }
 }
 
@@ -193,12 +203,433 @@ void q3ContactSolver::Solve() {
       }
     }
 
-    cs.A->VelocityState().linearVelocity = vA;
-    cs.A->VelocityState().angularVelocity = wA;
-    cs.B->VelocityState().linearVelocity = vB;
-    cs.B->VelocityState().angularVelocity = wB;
+    q3StoreVelocity(cs.A, vA, wA);
+    q3StoreVelocity(cs.B, vB, wB);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// q3WideSolver
+//--------------------------------------------------------------------------------------------------
+// Runs the iterations of q3ContactSolver on four constraints at a time, one
+// per lane. Constraints of a batch share no dynamic body, so the lanes never
+// race on a velocity; static and kinematic bodies are only read. Velocities
+// live in a contiguous array for the whole solve, the per constraint data is
+// packed once after q3ContactSolver computed the masses and warm started.
+namespace {
+
+using q3Float = q3Float4;
+const int k_lanes = 4;
+
+struct q3Vec3x4 {
+  q3Float x;
+  q3Float y;
+  q3Float z;
+
+  static q3Vec3x4 Load(const float (*p)[k_lanes]) {
+    return {q3Float::Load(p[0]), q3Float::Load(p[1]), q3Float::Load(p[2])};
   }
+};
+
+// Same arithmetic, in the same order, as the q3Vec3 operators
+inline q3Vec3x4 operator+(const q3Vec3x4 &a, const q3Vec3x4 &b) {
+  return {a.x + b.x, a.y + b.y, a.z + b.z};
+}
+inline q3Vec3x4 operator-(const q3Vec3x4 &a, const q3Vec3x4 &b) {
+  return {a.x - b.x, a.y - b.y, a.z - b.z};
+}
+inline q3Vec3x4 operator*(const q3Vec3x4 &a, q3Float f) {
+  return {a.x * f, a.y * f, a.z * f};
 }
+inline q3Float q3Dot(const q3Vec3x4 &a, const q3Vec3x4 &b) {
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+inline q3Vec3x4 q3Cross(const q3Vec3x4 &a, const q3Vec3x4 &b) {
+  return {(a.y * b.z) - (b.y * a.z), (b.x * a.z) - (a.x * b.z),
+          (a.x * b.y) - (b.x * a.y)};
+}
+
+struct q3Mat3x4 {
+  q3Vec3x4 ex;
+  q3Vec3x4 ey;
+  q3Vec3x4 ez;
+
+  q3Vec3x4 operator*(const q3Vec3x4 &v) const {
+    return {ex.x * v.x + ey.x * v.y + ez.x * v.z,
+            ex.y * v.x + ey.y * v.y + ez.y * v.z,
+            ex.z * v.x + ey.z * v.y + ez.z * v.z};
+  }
+};
+
+// Contact j of each lane of a batch. Lanes with fewer contacts keep zero
+// masses here, which makes every impulse zero.
+struct q3WideContact {
+  alignas(16) float ra[3][k_lanes];
+  alignas(16) float rb[3][k_lanes];
+  alignas(16) float normalMass[k_lanes];
+  alignas(16) float tangentMass[2][k_lanes];
+  alignas(16) float bias[k_lanes];
+  alignas(16) float normalImpulse[k_lanes];
+  alignas(16) float tangentImpulse[2][k_lanes];
+};
+
+// Empty lanes point at the dummy body, past the island's bodies, and have
+// zero masses
+struct q3WideConstraint {
+  alignas(16) float normal[3][k_lanes];
+  alignas(16) float tangent[2][3][k_lanes];
+  alignas(16) float friction[k_lanes];
+  alignas(16) float invMassA[k_lanes];
+  alignas(16) float invMassB[k_lanes];
+  alignas(16) float invInertiaA[3][3][k_lanes]; // Columns, like q3Mat3
+  alignas(16) float invInertiaB[3][3][k_lanes];
+  int constraint[k_lanes]; // Index of the lane's constraint, or -1
+  int bodyA[k_lanes];
+  int bodyB[k_lanes];
+  int laneCount;
+  int contactCount; // Most of any lane
+  int firstContact; // Into q3WideSolver::m_contacts
+};
+
+struct q3SolverBody {
+  q3Vec3 v;
+  q3Vec3 w;
+};
+
+class q3WideSolver {
+  bool m_enableFriction;
+  std::span<q3Body *> m_bodies;
+  std::span<std::tuple<q3ContactConstraintPtr, q3ContactConstraintState>>
+      m_constraints;
+  std::vector<q3SolverBody> m_solverBodies; // Island order, then the dummy
+  std::vector<q3WideConstraint> m_batches;
+  std::vector<q3WideContact> m_contacts;
+
+  void Gather(const int *index, q3Vec3x4 *v, q3Vec3x4 *w) const;
+  void Scatter(const int *index, const q3Vec3x4 &v, const q3Vec3x4 &w);
+  void Batch(std::span<const int> slotA, std::span<const int> slotB,
+             std::span<const uint8_t> dynamic);
+  void Pack();
+
+public:
+  q3WideSolver(bool enableFriction, std::span<q3Body *> bodies,
+               std::span<std::tuple<q3ContactConstraintPtr,
+                                    q3ContactConstraintState>>
+                   constraints);
+  void Solve();
+  void Finish();
+};
+
+q3WideSolver::q3WideSolver(
+    bool enableFriction, std::span<q3Body *> bodies,
+    std::span<std::tuple<q3ContactConstraintPtr, q3ContactConstraintState>>
+        constraints)
+    : m_enableFriction(enableFriction), m_bodies(bodies),
+      m_constraints(constraints) {
+  // Slots by body, found through a sorted copy of the island's bodies
+  std::vector<std::pair<const q3Body *, int>> slots(bodies.size());
+  // Bodies whose velocity the constraints cannot change may go in many lanes
+  std::vector<uint8_t> dynamic(bodies.size() + 1, 0);
+  m_solverBodies.resize(bodies.size() + 1);
+  for (int i = 0; i < int(bodies.size()); ++i) {
+    slots[i] = {bodies[i], i};
+    dynamic[i] = bodies[i]->HasFlag(q3BodyFlags::eDynamic);
+    const q3VelocityState &velocity = bodies[i]->VelocityState();
+    m_solverBodies[i] = {velocity.linearVelocity, velocity.angularVelocity};
+  }
+  m_solverBodies.back() = {};
+  std::sort(slots.begin(), slots.end());
+  auto slot = [&slots](const q3Body *body) {
+    auto it = std::lower_bound(slots.begin(), slots.end(),
+                               std::pair<const q3Body *, int>{body, 0});
+    assert(it != slots.end() && it->first == body);
+    return it->second;
+  };
+
+  std::vector<int> slotA(constraints.size());
+  std::vector<int> slotB(constraints.size());
+  for (int i = 0; i < int(constraints.size()); ++i) {
+    const q3ContactConstraintState &cs = std::get<1>(constraints[i]);
+    slotA[i] = slot(cs.A);
+    slotB[i] = slot(cs.B);
+  }
+
+  Batch(slotA, slotB, dynamic);
+  Pack();
+}
+
+// Greedy, in constraint order: each constraint goes to the first open batch
+// holding neither of its dynamic bodies. Up to k_openCount batches are open
+// at once; each body keeps a bit per open batch it is in, so the test is a
+// mask. When all are taken, the oldest open one, which has the lowest
+// index, is closed partly empty.
+void q3WideSolver::Batch(std::span<const int> slotA, std::span<const int> slotB,
+                         std::span<const uint8_t> dynamic) {
+  const int k_openCount = 8;
+  const int dummy = int(m_solverBodies.size()) - 1;
+  std::vector<uint8_t> openBits(m_solverBodies.size(), 0);
+  int open[k_openCount];
+  std::fill(open, open + k_openCount, -1);
+
+  auto close = [&](int k) {
+    const q3WideConstraint &batch = m_batches[open[k]];
+    for (int lane = 0; lane < batch.laneCount; ++lane) {
+      openBits[batch.bodyA[lane]] &= ~(1 << k);
+      openBits[batch.bodyB[lane]] &= ~(1 << k);
+    }
+    open[k] = -1;
+  };
+
+  m_batches.reserve(slotA.size() / k_lanes + k_openCount);
+  for (int i = 0; i < int(slotA.size()); ++i) {
+    int a = slotA[i];
+    int b = slotB[i];
+    int used = (dynamic[a] ? openBits[a] : 0) | (dynamic[b] ? openBits[b] : 0);
+
+    int k = 0;
+    while (k < k_openCount && (open[k] == -1 || (used & (1 << k))))
+      ++k;
+    if (k == k_openCount) {
+      k = 0;
+      while (k < k_openCount && open[k] != -1)
+        ++k;
+    }
+    if (k == k_openCount) {
+      k = int(std::min_element(open, open + k_openCount) - open);
+      close(k);
+    }
+
+    if (open[k] == -1) {
+      open[k] = int(m_batches.size());
+      q3WideConstraint &batch = m_batches.emplace_back();
+      std::fill(batch.constraint, batch.constraint + k_lanes, -1);
+      std::fill(batch.bodyA, batch.bodyA + k_lanes, dummy);
+      std::fill(batch.bodyB, batch.bodyB + k_lanes, dummy);
+      batch.laneCount = 0;
+    }
+
+    q3WideConstraint &batch = m_batches[open[k]];
+    int lane = batch.laneCount++;
+    batch.constraint[lane] = i;
+    batch.bodyA[lane] = a;
+    batch.bodyB[lane] = b;
+    if (dynamic[a])
+      openBits[a] |= 1 << k;
+    if (dynamic[b])
+      openBits[b] |= 1 << k;
+    if (batch.laneCount == k_lanes)
+      close(k);
+  }
+}
+
+// Lanes of the SoA batches from the constraint states
+void q3WideSolver::Pack() {
+  int contactCount = 0;
+  for (q3WideConstraint &batch : m_batches) {
+    batch.contactCount = 0;
+    for (int lane = 0; lane < batch.laneCount; ++lane) {
+      const q3ContactConstraintState &cs =
+          std::get<1>(m_constraints[batch.constraint[lane]]);
+      batch.contactCount = std::max(batch.contactCount, cs.contactCount);
+    }
+    batch.firstContact = contactCount;
+    contactCount += batch.contactCount;
+  }
+  m_contacts.assign(contactCount, {});
+
+  for (q3WideConstraint &batch : m_batches) {
+    for (int lane = 0; lane < k_lanes; ++lane) {
+      if (lane >= batch.laneCount) {
+        for (int i = 0; i < 3; ++i) {
+          batch.normal[i][lane] = float(0.0);
+          batch.tangent[0][i][lane] = float(0.0);
+          batch.tangent[1][i][lane] = float(0.0);
+          for (int j = 0; j < 3; ++j) {
+            batch.invInertiaA[i][j][lane] = float(0.0);
+            batch.invInertiaB[i][j][lane] = float(0.0);
+          }
+        }
+        batch.friction[lane] = float(0.0);
+        batch.invMassA[lane] = float(0.0);
+        batch.invMassB[lane] = float(0.0);
+        continue;
+      }
+
+      const q3ContactConstraintState &cs =
+          std::get<1>(m_constraints[batch.constraint[lane]]);
+      const q3Mat3 &iA = cs.stateA.m_invInertiaWorld;
+      const q3Mat3 &iB = cs.stateB.m_invInertiaWorld;
+      for (int i = 0; i < 3; ++i) {
+        batch.normal[i][lane] = cs.normal[i];
+        batch.tangent[0][i][lane] = cs.tangentVectors[0][i];
+        batch.tangent[1][i][lane] = cs.tangentVectors[1][i];
+        for (int j = 0; j < 3; ++j) {
+          batch.invInertiaA[i][j][lane] = iA[i][j];
+          batch.invInertiaB[i][j][lane] = iB[i][j];
+        }
+      }
+      batch.friction[lane] = cs.friction;
+      batch.invMassA[lane] = cs.stateA.m_invMass;
+      batch.invMassB[lane] = cs.stateB.m_invMass;
+
+      for (int j = 0; j < cs.contactCount; ++j) {
+        const q3ContactState &c = cs.contacts[j];
+        q3WideContact &wc = m_contacts[batch.firstContact + j];
+        for (int i = 0; i < 3; ++i) {
+          wc.ra[i][lane] = c.ra[i];
+          wc.rb[i][lane] = c.rb[i];
+        }
+        wc.normalMass[lane] = c.normalMass;
+        wc.tangentMass[0][lane] = c.tangentMass[0];
+        wc.tangentMass[1][lane] = c.tangentMass[1];
+        wc.bias[lane] = c.bias;
+        wc.normalImpulse[lane] = c.normalImpulse;
+        wc.tangentImpulse[0][lane] = c.tangentImpulse[0];
+        wc.tangentImpulse[1][lane] = c.tangentImpulse[1];
+      }
+    }
+  }
+}
+
+// Impulses back into the constraint states, velocities back into the bodies.
+// Must run before q3ContactSolver stores the impulses into the manifolds.
+void q3WideSolver::Finish() {
+  for (const q3WideConstraint &batch : m_batches) {
+    for (int lane = 0; lane < batch.laneCount; ++lane) {
+      q3ContactConstraintState &cs =
+          std::get<1>(m_constraints[batch.constraint[lane]]);
+      for (int j = 0; j < cs.contactCount; ++j) {
+        const q3WideContact &wc = m_contacts[batch.firstContact + j];
+        q3ContactState &c = cs.contacts[j];
+        c.normalImpulse = wc.normalImpulse[lane];
+        c.tangentImpulse[0] = wc.tangentImpulse[0][lane];
+        c.tangentImpulse[1] = wc.tangentImpulse[1][lane];
+      }
+    }
+  }
+
+  // Only dynamic bodies changed, and static ones may be in other islands
+  for (int i = 0; i < int(m_bodies.size()); ++i) {
+    if (!m_bodies[i]->HasFlag(q3BodyFlags::eDynamic))
+      continue;
+    q3VelocityState &velocity = m_bodies[i]->VelocityState();
+    velocity.linearVelocity = m_solverBodies[i].v;
+    velocity.angularVelocity = m_solverBodies[i].w;
+  }
+}
+
+void q3WideSolver::Gather(const int *index, q3Vec3x4 *v,
+                          q3Vec3x4 *w) const {
+  alignas(16) float f[6][k_lanes];
+  for (int lane = 0; lane < k_lanes; ++lane) {
+    const q3SolverBody &body = m_solverBodies[index[lane]];
+    for (int i = 0; i < 3; ++i) {
+      f[i][lane] = body.v[i];
+      f[3 + i][lane] = body.w[i];
+    }
+  }
+  *v = q3Vec3x4::Load(f);
+  *w = q3Vec3x4::Load(f + 3);
+}
+
+// Lanes sharing a static body all write back its unchanged velocity
+void q3WideSolver::Scatter(const int *index, const q3Vec3x4 &v,
+                           const q3Vec3x4 &w) {
+  alignas(16) float f[6][k_lanes];
+  v.x.Store(f[0]);
+  v.y.Store(f[1]);
+  v.z.Store(f[2]);
+  w.x.Store(f[3]);
+  w.y.Store(f[4]);
+  w.z.Store(f[5]);
+  for (int lane = 0; lane < k_lanes; ++lane) {
+    q3SolverBody &body = m_solverBodies[index[lane]];
+    for (int i = 0; i < 3; ++i) {
+      body.v[i] = f[i][lane];
+      body.w[i] = f[3 + i][lane];
+    }
+  }
+}
+
+// q3ContactSolver::Solve with a lane per constraint
+void q3WideSolver::Solve() {
+  const q3Float zero = q3Float::Splat(float(0.0));
+  for (q3WideConstraint &batch : m_batches) {
+    q3Vec3x4 vA, wA, vB, wB;
+    Gather(batch.bodyA, &vA, &wA);
+    Gather(batch.bodyB, &vB, &wB);
+
+    q3Vec3x4 normal = q3Vec3x4::Load(batch.normal);
+    q3Vec3x4 tangents[2] = {q3Vec3x4::Load(batch.tangent[0]),
+                            q3Vec3x4::Load(batch.tangent[1])};
+    q3Float friction = q3Float::Load(batch.friction);
+    q3Float invMassA = q3Float::Load(batch.invMassA);
+    q3Float invMassB = q3Float::Load(batch.invMassB);
+    q3Mat3x4 invInertiaA = {q3Vec3x4::Load(batch.invInertiaA[0]),
+                            q3Vec3x4::Load(batch.invInertiaA[1]),
+                            q3Vec3x4::Load(batch.invInertiaA[2])};
+    q3Mat3x4 invInertiaB = {q3Vec3x4::Load(batch.invInertiaB[0]),
+                            q3Vec3x4::Load(batch.invInertiaB[1]),
+                            q3Vec3x4::Load(batch.invInertiaB[2])};
+
+    auto apply = [&](const q3Vec3x4 &ra, const q3Vec3x4 &rb,
+                     const q3Vec3x4 &impulse) {
+      vA = vA - impulse * invMassA;
+      wA = wA - invInertiaA * q3Cross(ra, impulse);
+
+      vB = vB + impulse * invMassB;
+      wB = wB + invInertiaB * q3Cross(rb, impulse);
+    };
+
+    for (int j = 0; j < batch.contactCount; ++j) {
+      q3WideContact &c = m_contacts[batch.firstContact + j];
+      q3Vec3x4 ra = q3Vec3x4::Load(c.ra);
+      q3Vec3x4 rb = q3Vec3x4::Load(c.rb);
+
+      // relative velocity at contact
+      q3Vec3x4 dv = vB + q3Cross(wB, rb) - vA - q3Cross(wA, ra);
+
+      // Friction
+      if (m_enableFriction) {
+        for (int i = 0; i < 2; ++i) {
+          q3Float lambda = (zero - q3Dot(dv, tangents[i])) *
+                           q3Float::Load(c.tangentMass[i]);
+
+          // Clamp frictional impulse
+          q3Float maxLambda = friction * q3Float::Load(c.normalImpulse);
+          q3Float oldPT = q3Float::Load(c.tangentImpulse[i]);
+          q3Float pt =
+              q3Max(q3Min(oldPT + lambda, maxLambda), zero - maxLambda);
+          pt.Store(c.tangentImpulse[i]);
+          lambda = pt - oldPT;
+
+          apply(ra, rb, tangents[i] * lambda);
+        }
+      }
+
+      // Normal
+      {
+        dv = vB + q3Cross(wB, rb) - vA - q3Cross(wA, ra);
+        q3Float vn = q3Dot(dv, normal);
+        q3Float lambda = q3Float::Load(c.normalMass) *
+                         ((zero - vn) + q3Float::Load(c.bias));
+
+        // Clamp impulse
+        q3Float tempPN = q3Float::Load(c.normalImpulse);
+        q3Float pn = q3Max(tempPN + lambda, zero);
+        pn.Store(c.normalImpulse);
+        lambda = pn - tempPN;
+
+        apply(ra, rb, normal * lambda);
+      }
+    }
+
+    Scatter(batch.bodyA, vA, wA);
+    Scatter(batch.bodyB, vB, wB);
+  }
+}
+
+} // namespace
 
 void q3ContactSolve(
     const q3Env &env,
@@ -212,7 +643,21 @@ void q3ContactSolve(
   }
 }
 
-void q3ContactsSolve(const q3Env &env, std::span<q3Body *> bodies,
+// The masses and warm starting stay with q3ContactSolver, the iterations go
+// to q3WideSolver
+static void q3ContactSolveWide(
+    const q3Env &env, std::span<q3Body *> bodies,
+    std::span<std::tuple<q3ContactConstraintPtr, q3ContactConstraintState>>
+        constraints) {
+  q3ContactSolver contactSolver(env.m_dt, env.m_enableFriction, constraints);
+  q3WideSolver wideSolver(env.m_enableFriction, bodies, constraints);
+  for (int i = 0; i < env.m_iterations; ++i) {
+    wideSolver.Solve();
+  }
+  wideSolver.Finish();
+}
+
+bool q3ContactsSolve(const q3Env &env, std::span<q3Body *> bodies,
                      std::span<q3ContactConstraintPtr> constraints) {
   rmt_ScopedCPUSample(q3ContactsSolve, 0);
 
@@ -252,7 +697,10 @@ void q3ContactsSolve(const q3Env &env, std::span<q3Body *> bodies,
   }
 
   // Solve contacts. Modify velocity of bodies
-  q3ContactSolve(env, constraintWithStates);
+  if (env.m_wideSolver)
+    q3ContactSolveWide(env, bodies, constraintWithStates);
+  else
+    q3ContactSolve(env, constraintWithStates);
 
   // Copy back state buffers
   // Integrate positions
@@ -273,8 +721,11 @@ void q3ContactsSolve(const q3Env &env, std::span<q3Body *> bodies,
     // and sleep test will be tried again.
     if (minSleepTime > Q3_SLEEP_TIME) {
       for (auto body : bodies) {
-        body->SetToSleep();
+        if (!body->HasFlag(q3BodyFlags::eStatic))
+          body->SetToSleep();
       }
+      return true;
     }
   }
+  return false;
 }
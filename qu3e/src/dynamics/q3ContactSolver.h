@@ -35,5 +35,9 @@ void q3ContactSolve(
     std::span<std::tuple<q3ContactConstraintPtr, q3ContactConstraintState>>
         constraints);
 
-void q3ContactsSolve(const q3Env &env, std::span<q3Body *> bodies,
+// Solves one island and integrates its bodies. Returns true when the island
+// fell asleep; its static bodies are left to the caller to put to sleep, as
+// they may be part of other islands solved at the same time. Nothing else
+// outside the island is written.
+bool q3ContactsSolve(const q3Env &env, std::span<q3Body *> bodies,
                      std::span<q3ContactConstraintPtr> constraints);
\ No newline at end of file
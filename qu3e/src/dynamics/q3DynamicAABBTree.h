@@ -28,9 +28,14 @@ distribution.
 #pragma once
 #include "../math/q3AABB.h"
 #include "../math/q3Raycast.h"
+#include "../math/q3Simd.h"
+#include <algorithm>
 #include <assert.h>
+#include <float.h>
 #include <functional>
 #include <q3Render.h>
+#include <queue>
+#include <span>
 #include <vector>
 
 //--------------------------------------------------------------------------------------------------
@@ -39,107 +44,328 @@ distribution.
 // Resources:
 // http://box2d.org/2014/08/balancing-dynamic-trees/
 // http://www.randygaul.net/2013/08/06/dynamic-aabb-tree/
-inline void FattenAABB(q3AABB &aabb) {
-  const float k_fattener = float(0.5);
-  q3Vec3 v{k_fattener, k_fattener, k_fattener};
+
+// Default padding of a fat AABB on every side
+const float k_aabbMargin = float(0.5);
+
+// Pad by margin on every side, then stretch towards the displacement the
+// proxy is expected to make, so fast proxies stay inside for a few steps.
+inline void FattenAABB(q3AABB &aabb, float margin = k_aabbMargin,
+                       const q3Vec3 &displacement = {}) {
+  q3Vec3 v{margin, margin, margin};
 
   aabb.min -= v;
   aabb.max += v;
+
+  for (int i = 0; i < 3; ++i) {
+    if (displacement[i] < float(0.0))
+      aabb.min[i] += displacement[i];
+    else
+      aabb.max[i] += displacement[i];
+  }
+}
+
+// Whether a proxy must get a new fat AABB for its tight AABB: either it left
+// the fat one, or the fat one is far larger than margin and displacement
+// call for, as after a fast proxy came to rest.
+inline bool NeedsRefatten(const q3AABB &fat, const q3AABB &aabb, float margin,
+                          const q3Vec3 &displacement) {
+  if (!fat.Contains(aabb))
+    return true;
+
+  q3AABB huge = aabb;
+  FattenAABB(huge, margin * float(5.0), displacement);
+  return !huge.Contains(fat);
 }
 
 template <typename T> class q3DynamicAABBTree {
-  struct Node {
+  // Traversal data only: the bounds and child indices a query reads at every
+  // step. Two nodes fill a cache line and none straddles one. The rest of a
+  // node lives in the side arrays, indexed the same way.
+  struct alignas(32) Node {
     bool IsLeaf(void) const {
-      // The right leaf does not use the same memory as the userdata,
-      // and will always be Null (no children)
+      // Leaves have no children
       return right == Null;
     }
 
     // Fat AABB for leafs, bounding AABB for branches
     q3AABB aabb;
 
-    union {
-      int parent;
-      int next; // free list
-    };
-
     // Child indices
-    struct {
-      int left;
-      int right;
-    };
-
-    // Since only leaf nodes hold userdata, we can use the
-    // same memory used for left/right indices to store
-    // the userdata void pointer
-    T userData;
-
-    // leaf = 0, free nodes = -1
-    int height;
+    int left;
+    int right;
 
     static const int Null = -1;
   };
+  static_assert(sizeof(Node) == 32);
+
+  // Collapsed copy of the binary tree used by queries. Each node holds up to
+  // four children as SoA bounds so a single SIMD compare tests all of them.
+  // Children >= 0 are wide nodes, leaves are stored as WideLeaf( id ).
+  struct alignas(16) WideNode {
+    float minX[4], minY[4], minZ[4];
+    float maxX[4], maxY[4], maxZ[4];
+    int child[4];
+    int count;
+  };
+  static int WideLeaf(int id) { return -(id + 2); }
+
+  // Segments of a ray packet in SoA form, pre-computed the same way the
+  // single ray test does it.
+  struct alignas(16) RayPacket {
+    float dx[16], dy[16], dz[16];
+    float adx[16], ady[16], adz[16];
+    float adxe[16], adye[16], adze[16];
+    float px[16], py[16], pz[16];
+  };
 
   int m_root;
   std::vector<Node> m_nodes;
+  // Parent of a node, or the next free node for free nodes
+  std::vector<int> m_parents;
+  // leaf = 0, free nodes = -1
+  std::vector<int> m_heights;
+  // Leaves only
+  std::vector<T> m_userData;
+  // Padding of the fat AABB, leaves only
+  std::vector<float> m_margins;
   int m_count; // Number of active nodes
   int m_freeList;
 
+  // The binary tree remains the build/update structure. Any insertion or
+  // removal invalidates the wide layout until the next Collapse.
+  std::vector<WideNode> m_wideNodes;
+  bool m_wideValid = false;
+
+  // Cost() right after the last full build, the reference for rebuilds
+  float m_builtCost = float(0.0);
+
 public:
   q3DynamicAABBTree() {
     m_root = Node::Null;
-    m_nodes.resize(1024);
+    Resize(1024);
     m_count = 0;
     AddToFreeList(0);
   }
   ~q3DynamicAABBTree() {}
 
-  // Provide tight-AABB
-  int Insert(const q3AABB &aabb, const T &userData) {
+  // Provide tight-AABB. The fat AABB is padded by margin on every side.
+  int Insert(const q3AABB &aabb, const T &userData,
+             float margin = k_aabbMargin) {
     int id = AllocateNode();
 
     // Fatten AABB and set height/userdata
     m_nodes[id].aabb = aabb;
-    FattenAABB(m_nodes[id].aabb);
-    m_nodes[id].userData = userData;
-    m_nodes[id].height = 0;
+    FattenAABB(m_nodes[id].aabb, margin);
+    m_userData[id] = userData;
+    m_margins[id] = margin;
+    m_heights[id] = 0;
 
     InsertLeaf(id);
 
     return id;
   }
 
+  // Insert many leaves at once, e.g. on level load. The new leaves and any
+  // existing ones are built into a fresh tree with a binned SAH top-down
+  // build. ids receives the proxy id of each new leaf.
+  void BulkInsert(std::span<const q3AABB> aabbs, std::span<const T> userData,
+                  std::span<const float> margins, std::span<int> ids) {
+    assert(aabbs.size() == userData.size() && aabbs.size() == ids.size());
+    assert(aabbs.size() == margins.size());
+
+    for (int i = 0; i < int(aabbs.size()); ++i) {
+      int id = AllocateNode();
+      m_nodes[id].aabb = aabbs[i];
+      FattenAABB(m_nodes[id].aabb, margins[i]);
+      m_userData[id] = userData[i];
+      m_margins[id] = margins[i];
+      m_heights[id] = 0;
+      ids[i] = id;
+    }
+
+    Rebuild();
+  }
+
+  // Throw away all branches and rebuild them over the current leaves with a
+  // binned SAH build. Leaves keep their ids.
+  void Rebuild() {
+    std::vector<BuildLeaf> leaves;
+    leaves.reserve(m_count);
+    for (int i = 0; i < int(m_nodes.size()); ++i) {
+      if (m_heights[i] == 0) {
+        const q3AABB &aabb = m_nodes[i].aabb;
+        leaves.push_back({aabb, (aabb.min + aabb.max) * float(0.5), i});
+      } else if (m_heights[i] > 0)
+        DeallocateNode(i);
+    }
+
+    m_wideValid = false;
+    m_root = Node::Null;
+    if (!leaves.empty()) {
+      m_root = BuildSAH(leaves.data(), int(leaves.size()), 0);
+      m_parents[m_root] = Node::Null;
+    }
+    m_builtCost = Cost();
+  }
+
+  // Rebuild when the cost has grown past threshold times the cost measured
+  // after the last full build. Returns true when a rebuild happened.
+  bool RebuildIfDegraded(float threshold) {
+    float cost = Cost();
+    if (m_builtCost == float(0.0))
+      m_builtCost = cost;
+
+    if (cost <= m_builtCost * threshold)
+      return false;
+
+    Rebuild();
+    return true;
+  }
+
+  // Surface area heuristic cost of the tree: summed surface area of all
+  // branches relative to the root. Lower is better for queries.
+  float Cost() const {
+    if (m_root == Node::Null)
+      return float(0.0);
+
+    float rootArea = m_nodes[m_root].aabb.SurfaceArea();
+    if (rootArea == float(0.0))
+      return float(0.0);
+
+    float total = float(0.0);
+    for (int i = 0; i < int(m_nodes.size()); ++i) {
+      if (m_heights[i] > 0)
+        total += m_nodes[i].aabb.SurfaceArea();
+    }
+
+    return total / rootArea;
+  }
+
+  // Number of leaves
+  int LeafCount() const {
+    return m_root == Node::Null ? 0 : (m_count + 1) / 2;
+  }
+
+  int Height() const {
+    return m_root == Node::Null ? 0 : m_heights[m_root];
+  }
+
   void Remove(int id) {
-    assert(id >= 0 && id < m_nodes.size());
+    assert(id >= 0 && id < int(m_nodes.size()));
     assert(m_nodes[id].IsLeaf());
     RemoveLeaf(id);
     DeallocateNode(id);
   }
 
-  bool Update(int id, const q3AABB &aabb) {
-    assert(id >= 0 && id < m_nodes.size());
+  // Move a leaf to a new tight AABB. displacement is how far the proxy is
+  // expected to move next, the fat AABB is stretched to cover it. Returns
+  // true when the leaf got a new fat AABB and was reinserted.
+  bool Update(int id, const q3AABB &aabb, const q3Vec3 &displacement = {}) {
+    assert(id >= 0 && id < int(m_nodes.size()));
     assert(m_nodes[id].IsLeaf());
 
-    if (m_nodes[id].aabb.Contains(aabb))
+    float margin = m_margins[id];
+    if (!NeedsRefatten(m_nodes[id].aabb, aabb, margin, displacement))
       return false;
 
     RemoveLeaf(id);
 
     m_nodes[id].aabb = aabb;
-    FattenAABB(m_nodes[id].aabb);
+    FattenAABB(m_nodes[id].aabb, margin, displacement);
 
     InsertLeaf(id);
 
     return true;
   }
 
+  // Update many leaves at once. A leaf that got a new fat AABB keeps its
+  // place unless that would grow its parent past growthLimit times its
+  // surface area, since the parent's growth is what the leaf adds to the
+  // tree's SAH cost; such leaves are reinserted. The branches above the
+  // leaves that stay are then refit bottom-up in one pass. The default only
+  // keeps leaves that still fit in their parent. Drifting leaves degrade
+  // the tree fast under larger limits, so pair those with
+  // RebuildIfDegraded. The index of every leaf that got a new fat AABB is
+  // appended to moved.
+  void UpdateBulk(std::span<const int> ids, std::span<const q3AABB> aabbs,
+                  std::span<const q3Vec3> displacements,
+                  std::vector<int> &moved, float growthLimit = float(1.0)) {
+    assert(ids.size() == aabbs.size() && ids.size() == displacements.size());
+
+    std::vector<int> refit;
+    std::vector<int> reinsert;
+    bool changed = false;
+    for (int i = 0; i < int(ids.size()); ++i) {
+      int id = ids[i];
+      assert(id >= 0 && id < int(m_nodes.size()));
+      assert(m_nodes[id].IsLeaf());
+
+      Node &leaf = m_nodes[id];
+      float margin = m_margins[id];
+      if (!NeedsRefatten(leaf.aabb, aabbs[i], margin, displacements[i]))
+        continue;
+
+      moved.push_back(i);
+      changed = true;
+      leaf.aabb = aabbs[i];
+      FattenAABB(leaf.aabb, margin, displacements[i]);
+
+      // A root leaf has no branches to refit, but the wide layout still
+      // holds its old AABB
+      if (m_parents[id] == Node::Null)
+        continue;
+
+      const Node &parent = m_nodes[m_parents[id]];
+      int sibling = parent.left == id ? parent.right : parent.left;
+      float area = leaf.aabb.Combine(m_nodes[sibling].aabb).SurfaceArea();
+      if (area > parent.aabb.SurfaceArea() * growthLimit)
+        reinsert.push_back(id);
+      else
+        refit.push_back(id);
+    }
+
+    if (!changed)
+      return;
+    m_wideValid = false;
+
+    // Reinsertion refits the path it leaves and the one it joins. Refit
+    // leaves already hold their new AABB, any branch above them that was
+    // combined early is refit again below.
+    for (int id : reinsert) {
+      RemoveLeaf(id);
+      InsertLeaf(id);
+    }
+
+    // Every branch above a refit leaf. Heights strictly grow towards the
+    // root, so sorting by height refits children before their parents.
+    std::vector<int> branches;
+    std::vector<bool> visited(m_nodes.size());
+    for (int id : refit) {
+      for (int index = m_parents[id];
+           index != Node::Null && !visited[index];
+           index = m_parents[index]) {
+        visited[index] = true;
+        branches.push_back(index);
+      }
+    }
+    std::sort(branches.begin(), branches.end(), [this](int a, int b) {
+      return m_heights[a] < m_heights[b];
+    });
+
+    for (int index : branches) {
+      Node &n = m_nodes[index];
+      n.aabb = m_nodes[n.left].aabb.Combine(m_nodes[n.right].aabb);
+    }
+  }
+
   T GetUserData(int id) const {
-    assert(id >= 0 && id < m_nodes.size());
-    return m_nodes[id].userData;
+    assert(id >= 0 && id < int(m_nodes.size()));
+    return m_userData[id];
   }
 
   const q3AABB &GetFatAABB(int id) const {
-    assert(id >= 0 && id < m_nodes.size());
+    assert(id >= 0 && id < int(m_nodes.size()));
     return m_nodes[id].aabb;
   }
 
@@ -150,7 +376,36 @@ public:
     }
   }
 
-  void QueryAABB(const std::function<bool(int)> &cb, const q3AABB &aabb) const {
+  // Rebuild the wide layout from the binary tree. Queries use it until the
+  // tree structure changes again.
+  void Collapse() {
+    m_wideNodes.clear();
+    m_wideValid = true;
+    if (m_root == Node::Null)
+      return;
+
+    if (m_nodes[m_root].IsLeaf()) {
+      m_wideNodes.push_back(MakeWideNode(&m_root, 1));
+      m_wideNodes[0].child[0] = WideLeaf(m_root);
+      return;
+    }
+
+    CollapseNode(m_root);
+  }
+
+  bool IsCollapsed() const { return m_wideValid; }
+
+  // Queries take any callable, usually a lambda, and are instantiated per
+  // callback so the per leaf call inlines. A std::function works as well.
+  template <typename F> void QueryAABB(F &&cb, const q3AABB &aabb) const {
+    if (m_wideValid) {
+      QueryAABBWide(cb, aabb);
+      return;
+    }
+
+    if (m_root == Node::Null)
+      return;
+
     const int k_stackCapacity = 256;
     int stack[k_stackCapacity];
     int sp = 1;
@@ -176,8 +431,13 @@ public:
     }
   }
 
-  void QueryRay(const std::function<bool(int)> &cb,
-                q3RaycastData &rayCast) const {
+  template <typename F>
+  void QueryRay(F &&cb, q3RaycastData &rayCast) const {
+    if (m_wideValid) {
+      QueryRayWide(cb, rayCast);
+      return;
+    }
+
     const float k_epsilon = float(1.0e-6);
     const int k_stackCapacity = 256;
     int stack[k_stackCapacity];
@@ -243,6 +503,199 @@ public:
     }
   }
 
+  static const int k_rayPacketSize = 16;
+
+  // Walk the tree once for a packet of up to k_rayPacketSize rays, testing
+  // four rays per SIMD compare. For every ray, cb( ray, id ) reports the
+  // same leaves in the same order as QueryRay would for that ray alone.
+  // Returning false stops that ray only.
+  template <typename F>
+  void QueryRayPacket(F &&cb, const q3RaycastData *rays, int count) const {
+    assert(count <= k_rayPacketSize);
+    const float k_epsilon = float(1.0e-6);
+
+    RayPacket packet;
+    for (int i = 0; i < k_rayPacketSize; ++i) {
+      q3RaycastData ray = {};
+      if (i < count)
+        ray = rays[i];
+      q3Vec3 p0 = ray.start;
+      q3Vec3 p1 = p0 + ray.dir * ray.t;
+      q3Vec3 d = p1 - p0;
+      q3Vec3 p01 = p0 + p1;
+      packet.dx[i] = d.x;
+      packet.dy[i] = d.y;
+      packet.dz[i] = d.z;
+      packet.adx[i] = std::abs(d.x);
+      packet.ady[i] = std::abs(d.y);
+      packet.adz[i] = std::abs(d.z);
+      packet.adxe[i] = std::abs(d.x) + k_epsilon;
+      packet.adye[i] = std::abs(d.y) + k_epsilon;
+      packet.adze[i] = std::abs(d.z) + k_epsilon;
+      packet.px[i] = p01.x;
+      packet.py[i] = p01.y;
+      packet.pz[i] = p01.z;
+    }
+
+    int alive = (1 << count) - 1;
+    auto report = [&](int rays, int id) {
+      for (int r = 0; r < count; ++r) {
+        if ((rays & (1 << r)) && !cb(r, id))
+          alive &= ~(1 << r);
+      }
+    };
+
+    const int k_stackCapacity = 256;
+    struct Entry {
+      int id;
+      int rays;
+    };
+    Entry stack[k_stackCapacity];
+    int sp = 0;
+
+    if (m_wideValid) {
+      if (m_wideNodes.empty())
+        return;
+
+      stack[sp++] = {0, alive};
+      while (sp) {
+        Entry e = stack[--sp];
+        const WideNode *n = &m_wideNodes[e.id];
+
+        for (int i = 0; i < n->count; ++i) {
+          q3AABB aabb = {{n->minX[i], n->minY[i], n->minZ[i]},
+                         {n->maxX[i], n->maxY[i], n->maxZ[i]}};
+          int hit = TestRayPacket(packet, aabb, e.rays & alive);
+          if (!hit)
+            continue;
+
+          int child = n->child[i];
+          if (child < Node::Null) {
+            report(hit, -(child + 2));
+          } else {
+            // k_stackCapacity too small
+            assert(sp < k_stackCapacity);
+            stack[sp++] = {child, hit};
+          }
+        }
+      }
+      return;
+    }
+
+    stack[sp++] = {m_root, alive};
+    while (sp) {
+      // k_stackCapacity too small
+      assert(sp < k_stackCapacity);
+
+      Entry e = stack[--sp];
+      if (e.id == Node::Null)
+        continue;
+
+      const Node *n = &m_nodes[e.id];
+      int hit = TestRayPacket(packet, n->aabb, e.rays & alive);
+      if (!hit)
+        continue;
+
+      if (n->IsLeaf()) {
+        report(hit, e.id);
+      } else {
+        stack[sp++] = {n->left, hit};
+        stack[sp++] = {n->right, hit};
+      }
+    }
+  }
+
+  // Visit leaves nearest first by the distance from point to their fat AABB.
+  // Nodes wait in a priority queue keyed by that distance, so only nodes
+  // nearer than the leaves still wanted are opened. cb( id, distanceSq )
+  // returns the squared distance the walk still cares about; it ends once
+  // every node left is farther.
+  template <typename F>
+  void QueryNearest(F &&cb, const q3Vec3 &point,
+                    float maxDistanceSq = FLT_MAX) const {
+    if (m_root == Node::Null)
+      return;
+
+    struct Entry {
+      float distanceSq;
+      int id;
+
+      bool operator>(const Entry &other) const {
+        return distanceSq > other.distanceSq;
+      }
+    };
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+
+    float rootDistanceSq = m_nodes[m_root].aabb.DistanceSq(point);
+    if (rootDistanceSq <= maxDistanceSq)
+      queue.push({rootDistanceSq, m_root});
+
+    while (!queue.empty()) {
+      Entry e = queue.top();
+      queue.pop();
+      if (e.distanceSq > maxDistanceSq)
+        return;
+
+      const Node *n = &m_nodes[e.id];
+      if (n->IsLeaf()) {
+        maxDistanceSq = cb(e.id, e.distanceSq);
+        continue;
+      }
+
+      for (int child : {n->left, n->right}) {
+        float distanceSq = m_nodes[child].aabb.DistanceSq(point);
+        if (distanceSq <= maxDistanceSq)
+          queue.push({distanceSq, child});
+      }
+    }
+  }
+
+  // Append the k leaves whose fat AABBs are nearest to point to ids,
+  // nearest first. Leaves farther than maxDistance are left out.
+  void QueryKNearest(const q3Vec3 &point, int k, std::vector<int> &ids,
+                     float maxDistance = FLT_MAX) const {
+    if (k <= 0)
+      return;
+
+    float maxDistanceSq = maxDistance * maxDistance;
+    int found = 0;
+    QueryNearest(
+        [&](int id, float) {
+          ids.push_back(id);
+          return ++found < k ? maxDistanceSq : float(-1.0);
+        },
+        point, maxDistanceSq);
+  }
+
+  // Leaf whose fat AABB is nearest to point, Null for an empty tree.
+  // distance receives the distance to that AABB, zero inside it.
+  int QueryClosest(const q3Vec3 &point, float *distance = nullptr) const {
+    int closest = Node::Null;
+    QueryNearest(
+        [&](int id, float distanceSq) {
+          closest = id;
+          if (distance)
+            *distance = std::sqrt(distanceSq);
+          return float(-1.0);
+        },
+        point);
+    return closest;
+  }
+
+  // Report cb( id, otherId ) for every overlapping pair of leaves, id from
+  // this tree and otherId from other, descending both trees together. Costs
+  // about one walk per overlapping pair instead of one query per leaf.
+  template <typename F>
+  void QueryOverlaps(F &&cb, const q3DynamicAABBTree &other) const {
+    DualTreeOverlaps(cb, other, false);
+  }
+
+  // Same for the leaves of this tree against each other. Each pair is
+  // reported once, in no particular order of its ids.
+  template <typename F> void QuerySelfOverlaps(F &&cb) const {
+    DualTreeOverlaps(cb, *this, true);
+  }
+
   // For testing
   void Validate() const {
     // Verify free list
@@ -251,7 +704,7 @@ public:
 
     while (index != Node::Null) {
       assert(index >= 0 && index < m_nodes.size());
-      index = m_nodes[index].next;
+      index = m_parents[index];
       ++freeNodes;
     }
 
@@ -259,7 +712,7 @@ public:
 
     // Validate tree structure
     if (m_root != Node::Null) {
-      assert(m_nodes[m_root].parent == Node::Null);
+      assert(m_parents[m_root] == Node::Null);
 
 #ifdef _DEBUG
       ValidateStructure(m_root);
@@ -268,19 +721,413 @@ public:
   }
 
 private:
+  // Walks pairs of nodes, one from each tree, that overlap. A pair of
+  // branches opens the larger one so both sides shrink at the same pace. In
+  // self mode the walk starts at ( root, root ), and a node paired with
+  // itself opens into its two children paired with themselves and with
+  // each other, so every leaf pair is reached once.
+  template <typename F>
+  void DualTreeOverlaps(F &cb, const q3DynamicAABBTree &other,
+                        bool self) const {
+    if (m_root == Node::Null || other.m_root == Node::Null)
+      return;
+
+    const int k_stackCapacity = 256;
+    struct Entry {
+      int a;
+      int b;
+    };
+    Entry stack[k_stackCapacity];
+    int sp = 1;
+
+    *stack = {m_root, other.m_root};
+
+    while (sp) {
+      // k_stackCapacity too small
+      assert(sp + 3 <= k_stackCapacity);
+
+      Entry e = stack[--sp];
+      const Node *a = &m_nodes[e.a];
+      const Node *b = &other.m_nodes[e.b];
+
+      if (self && e.a == e.b) {
+        if (!a->IsLeaf()) {
+          stack[sp++] = {a->left, a->left};
+          stack[sp++] = {a->right, a->right};
+          stack[sp++] = {a->left, a->right};
+        }
+        continue;
+      }
+
+      if (!a->aabb.IsOverlapped(b->aabb))
+        continue;
+
+      if (a->IsLeaf() && b->IsLeaf()) {
+        cb(e.a, e.b);
+        continue;
+      }
+
+      bool openA = b->IsLeaf() || (!a->IsLeaf() && a->aabb.SurfaceArea() >
+                                                       b->aabb.SurfaceArea());
+      if (openA) {
+        stack[sp++] = {a->left, e.b};
+        stack[sp++] = {a->right, e.b};
+      } else {
+        stack[sp++] = {e.a, b->left};
+        stack[sp++] = {e.a, b->right};
+      }
+    }
+  }
+
+  template <typename F>
+  void QueryAABBWide(F &cb, const q3AABB &aabb) const {
+    if (m_wideNodes.empty())
+      return;
+
+    const int k_stackCapacity = 256;
+    int stack[k_stackCapacity];
+    int sp = 1;
+
+    *stack = 0;
+
+    q3Float4 minX = q3Float4::Splat(aabb.min.x);
+    q3Float4 minY = q3Float4::Splat(aabb.min.y);
+    q3Float4 minZ = q3Float4::Splat(aabb.min.z);
+    q3Float4 maxX = q3Float4::Splat(aabb.max.x);
+    q3Float4 maxY = q3Float4::Splat(aabb.max.y);
+    q3Float4 maxZ = q3Float4::Splat(aabb.max.z);
+
+    while (sp) {
+      const WideNode *n = &m_wideNodes[stack[--sp]];
+
+      // Same test as q3AABB::IsOverlapped, four children at once
+      q3Float4 overlap = (q3Float4::Load(n->minX) <= maxX) &
+                         (q3Float4::Load(n->maxX) >= minX) &
+                         (q3Float4::Load(n->minY) <= maxY) &
+                         (q3Float4::Load(n->maxY) >= minY) &
+                         (q3Float4::Load(n->minZ) <= maxZ) &
+                         (q3Float4::Load(n->maxZ) >= minZ);
+      int mask = q3MoveMask(overlap) & ((1 << n->count) - 1);
+
+      for (int i = 0; i < n->count; ++i) {
+        if (!(mask & (1 << i)))
+          continue;
+
+        int child = n->child[i];
+        if (child < Node::Null) {
+          if (!cb(-(child + 2)))
+            return;
+        } else {
+          // k_stackCapacity too small
+          assert(sp < k_stackCapacity);
+          stack[sp++] = child;
+        }
+      }
+    }
+  }
+
+  template <typename F>
+  void QueryRayWide(F &cb, q3RaycastData &rayCast) const {
+    if (m_wideNodes.empty())
+      return;
+
+    const float k_epsilon = float(1.0e-6);
+    const int k_stackCapacity = 256;
+    int stack[k_stackCapacity];
+    int sp = 1;
+
+    *stack = 0;
+
+    // Mirrors the scalar segment vs AABB separating axis test in QueryRay
+    q3Vec3 p0 = rayCast.start;
+    q3Vec3 p1 = p0 + rayCast.dir * rayCast.t;
+    q3Vec3 d = p1 - p0;
+    q3Vec3 p01 = p0 + p1;
+
+    q3Float4 dx = q3Float4::Splat(d.x);
+    q3Float4 dy = q3Float4::Splat(d.y);
+    q3Float4 dz = q3Float4::Splat(d.z);
+    q3Float4 adx = q3Float4::Splat(std::abs(d.x));
+    q3Float4 ady = q3Float4::Splat(std::abs(d.y));
+    q3Float4 adz = q3Float4::Splat(std::abs(d.z));
+    q3Float4 adxe = q3Float4::Splat(std::abs(d.x) + k_epsilon);
+    q3Float4 adye = q3Float4::Splat(std::abs(d.y) + k_epsilon);
+    q3Float4 adze = q3Float4::Splat(std::abs(d.z) + k_epsilon);
+    q3Float4 px = q3Float4::Splat(p01.x);
+    q3Float4 py = q3Float4::Splat(p01.y);
+    q3Float4 pz = q3Float4::Splat(p01.z);
+
+    while (sp) {
+      const WideNode *n = &m_wideNodes[stack[--sp]];
+
+      q3Float4 minX = q3Float4::Load(n->minX);
+      q3Float4 minY = q3Float4::Load(n->minY);
+      q3Float4 minZ = q3Float4::Load(n->minZ);
+      q3Float4 maxX = q3Float4::Load(n->maxX);
+      q3Float4 maxY = q3Float4::Load(n->maxY);
+      q3Float4 maxZ = q3Float4::Load(n->maxZ);
+
+      q3Float4 ex = maxX - minX;
+      q3Float4 ey = maxY - minY;
+      q3Float4 ez = maxZ - minZ;
+      q3Float4 mx = px - minX - maxX;
+      q3Float4 my = py - minY - maxY;
+      q3Float4 mz = pz - minZ - maxZ;
+
+      q3Float4 separated = (q3Abs(mx) > ex + adx) | (q3Abs(my) > ey + ady) |
+                           (q3Abs(mz) > ez + adz) |
+                           (q3Abs(my * dz - mz * dy) > ey * adze + ez * adye) |
+                           (q3Abs(mz * dx - mx * dz) > ex * adze + ez * adxe) |
+                           (q3Abs(mx * dy - my * dx) > ex * adye + ey * adxe);
+      int mask = ~q3MoveMask(separated) & ((1 << n->count) - 1);
+
+      for (int i = 0; i < n->count; ++i) {
+        if (!(mask & (1 << i)))
+          continue;
+
+        int child = n->child[i];
+        if (child < Node::Null) {
+          if (!cb(-(child + 2)))
+            return;
+        } else {
+          // k_stackCapacity too small
+          assert(sp < k_stackCapacity);
+          stack[sp++] = child;
+        }
+      }
+    }
+  }
+
+  // Bit mask of the packet rays in rays whose segment overlaps aabb
+  static int TestRayPacket(const RayPacket &p, const q3AABB &aabb, int rays) {
+    q3Float4 minX = q3Float4::Splat(aabb.min.x);
+    q3Float4 minY = q3Float4::Splat(aabb.min.y);
+    q3Float4 minZ = q3Float4::Splat(aabb.min.z);
+    q3Float4 maxX = q3Float4::Splat(aabb.max.x);
+    q3Float4 maxY = q3Float4::Splat(aabb.max.y);
+    q3Float4 maxZ = q3Float4::Splat(aabb.max.z);
+    q3Float4 ex = maxX - minX;
+    q3Float4 ey = maxY - minY;
+    q3Float4 ez = maxZ - minZ;
+
+    int hit = 0;
+    for (int g = 0; g < k_rayPacketSize; g += 4) {
+      if (!((rays >> g) & 0xF))
+        continue;
+
+      q3Float4 dx = q3Float4::Load(p.dx + g);
+      q3Float4 dy = q3Float4::Load(p.dy + g);
+      q3Float4 dz = q3Float4::Load(p.dz + g);
+      q3Float4 adxe = q3Float4::Load(p.adxe + g);
+      q3Float4 adye = q3Float4::Load(p.adye + g);
+      q3Float4 adze = q3Float4::Load(p.adze + g);
+      q3Float4 mx = q3Float4::Load(p.px + g) - minX - maxX;
+      q3Float4 my = q3Float4::Load(p.py + g) - minY - maxY;
+      q3Float4 mz = q3Float4::Load(p.pz + g) - minZ - maxZ;
+
+      q3Float4 separated =
+          (q3Abs(mx) > ex + q3Float4::Load(p.adx + g)) |
+          (q3Abs(my) > ey + q3Float4::Load(p.ady + g)) |
+          (q3Abs(mz) > ez + q3Float4::Load(p.adz + g)) |
+          (q3Abs(my * dz - mz * dy) > ey * adze + ez * adye) |
+          (q3Abs(mz * dx - mx * dz) > ex * adze + ez * adxe) |
+          (q3Abs(mx * dy - my * dx) > ex * adye + ey * adxe);
+      hit |= (~q3MoveMask(separated) & 0xF) << g;
+    }
+
+    return hit & rays;
+  }
+
+  WideNode MakeWideNode(const int *children, int count) const {
+    WideNode w;
+    for (int i = 0; i < 4; ++i) {
+      // Empty slots can never overlap anything
+      q3AABB aabb = {{FLT_MAX, FLT_MAX, FLT_MAX}, {-FLT_MAX, -FLT_MAX, -FLT_MAX}};
+      if (i < count)
+        aabb = m_nodes[children[i]].aabb;
+      w.minX[i] = aabb.min.x;
+      w.minY[i] = aabb.min.y;
+      w.minZ[i] = aabb.min.z;
+      w.maxX[i] = aabb.max.x;
+      w.maxY[i] = aabb.max.y;
+      w.maxZ[i] = aabb.max.z;
+      w.child[i] = Node::Null;
+    }
+    w.count = count;
+    return w;
+  }
+
+  // Gather up to four descendants of a branch by repeatedly opening the
+  // child with the largest surface area, then collapse those recursively.
+  int CollapseNode(int index) {
+    int children[4] = {m_nodes[index].left, m_nodes[index].right};
+    int count = 2;
+
+    while (count < 4) {
+      int best = -1;
+      float bestArea = -FLT_MAX;
+      for (int i = 0; i < count; ++i) {
+        const Node *n = &m_nodes[children[i]];
+        if (!n->IsLeaf() && n->aabb.SurfaceArea() > bestArea) {
+          best = i;
+          bestArea = n->aabb.SurfaceArea();
+        }
+      }
+
+      if (best == -1)
+        break;
+
+      int open = children[best];
+      children[best] = m_nodes[open].left;
+      children[count++] = m_nodes[open].right;
+    }
+
+    int wide = int(m_wideNodes.size());
+    m_wideNodes.push_back(MakeWideNode(children, count));
+
+    for (int i = 0; i < count; ++i) {
+      int child = m_nodes[children[i]].IsLeaf() ? WideLeaf(children[i])
+                                                : CollapseNode(children[i]);
+      m_wideNodes[wide].child[i] = child;
+    }
+
+    return wide;
+  }
+
+  // Leaves are copied out of m_nodes during a build so partitioning walks
+  // a compact array instead of scattered nodes
+  struct BuildLeaf {
+    q3AABB aabb;
+    q3Vec3 center;
+    int id;
+  };
+
+  // Build a subtree over the given leaves, returns its root. Splits are
+  // picked by the surface area heuristic over up to k_bins centroid bins per
+  // axis.
+  // Deep subtrees fall back to median splits so the height stays within the
+  // fixed query stacks.
+  int BuildSAH(BuildLeaf *leaves, int count, int depth) {
+    if (count == 1)
+      return leaves[0].id;
+
+    const int k_bins = 16;
+    // Small ranges gain nothing from more bins than leaves
+    int bins = std::min(k_bins, count);
+    const int k_maxSAHDepth = 48;
+
+    q3AABB centroids = {leaves[0].center, leaves[0].center};
+    for (int i = 1; i < count; ++i) {
+      centroids = centroids.Combine({leaves[i].center, leaves[i].center});
+    }
+
+    int bestAxis = -1;
+    int bestSplit = 0;
+    q3Vec3 extent = centroids.max - centroids.min;
+    if (count > 2 && depth < k_maxSAHDepth) {
+      float bestCost = FLT_MAX;
+      for (int axis = 0; axis < 3; ++axis) {
+        if (extent[axis] <= float(0.0))
+          continue;
+
+        q3AABB bounds[k_bins];
+        int counts[k_bins] = {};
+        float scale = float(bins) / extent[axis];
+        for (int i = 0; i < count; ++i) {
+          int b = Bin(leaves[i], axis, centroids.min[axis], scale, bins);
+          bounds[b] = counts[b] ? bounds[b].Combine(leaves[i].aabb)
+                                : leaves[i].aabb;
+          ++counts[b];
+        }
+
+        // Sweep from the right to get the cost of every split plane
+        float rightArea[k_bins];
+        int rightCount[k_bins];
+        q3AABB right;
+        int n = 0;
+        for (int b = bins - 1; b > 0; --b) {
+          if (counts[b])
+            right = n ? right.Combine(bounds[b]) : bounds[b];
+          n += counts[b];
+          rightArea[b] = n ? right.SurfaceArea() : float(0.0);
+          rightCount[b] = n;
+        }
+
+        q3AABB left;
+        n = 0;
+        for (int b = 0; b < bins - 1; ++b) {
+          if (counts[b])
+            left = n ? left.Combine(bounds[b]) : bounds[b];
+          n += counts[b];
+          if (n == 0 || rightCount[b + 1] == 0)
+            continue;
+
+          float cost = left.SurfaceArea() * float(n) +
+                       rightArea[b + 1] * float(rightCount[b + 1]);
+          if (cost < bestCost) {
+            bestCost = cost;
+            bestAxis = axis;
+            bestSplit = b;
+          }
+        }
+      }
+    }
+
+    int middle;
+    if (bestAxis != -1) {
+      float scale = float(bins) / extent[bestAxis];
+      float min = centroids.min[bestAxis];
+      BuildLeaf *mid =
+          std::partition(leaves, leaves + count, [&](const BuildLeaf &leaf) {
+        return Bin(leaf, bestAxis, min, scale, bins) <= bestSplit;
+      });
+      middle = int(mid - leaves);
+    } else {
+      // Median split along the widest centroid axis
+      int axis = 0;
+      if (extent.y > extent[axis])
+        axis = 1;
+      if (extent.z > extent[axis])
+        axis = 2;
+      middle = count / 2;
+      std::nth_element(leaves, leaves + middle, leaves + count,
+                       [&](const BuildLeaf &a, const BuildLeaf &b) {
+                         return a.center[axis] < b.center[axis];
+                       });
+    }
+
+    int left = BuildSAH(leaves, middle, depth + 1);
+    int right = BuildSAH(leaves + middle, count - middle, depth + 1);
+
+    int index = AllocateNode();
+    m_nodes[index].left = left;
+    m_nodes[index].right = right;
+    m_nodes[index].aabb = m_nodes[left].aabb.Combine(m_nodes[right].aabb);
+    m_heights[index] = 1 + std::max(m_heights[left], m_heights[right]);
+    m_parents[left] = index;
+    m_parents[right] = index;
+    return index;
+  }
+
+  static int Bin(const BuildLeaf &leaf, int axis, float min, float scale,
+                 int bins) {
+    int b = int((leaf.center[axis] - min) * scale);
+    return std::min(std::max(b, 0), bins - 1);
+  }
+
   int AllocateNode() {
     if (m_freeList == Node::Null) {
-      m_nodes.resize(m_nodes.size() * 2);
+      Resize(int(m_nodes.size()) * 2);
       AddToFreeList(m_count);
     }
 
     int freeNode = m_freeList;
-    m_freeList = m_nodes[m_freeList].next;
-    m_nodes[freeNode].height = 0;
+    m_freeList = m_parents[m_freeList];
+    m_heights[freeNode] = 0;
     m_nodes[freeNode].left = Node::Null;
     m_nodes[freeNode].right = Node::Null;
-    m_nodes[freeNode].parent = Node::Null;
-    m_nodes[freeNode].userData = {};
+    m_parents[freeNode] = Node::Null;
+    m_userData[freeNode] = {};
     ++m_count;
     return freeNode;
   }
@@ -288,8 +1135,8 @@ private:
   inline void DeallocateNode(int index) {
     assert(index >= 0 && index < m_nodes.size());
 
-    m_nodes[index].next = m_freeList;
-    m_nodes[index].height = Node::Null;
+    m_parents[index] = m_freeList;
+    m_heights[index] = Node::Null;
     m_freeList = index;
 
     --m_count;
@@ -298,7 +1145,7 @@ private:
   int Balance(int iA) {
     Node *A = &m_nodes[iA];
 
-    if (A->IsLeaf() || A->height == 1)
+    if (A->IsLeaf() || m_heights[iA] == 1)
       return iA;
 
     /*      A
@@ -313,7 +1160,7 @@ private:
     Node *B = &m_nodes[iB];
     Node *C = &m_nodes[iC];
 
-    int balance = C->height - B->height;
+    int balance = m_heights[iC] - m_heights[iB];
 
     // C is higher, promote C
     if (balance > 1) {
@@ -323,41 +1170,41 @@ private:
       Node *G = &m_nodes[iG];
 
       // grandParent point to C
-      if (A->parent != Node::Null) {
-        if (m_nodes[A->parent].left == iA)
-          m_nodes[A->parent].left = iC;
+      if (m_parents[iA] != Node::Null) {
+        if (m_nodes[m_parents[iA]].left == iA)
+          m_nodes[m_parents[iA]].left = iC;
 
         else
-          m_nodes[A->parent].right = iC;
+          m_nodes[m_parents[iA]].right = iC;
       } else
         m_root = iC;
 
       // Swap A and C
       C->left = iA;
-      C->parent = A->parent;
-      A->parent = iC;
+      m_parents[iC] = m_parents[iA];
+      m_parents[iA] = iC;
 
       // Finish rotation
-      if (F->height > G->height) {
+      if (m_heights[iF] > m_heights[iG]) {
         C->right = iF;
         A->right = iG;
-        G->parent = iA;
+        m_parents[iG] = iA;
         A->aabb = B->aabb.Combine(G->aabb);
         C->aabb = A->aabb.Combine(F->aabb);
 
-        A->height = 1 + std::max(B->height, G->height);
-        C->height = 1 + std::max(A->height, F->height);
+        m_heights[iA] = 1 + std::max(m_heights[iB], m_heights[iG]);
+        m_heights[iC] = 1 + std::max(m_heights[iA], m_heights[iF]);
       }
 
       else {
         C->right = iG;
         A->right = iF;
-        F->parent = iA;
+        m_parents[iF] = iA;
         A->aabb = B->aabb.Combine(F->aabb);
         C->aabb = A->aabb.Combine(G->aabb);
 
-        A->height = 1 + std::max(B->height, F->height);
-        C->height = 1 + std::max(A->height, G->height);
+        m_heights[iA] = 1 + std::max(m_heights[iB], m_heights[iF]);
+        m_heights[iC] = 1 + std::max(m_heights[iA], m_heights[iG]);
       }
 
       return iC;
@@ -371,11 +1218,11 @@ private:
       Node *E = &m_nodes[iE];
 
       // grandParent point to B
-      if (A->parent != Node::Null) {
-        if (m_nodes[A->parent].left == iA)
-          m_nodes[A->parent].left = iB;
+      if (m_parents[iA] != Node::Null) {
+        if (m_nodes[m_parents[iA]].left == iA)
+          m_nodes[m_parents[iA]].left = iB;
         else
-          m_nodes[A->parent].right = iB;
+          m_nodes[m_parents[iA]].right = iB;
       }
 
       else
@@ -383,30 +1230,30 @@ private:
 
       // Swap A and B
       B->right = iA;
-      B->parent = A->parent;
-      A->parent = iB;
+      m_parents[iB] = m_parents[iA];
+      m_parents[iA] = iB;
 
       // Finish rotation
-      if (D->height > E->height) {
+      if (m_heights[iD] > m_heights[iE]) {
         B->left = iD;
         A->left = iE;
-        E->parent = iA;
+        m_parents[iE] = iA;
         A->aabb = C->aabb.Combine(E->aabb);
         B->aabb = A->aabb.Combine(D->aabb);
 
-        A->height = 1 + std::max(C->height, E->height);
-        B->height = 1 + std::max(A->height, D->height);
+        m_heights[iA] = 1 + std::max(m_heights[iC], m_heights[iE]);
+        m_heights[iB] = 1 + std::max(m_heights[iA], m_heights[iD]);
       }
 
       else {
         B->left = iE;
         A->left = iD;
-        D->parent = iA;
+        m_parents[iD] = iA;
         A->aabb = C->aabb.Combine(D->aabb);
         B->aabb = A->aabb.Combine(E->aabb);
 
-        A->height = 1 + std::max(C->height, D->height);
-        B->height = 1 + std::max(A->height, E->height);
+        m_heights[iA] = 1 + std::max(m_heights[iC], m_heights[iD]);
+        m_heights[iB] = 1 + std::max(m_heights[iA], m_heights[iE]);
       }
 
       return iB;
@@ -416,9 +1263,11 @@ private:
   }
 
   void InsertLeaf(int id) {
+    m_wideValid = false;
+
     if (m_root == Node::Null) {
       m_root = id;
-      m_nodes[m_root].parent = Node::Null;
+      m_parents[m_root] = Node::Null;
       return;
     }
 
@@ -478,19 +1327,19 @@ private:
     int sibling = searchIndex;
 
     // Create new parent
-    int oldParent = m_nodes[sibling].parent;
+    int oldParent = m_parents[sibling];
     int newParent = AllocateNode();
-    m_nodes[newParent].parent = oldParent;
-    m_nodes[newParent].userData = {};
+    m_parents[newParent] = oldParent;
+    m_userData[newParent] = {};
     m_nodes[newParent].aabb = leafAABB.Combine(m_nodes[sibling].aabb);
-    m_nodes[newParent].height = m_nodes[sibling].height + 1;
+    m_heights[newParent] = m_heights[sibling] + 1;
 
     // Sibling was root
     if (oldParent == Node::Null) {
       m_nodes[newParent].left = sibling;
       m_nodes[newParent].right = id;
-      m_nodes[sibling].parent = newParent;
-      m_nodes[id].parent = newParent;
+      m_parents[sibling] = newParent;
+      m_parents[id] = newParent;
       m_root = newParent;
     }
 
@@ -503,22 +1352,24 @@ private:
 
       m_nodes[newParent].left = sibling;
       m_nodes[newParent].right = id;
-      m_nodes[sibling].parent = newParent;
-      m_nodes[id].parent = newParent;
+      m_parents[sibling] = newParent;
+      m_parents[id] = newParent;
     }
 
-    SyncHeirarchy(m_nodes[id].parent);
+    SyncHeirarchy(m_parents[id]);
   }
 
   void RemoveLeaf(int id) {
+    m_wideValid = false;
+
     if (id == m_root) {
       m_root = Node::Null;
       return;
     }
 
     // Setup parent, grandParent and sibling
-    int parent = m_nodes[id].parent;
-    int grandParent = m_nodes[parent].parent;
+    int parent = m_parents[id];
+    int grandParent = m_parents[parent];
     int sibling;
 
     if (m_nodes[parent].left == id)
@@ -537,13 +1388,13 @@ private:
         m_nodes[grandParent].right = sibling;
 
       // Connect sibling to grandParent
-      m_nodes[sibling].parent = grandParent;
+      m_parents[sibling] = grandParent;
     }
 
     // Parent was root
     else {
       m_root = sibling;
-      m_nodes[sibling].parent = Node::Null;
+      m_parents[sibling] = Node::Null;
     }
 
     DeallocateNode(parent);
@@ -558,7 +1409,7 @@ private:
 
     if (n->IsLeaf()) {
       assert(ir == Node::Null);
-      assert(n->height == 0);
+      assert(m_heights[index] == 0);
       return;
     }
 
@@ -567,8 +1418,8 @@ private:
     auto l = &m_nodes[il];
     auto r = &m_nodes[ir];
 
-    assert(l->parent == index);
-    assert(r->parent == index);
+    assert(m_parents[il] == index);
+    assert(m_parents[ir] == index);
 
     ValidateStructure(il);
     ValidateStructure(ir);
@@ -594,21 +1445,30 @@ private:
       index = Balance(index);
       int left = m_nodes[index].left;
       int right = m_nodes[index].right;
-      m_nodes[index].height =
-          1 + std::max(m_nodes[left].height, m_nodes[right].height);
+      m_heights[index] =
+          1 + std::max(m_heights[left], m_heights[right]);
       m_nodes[index].aabb = m_nodes[left].aabb.Combine(m_nodes[right].aabb);
-      index = m_nodes[index].parent;
+      index = m_parents[index];
     }
   }
 
+  // Grow the node array and its side arrays together
+  void Resize(int size) {
+    m_nodes.resize(size);
+    m_parents.resize(size);
+    m_heights.resize(size);
+    m_userData.resize(size);
+    m_margins.resize(size);
+  }
+
   // Insert nodes at a given index until m_nodes.size() into the free list
   void AddToFreeList(int index) {
     for (int i = index; i < m_nodes.size() - 1; ++i) {
-      m_nodes[i].next = i + 1;
-      m_nodes[i].height = Node::Null;
+      m_parents[i] = i + 1;
+      m_heights[i] = Node::Null;
     }
-    m_nodes[m_nodes.size() - 1].next = Node::Null;
-    m_nodes[m_nodes.size() - 1].height = Node::Null;
+    m_parents[m_nodes.size() - 1] = Node::Null;
+    m_heights[m_nodes.size() - 1] = Node::Null;
     m_freeList = index;
   }
 };
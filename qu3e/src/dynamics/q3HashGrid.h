@@ -0,0 +1,389 @@
+#pragma once
+#include "q3DynamicAABBTree.h"
+#include <algorithm>
+#include <stdint.h>
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------
+// q3HashGrid
+//--------------------------------------------------------------------------------------------------
+// Uniform grid over fat AABBs with cells hashed into a bucket table, so the
+// world needs no bounds. Each proxy is listed in every cell it touches; proxies
+// that would touch too many cells are kept in a separate list and tested
+// against everything instead. Proxies keep the fat AABB and moved flag
+// semantics of q3DynamicAABBTree, so FindPairs reports the same pairs the
+// tree finds for its moved proxies.
+template <typename T> class q3HashGrid {
+  struct Cell {
+    int x;
+    int y;
+    int z;
+
+    bool operator==(const Cell &) const = default;
+  };
+
+  struct Proxy {
+    q3AABB aabb;
+    T userData;
+    float margin;
+    Cell min; // Cell range, only used for proxies in the grid
+    Cell max;
+    int next; // Next free proxy
+    bool alive;
+    bool isStatic;
+    bool moved;
+    bool large;
+  };
+
+  static const int Null = -1;
+
+  // Proxies spanning more cells than this along any axis go to m_large
+  static const int k_maxCellSpan = 4;
+
+  float m_cellSize;
+  float m_invCellSize;
+
+  std::vector<Proxy> m_proxies;
+  int m_freeList = Null;
+
+  // One entry per proxy per cell it touches
+  struct CellEntry {
+    Cell cell;
+    int id;
+  };
+
+  // Buckets keep their storage as proxies come and go, so steady state
+  // updates do not allocate. The bucket count is a power of two, grown to
+  // stay above the entry count.
+  std::vector<std::vector<CellEntry>> m_buckets;
+  int m_entryCount = 0;
+  std::vector<int> m_large;
+  std::vector<int> m_moved;
+
+public:
+  // The default fits the fat AABB of a unit box into at most 2x2x2 cells
+  q3HashGrid(float cellSize = float(2.0))
+      : m_cellSize(cellSize), m_invCellSize(float(1.0) / cellSize) {}
+
+  int Insert(const q3AABB &aabb, T userData, bool isStatic,
+             float margin = k_aabbMargin) {
+    int id;
+    if (m_freeList != Null) {
+      id = m_freeList;
+      m_freeList = m_proxies[id].next;
+    } else {
+      id = int(m_proxies.size());
+      m_proxies.emplace_back();
+    }
+
+    Proxy &p = m_proxies[id];
+    p.aabb = aabb;
+    FattenAABB(p.aabb, margin);
+    p.userData = userData;
+    p.margin = margin;
+    p.alive = true;
+    p.isStatic = isStatic;
+    p.moved = false;
+    Link(id);
+    MarkMoved(id);
+    return id;
+  }
+
+  void Remove(int id) {
+    assert(id >= 0 && id < int(m_proxies.size()));
+
+    Unlink(id);
+    if (m_proxies[id].moved) {
+      m_moved.erase(std::find(m_moved.begin(), m_moved.end(), id));
+    }
+
+    m_proxies[id].alive = false;
+    m_proxies[id].next = m_freeList;
+    m_freeList = id;
+  }
+
+  // Same as q3DynamicAABBTree::Update. Returns true when the proxy got a
+  // new fat AABB and was flagged as moved.
+  bool Update(int id, const q3AABB &aabb, const q3Vec3 &displacement = {}) {
+    assert(id >= 0 && id < int(m_proxies.size()));
+
+    Proxy &p = m_proxies[id];
+    if (!NeedsRefatten(p.aabb, aabb, p.margin, displacement))
+      return false;
+
+    q3AABB fat = aabb;
+    FattenAABB(fat, p.margin, displacement);
+
+    // Small moves keep most of their cells, only the difference between
+    // the old and new range is touched
+    Cell min = ToCell(fat.min);
+    Cell max = ToCell(fat.max);
+    if (!p.large && !IsLarge(min, max)) {
+      RemoveFromCells(id, p.min, p.max, min, max);
+      AddToCells(id, min, max, p.min, p.max);
+      p.min = min;
+      p.max = max;
+      p.aabb = fat;
+    } else {
+      Unlink(id);
+      p.aabb = fat;
+      Link(id);
+    }
+
+    MarkMoved(id);
+    return true;
+  }
+
+  T GetUserData(int id) const {
+    assert(id >= 0 && id < int(m_proxies.size()));
+    return m_proxies[id].userData;
+  }
+
+  const q3AABB &GetFatAABB(int id) const {
+    assert(id >= 0 && id < int(m_proxies.size()));
+    return m_proxies[id].aabb;
+  }
+
+  bool IsStatic(int id) const {
+    assert(id >= 0 && id < int(m_proxies.size()));
+    return m_proxies[id].isStatic;
+  }
+
+  int BucketCount() const { return int(m_buckets.size()); }
+  int LargeCount() const { return int(m_large.size()); }
+
+  // Report cb( idA, idB ) for every overlapping pair where at least one
+  // proxy moved since the last call, and not both are static. Each pair is
+  // reported once. Clears all moved flags.
+  template <typename F> void FindPairs(F &&cb) {
+    for (int id : m_moved) {
+      const Proxy &a = m_proxies[id];
+
+      auto test = [&](int other) {
+        const Proxy &b = m_proxies[other];
+        if (other == id || (a.isStatic && b.isStatic))
+          return;
+
+        // A pair of moved proxies is left to the lower id
+        if (b.moved && other < id)
+          return;
+
+        if (a.aabb.IsOverlapped(b.aabb))
+          cb(id, other);
+      };
+
+      if (a.large) {
+        for (int i = 0; i < int(m_proxies.size()); ++i) {
+          if (m_proxies[i].alive)
+            test(i);
+        }
+        continue;
+      }
+
+      ForEachInCells(a.min, a.max, [&](const Cell &cell, int other) {
+        // Two proxies share several cells when they overlap across a cell
+        // border. Only the cell holding the low corner of the overlap
+        // reports them.
+        if (Corner(a.min, m_proxies[other].min) == cell)
+          test(other);
+      });
+
+      for (int other : m_large)
+        test(other);
+    }
+
+    for (int id : m_moved)
+      m_proxies[id].moved = false;
+    m_moved.clear();
+  }
+
+  // Visits the cells the AABB touches, or every proxy when that would be
+  // more cells than proxies.
+  template <typename F> void QueryAABB(F &&cb, const q3AABB &aabb) const {
+    Cell min = ToCell(aabb.min);
+    Cell max = ToCell(aabb.max);
+    double cells = double(max.x - min.x + 1) * double(max.y - min.y + 1) *
+                   double(max.z - min.z + 1);
+    if (cells > double(m_proxies.size())) {
+      for (int id = 0; id < int(m_proxies.size()); ++id) {
+        const Proxy &p = m_proxies[id];
+        if (p.alive && aabb.IsOverlapped(p.aabb) && !cb(id))
+          return;
+      }
+      return;
+    }
+
+    bool stop = false;
+    ForEachInCells(min, max, [&](const Cell &cell, int id) {
+      const Proxy &p = m_proxies[id];
+      if (stop || !(Corner(min, p.min) == cell) || !aabb.IsOverlapped(p.aabb))
+        return;
+      stop = !cb(id);
+    });
+
+    for (int id : m_large) {
+      if (stop)
+        return;
+      if (aabb.IsOverlapped(m_proxies[id].aabb))
+        stop = !cb(id);
+    }
+  }
+
+  // Calls cb( id ) for every proxy
+  template <typename F> void ForEach(F &&cb) const {
+    for (int id = 0; id < int(m_proxies.size()); ++id) {
+      if (m_proxies[id].alive)
+        cb(id);
+    }
+  }
+
+  // Reports proxies overlapping the bounds of the ray segment
+  template <typename F> void QueryRay(F &&cb, q3RaycastData &rayCast) const {
+    q3Vec3 p0 = rayCast.start;
+    q3Vec3 p1 = p0 + rayCast.dir * rayCast.t;
+    q3AABB bounds = q3AABB{p0, p0}.Combine({p1, p1});
+    QueryAABB(cb, bounds);
+  }
+
+  void Render(q3Render *render) const {
+    render->SetPenColor(0.5f, 0.5f, 1.0f);
+    for (const Proxy &p : m_proxies) {
+      if (p.alive)
+        render->LineAABB(p.aabb);
+    }
+  }
+
+private:
+  Cell ToCell(const q3Vec3 &p) const {
+    return {
+        int(std::floor(p.x * m_invCellSize)),
+        int(std::floor(p.y * m_invCellSize)),
+        int(std::floor(p.z * m_invCellSize)),
+    };
+  }
+
+  // Cell of the low corner of two overlapping boxes, given their low cells.
+  // It lies in the cell range of both.
+  static Cell Corner(const Cell &a, const Cell &b) {
+    return {std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z)};
+  }
+
+  int Bucket(const Cell &c) const {
+    uint32_t h = uint32_t(c.x) * 73856093u ^ uint32_t(c.y) * 19349663u ^
+                 uint32_t(c.z) * 83492791u;
+    return int(h & uint32_t(m_buckets.size() - 1));
+  }
+
+  // Calls f( cell, id ) for every proxy listed in the cells from min to max
+  template <typename F>
+  void ForEachInCells(const Cell &min, const Cell &max, F &&f) const {
+    if (m_buckets.empty())
+      return;
+
+    for (int z = min.z; z <= max.z; ++z) {
+      for (int y = min.y; y <= max.y; ++y) {
+        for (int x = min.x; x <= max.x; ++x) {
+          Cell cell = {x, y, z};
+          for (const CellEntry &e : m_buckets[Bucket(cell)]) {
+            if (e.cell == cell)
+              f(cell, e.id);
+          }
+        }
+      }
+    }
+  }
+
+  static bool IsLarge(const Cell &min, const Cell &max) {
+    return max.x - min.x >= k_maxCellSpan || max.y - min.y >= k_maxCellSpan ||
+           max.z - min.z >= k_maxCellSpan;
+  }
+
+  static bool InRange(const Cell &c, const Cell &min, const Cell &max) {
+    return c.x >= min.x && c.y >= min.y && c.z >= min.z && c.x <= max.x &&
+           c.y <= max.y && c.z <= max.z;
+  }
+
+  void Link(int id) {
+    Proxy &p = m_proxies[id];
+    p.min = ToCell(p.aabb.min);
+    p.max = ToCell(p.aabb.max);
+    p.large = IsLarge(p.min, p.max);
+    if (p.large)
+      m_large.push_back(id);
+    else
+      AddToCells(id, p.min, p.max, {0, 0, 0}, {-1, -1, -1});
+  }
+
+  void Unlink(int id) {
+    Proxy &p = m_proxies[id];
+    if (p.large)
+      m_large.erase(std::find(m_large.begin(), m_large.end(), id));
+    else
+      RemoveFromCells(id, p.min, p.max, {0, 0, 0}, {-1, -1, -1});
+  }
+
+  // Add id to the cells from min to max, except those from keepMin to keepMax
+  // which already list it
+  void AddToCells(int id, const Cell &min, const Cell &max,
+                  const Cell &keepMin, const Cell &keepMax) {
+    int added = (max.x - min.x + 1) * (max.y - min.y + 1) * (max.z - min.z + 1);
+    if (m_entryCount + added > int(m_buckets.size()))
+      Grow(m_entryCount + added);
+
+    for (int z = min.z; z <= max.z; ++z) {
+      for (int y = min.y; y <= max.y; ++y) {
+        for (int x = min.x; x <= max.x; ++x) {
+          if (InRange({x, y, z}, keepMin, keepMax))
+            continue;
+
+          m_buckets[Bucket({x, y, z})].push_back({{x, y, z}, id});
+          ++m_entryCount;
+        }
+      }
+    }
+  }
+
+  // Remove id from the cells from min to max, except those from keepMin to
+  // keepMax
+  void RemoveFromCells(int id, const Cell &min, const Cell &max,
+                       const Cell &keepMin, const Cell &keepMax) {
+    for (int z = min.z; z <= max.z; ++z) {
+      for (int y = min.y; y <= max.y; ++y) {
+        for (int x = min.x; x <= max.x; ++x) {
+          if (InRange({x, y, z}, keepMin, keepMax))
+            continue;
+
+          auto &bucket = m_buckets[Bucket({x, y, z})];
+          for (CellEntry &e : bucket) {
+            if (e.id == id && e.cell == Cell{x, y, z}) {
+              e = bucket.back();
+              bucket.pop_back();
+              break;
+            }
+          }
+          --m_entryCount;
+        }
+      }
+    }
+  }
+
+  void Grow(int entries) {
+    int count = m_buckets.empty() ? 1024 : int(m_buckets.size());
+    while (count < entries * 2)
+      count *= 2;
+
+    std::vector<std::vector<CellEntry>> old(count);
+    old.swap(m_buckets);
+    for (auto &bucket : old) {
+      for (const CellEntry &e : bucket)
+        m_buckets[Bucket(e.cell)].push_back(e);
+    }
+  }
+
+  void MarkMoved(int id) {
+    if (!m_proxies[id].moved) {
+      m_proxies[id].moved = true;
+      m_moved.push_back(id);
+    }
+  }
+};
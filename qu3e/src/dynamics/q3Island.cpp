@@ -26,7 +26,7 @@ distribution.
 //--------------------------------------------------------------------------------------------------
 
 #include "q3Island.h"
-#include "../scene/q3Box.h"
+#include "../scene/q3Shape.h"
 #include "../scene/q3Scene.h"
 #include "q3BroadPhase.h"
 #include "q3Contact.h"
@@ -62,36 +62,34 @@ q3Island::q3Island(q3Body *seed, class q3ContactManager *contactManager) {
       continue;
 
     // Search all contacts connected to this body
-    for (q3ContactEdge *edge = contactManager->ContactEdge(body); edge;
-         edge = edge->next) {
-      auto contact = edge->constraint;
-
+    contactManager->ForEachContact(body, [&](q3ContactHandle,
+                                             q3ContactConstraint &contact,
+                                             q3Body *other) {
       // Skip contacts that have been added to an island already
-      if (contact->HasFlag(q3ContactConstraintFlags::eIsland))
-        continue;
+      if (contact.HasFlag(q3ContactConstraintFlags::eIsland))
+        return;
 
       // Can safely skip this contact if it didn't actually collide with
       // anything
-      if (!contact->HasFlag(q3ContactConstraintFlags::eColliding))
-        continue;
+      if (!contact.HasFlag(q3ContactConstraintFlags::eColliding))
+        return;
 
       // Skip sensors
-      if (contact->A->Sensor() || contact->B->Sensor())
-        continue;
+      if (contact.A->Sensor() || contact.B->Sensor())
+        return;
 
       // Mark island flag and add to island
-      contact->AddFlag(q3ContactConstraintFlags::eIsland);
-      m_constraints.push_back(contact);
+      contact.AddFlag(q3ContactConstraintFlags::eIsland);
+      m_constraints.push_back(&contact);
 
       // Attempt to add the other body in the contact to the island
       // to simulate contact awakening propogation
-      q3Body *other = edge->other;
       if (other->HasFlag(q3BodyFlags::eIsland))
-        continue;
+        return;
 
       m_stack.push_back(other);
       other->AddFlag(q3BodyFlags::eIsland);
-    }
+    });
   }
 
   assert(m_bodies.size() != 0);
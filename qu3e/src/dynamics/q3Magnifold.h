@@ -1,17 +1,41 @@
 #pragma once
 #include "../scene/q3Body.h"
 #include "../scene/q3Box.h"
+#include "../scene/q3Capsule.h"
+#include "../scene/q3Sphere.h"
 #include "q3Contact.h"
 
+// How q3BoxtoBox settled the separating axis query of a manifold
+enum class q3SatQuery : uint8_t {
+  eNone,       // Not queried yet
+  eFull,       // All 15 axes
+  eSeparation, // The cached axis still separates the boxes
+  eFeature,    // The boxes barely moved, the cached axis was reused
+};
+
+// Relative moves below these reuse the cached axis of touching boxes
+const float k_satLinearSlop = float(0.005);
+const float k_satAngularSlop = float(0.005);
+
+// Result of the last full separating axis query, kept across steps
+struct q3SatCache {
+  int axis = 0; // Separating axis, or of least penetration
+  bool separated = false;
+  bool valid = false;
+  q3SatQuery last = q3SatQuery::eNone;
+  q3Transform relative; // B in A's space at that query, if touching
+};
+
 struct q3Manifold {
-  void SetPair(q3Body *bodyA, q3Box *a, q3Body *bodyB, q3Box *b) {
+  void SetPair(q3Body *bodyA, q3Shape *a, q3Body *bodyB, q3Shape *b) {
     A = {bodyA, a};
     B = {bodyB, b};
     sensor = a->Sensor() || b->Sensor();
   }
 
-  std::tuple<q3Body *, q3Box *> A;
-  std::tuple<q3Body *, q3Box *> B;
+  std::tuple<q3Body *, q3Shape *> A;
+  std::tuple<q3Body *, q3Shape *> B;
+  q3SatCache cache; // Next to the pair, the query reads both
   q3Contact contacts[8];
   int contactCount;
 
@@ -26,3 +50,27 @@ struct q3Manifold {
 
 void q3BoxtoBox(q3Manifold *m, q3Body *a_body, q3Box *a, q3Body *b_body,
                 q3Box *b);
+
+// Contacts of the sphere and capsule shapes, in q3Collide.cpp
+void q3SpheretoSphere(q3Manifold *m, q3Body *a_body, q3Sphere *a,
+                      q3Body *b_body, q3Sphere *b);
+void q3BoxtoSphere(q3Manifold *m, q3Body *a_body, q3Box *a, q3Body *b_body,
+                   q3Sphere *b);
+void q3SpheretoCapsule(q3Manifold *m, q3Body *a_body, q3Sphere *a,
+                       q3Body *b_body, q3Capsule *b);
+void q3CapsuletoCapsule(q3Manifold *m, q3Body *a_body, q3Capsule *a,
+                        q3Body *b_body, q3Capsule *b);
+void q3BoxtoCapsule(q3Manifold *m, q3Body *a_body, q3Box *a, q3Body *b_body,
+                    q3Capsule *b);
+
+using q3CollideFn = void (*)(q3Manifold *m, q3Body *a_body, q3Shape *a,
+                             q3Body *b_body, q3Shape *b);
+
+// Runs the routine for the shape types of a and b from a dispatch table
+void q3Collide(q3Manifold *m, q3Body *a_body, q3Shape *a, q3Body *b_body,
+               q3Shape *b);
+
+// q3BoxtoBox for the pair of each manifold, with the separating axis
+// queries of four pairs at a time in SIMD lanes. The manifolds come out
+// the same as from q3BoxtoBox.
+void q3BoxtoBoxBatch(q3Manifold *const *manifolds, int count);
@@ -1,23 +1,22 @@
 #include "q3ClipVertex.h"
 #include "q3Magnifold.h"
 #include "../math/q3Math.h"
+#include "../math/q3Simd.h"
 
-static bool q3TrackFaceAxis(int *axis, int n, float s, float *sMax,
-                            const q3Vec3 &normal, q3Vec3 *axisNormal) {
+static bool q3TrackFaceAxis(int *axis, int n, float s, float *sMax) {
   if (s > float(0.0))
     return true;
 
   if (s > *sMax) {
     *sMax = s;
     *axis = n;
-    *axisNormal = normal;
   }
 
   return false;
 }
 
 static bool q3TrackEdgeAxis(int *axis, int n, float s, float *sMax,
-                            const q3Vec3 &normal, q3Vec3 *axisNormal) {
+                            const q3Vec3 &normal) {
   if (s > float(0.0))
     return true;
 
@@ -27,12 +26,63 @@ static bool q3TrackEdgeAxis(int *axis, int n, float s, float *sMax,
   if (s > *sMax) {
     *sMax = s;
     *axis = n;
-    *axisNormal = normal * l;
   }
 
   return false;
 }
 
+namespace {
+
+// World frames and extents of the two boxes of a query
+struct q3BoxPair {
+  q3Transform atx;
+  q3Transform btx;
+  q3Vec3 eA;
+  q3Vec3 eB;
+
+  q3BoxPair() = default;
+  q3BoxPair(const q3Body *a_body, const q3Box *a, const q3Body *b_body,
+            const q3Box *b)
+      : atx(a_body->Transform() * a->Local()),
+        btx(b_body->Transform() * b->Local()), eA(a->Extent()),
+        eB(b->Extent()) {}
+  // The manifold of two boxes
+  explicit q3BoxPair(const q3Manifold *m)
+      : q3BoxPair(std::get<0>(m->A),
+                  static_cast<const q3Box *>(std::get<1>(m->A)),
+                  std::get<0>(m->B),
+                  static_cast<const q3Box *>(std::get<1>(m->B))) {}
+};
+
+} // namespace
+
+// Unit normal of a query axis: a face axis of A or B in world space, or the
+// cross product of an edge of A and an edge of B in A's space
+static q3Vec3 q3BoxAxisNormal(const q3BoxPair &p, int axis) {
+  if (axis < 3)
+    return p.atx.rotation[axis];
+  if (axis < 6)
+    return p.btx.rotation[axis - 3];
+
+  // Column of B's frame in A's space
+  int bAxis = (axis - 6) % 3;
+  q3Vec3 c = p.atx.rotation.Transposed() * p.btx.rotation[bAxis];
+  q3Vec3 n;
+  switch ((axis - 6) / 3) {
+  case 0:
+    n = q3Vec3{float(0.0), -c[2], c[1]};
+    break;
+  case 1:
+    n = q3Vec3{c[2], float(0.0), -c[0]};
+    break;
+  default:
+    n = q3Vec3{-c[1], c[0], float(0.0)};
+    break;
+  }
+  float l = float(1.0) / n.Length();
+  return n * l;
+}
+
 static void q3ComputeIncidentFace(const q3Transform &itx, const q3Vec3 &e,
                                   q3Vec3 n, q3ClipVertex *out) {
   n = -(itx.rotation.Transposed() * n);
@@ -410,16 +460,13 @@ static void q3EdgesContact(q3Vec3 *CA, q3Vec3 *CB, const q3Vec3 &PA,
 // http://www.randygaul.net/2014/05/22/deriving-obb-to-obb-intersection-sat/
 // https://box2d.googlecode.com/files/GDC2007_ErinCatto.zip
 // https://box2d.googlecode.com/files/Box2D_Lite.zip
-void q3BoxtoBox(q3Manifold *m, q3Body *a_body, q3Box *a, q3Body *b_body,
-                q3Box *b) {
-  q3Transform atx = a_body->Transform();
-  q3Transform btx = b_body->Transform();
-  q3Transform aL = a->Local();
-  q3Transform bL = b->Local();
-  atx = atx * aL;
-  btx = btx * bL;
-  q3Vec3 eA = a->Extent();
-  q3Vec3 eB = b->Extent();
+// The 15 axis separation test. Returns the axis of least penetration, or
+// ~axis of the first separating axis when the boxes are apart.
+static int q3QueryBoxAxes(const q3BoxPair &p, float *separation) {
+  const q3Transform &atx = p.atx;
+  const q3Transform &btx = p.btx;
+  const q3Vec3 &eA = p.eA;
+  const q3Vec3 &eB = p.eB;
 
   // B's frame in A's space
   q3Mat3 C = atx.rotation.Transposed() * btx.rotation;
@@ -448,41 +495,38 @@ void q3BoxtoBox(q3Manifold *m, q3Body *a_body, q3Box *a, q3Body *b_body,
   int aAxis = ~0;
   int bAxis = ~0;
   int eAxis = ~0;
-  q3Vec3 nA;
-  q3Vec3 nB;
-  q3Vec3 nE;
 
   // Face axis checks
 
   // a's x axis
   s = std::abs(t.x) - (eA.x + q3Dot(absC.Column0(), eB));
-  if (q3TrackFaceAxis(&aAxis, 0, s, &aMax, atx.rotation.ex, &nA))
-    return;
+  if (q3TrackFaceAxis(&aAxis, 0, s, &aMax))
+    return ~0;
 
   // a's y axis
   s = std::abs(t.y) - (eA.y + q3Dot(absC.Column1(), eB));
-  if (q3TrackFaceAxis(&aAxis, 1, s, &aMax, atx.rotation.ey, &nA))
-    return;
+  if (q3TrackFaceAxis(&aAxis, 1, s, &aMax))
+    return ~1;
 
   // a's z axis
   s = std::abs(t.z) - (eA.z + q3Dot(absC.Column2(), eB));
-  if (q3TrackFaceAxis(&aAxis, 2, s, &aMax, atx.rotation.ez, &nA))
-    return;
+  if (q3TrackFaceAxis(&aAxis, 2, s, &aMax))
+    return ~2;
 
   // b's x axis
   s = std::abs(q3Dot(t, C.ex)) - (eB.x + q3Dot(absC.ex, eA));
-  if (q3TrackFaceAxis(&bAxis, 3, s, &bMax, btx.rotation.ex, &nB))
-    return;
+  if (q3TrackFaceAxis(&bAxis, 3, s, &bMax))
+    return ~3;
 
   // b's y axis
   s = std::abs(q3Dot(t, C.ey)) - (eB.y + q3Dot(absC.ey, eA));
-  if (q3TrackFaceAxis(&bAxis, 4, s, &bMax, btx.rotation.ey, &nB))
-    return;
+  if (q3TrackFaceAxis(&bAxis, 4, s, &bMax))
+    return ~4;
 
   // b's z axis
   s = std::abs(q3Dot(t, C.ez)) - (eB.z + q3Dot(absC.ez, eA));
-  if (q3TrackFaceAxis(&bAxis, 5, s, &bMax, btx.rotation.ez, &nB))
-    return;
+  if (q3TrackFaceAxis(&bAxis, 5, s, &bMax))
+    return ~5;
 
   if (!parallel) {
     // Edge axis checks
@@ -494,107 +538,241 @@ void q3BoxtoBox(q3Manifold *m, q3Body *a_body, q3Box *a, q3Body *b_body,
     rB = eB.y * absC[2][0] + eB.z * absC[1][0];
     s = std::abs(t.z * C[0][1] - t.y * C[0][2]) - (rA + rB);
     if (q3TrackEdgeAxis(&eAxis, 6, s, &eMax,
-                        q3Vec3{float(0.0), -C[0][2], C[0][1]}, &nE))
-      return;
+                        q3Vec3{float(0.0), -C[0][2], C[0][1]}))
+      return ~6;
 
     // Cross( a.x, b.y )
     rA = eA.y * absC[1][2] + eA.z * absC[1][1];
     rB = eB.x * absC[2][0] + eB.z * absC[0][0];
     s = std::abs(t.z * C[1][1] - t.y * C[1][2]) - (rA + rB);
     if (q3TrackEdgeAxis(&eAxis, 7, s, &eMax,
-                        q3Vec3{float(0.0), -C[1][2], C[1][1]}, &nE))
-      return;
+                        q3Vec3{float(0.0), -C[1][2], C[1][1]}))
+      return ~7;
 
     // Cross( a.x, b.z )
     rA = eA.y * absC[2][2] + eA.z * absC[2][1];
     rB = eB.x * absC[1][0] + eB.y * absC[0][0];
     s = std::abs(t.z * C[2][1] - t.y * C[2][2]) - (rA + rB);
     if (q3TrackEdgeAxis(&eAxis, 8, s, &eMax,
-                        q3Vec3{float(0.0), -C[2][2], C[2][1]}, &nE))
-      return;
+                        q3Vec3{float(0.0), -C[2][2], C[2][1]}))
+      return ~8;
 
     // Cross( a.y, b.x )
     rA = eA.x * absC[0][2] + eA.z * absC[0][0];
     rB = eB.y * absC[2][1] + eB.z * absC[1][1];
     s = std::abs(t.x * C[0][2] - t.z * C[0][0]) - (rA + rB);
     if (q3TrackEdgeAxis(&eAxis, 9, s, &eMax,
-                        q3Vec3{C[0][2], float(0.0), -C[0][0]}, &nE))
-      return;
+                        q3Vec3{C[0][2], float(0.0), -C[0][0]}))
+      return ~9;
 
     // Cross( a.y, b.y )
     rA = eA.x * absC[1][2] + eA.z * absC[1][0];
     rB = eB.x * absC[2][1] + eB.z * absC[0][1];
     s = std::abs(t.x * C[1][2] - t.z * C[1][0]) - (rA + rB);
     if (q3TrackEdgeAxis(&eAxis, 10, s, &eMax,
-                        q3Vec3{C[1][2], float(0.0), -C[1][0]}, &nE))
-      return;
+                        q3Vec3{C[1][2], float(0.0), -C[1][0]}))
+      return ~10;
 
     // Cross( a.y, b.z )
     rA = eA.x * absC[2][2] + eA.z * absC[2][0];
     rB = eB.x * absC[1][1] + eB.y * absC[0][1];
     s = std::abs(t.x * C[2][2] - t.z * C[2][0]) - (rA + rB);
     if (q3TrackEdgeAxis(&eAxis, 11, s, &eMax,
-                        q3Vec3{C[2][2], float(0.0), -C[2][0]}, &nE))
-      return;
+                        q3Vec3{C[2][2], float(0.0), -C[2][0]}))
+      return ~11;
 
     // Cross( a.z, b.x )
     rA = eA.x * absC[0][1] + eA.y * absC[0][0];
     rB = eB.y * absC[2][2] + eB.z * absC[1][2];
     s = std::abs(t.y * C[0][0] - t.x * C[0][1]) - (rA + rB);
     if (q3TrackEdgeAxis(&eAxis, 12, s, &eMax,
-                        q3Vec3{-C[0][1], C[0][0], float(0.0)}, &nE))
-      return;
+                        q3Vec3{-C[0][1], C[0][0], float(0.0)}))
+      return ~12;
 
     // Cross( a.z, b.y )
     rA = eA.x * absC[1][1] + eA.y * absC[1][0];
     rB = eB.x * absC[2][2] + eB.z * absC[0][2];
     s = std::abs(t.y * C[1][0] - t.x * C[1][1]) - (rA + rB);
     if (q3TrackEdgeAxis(&eAxis, 13, s, &eMax,
-                        q3Vec3{-C[1][1], C[1][0], float(0.0)}, &nE))
-      return;
+                        q3Vec3{-C[1][1], C[1][0], float(0.0)}))
+      return ~13;
 
     // Cross( a.z, b.z )
     rA = eA.x * absC[2][1] + eA.y * absC[2][0];
     rB = eB.x * absC[1][2] + eB.y * absC[0][2];
     s = std::abs(t.y * C[2][0] - t.x * C[2][1]) - (rA + rB);
     if (q3TrackEdgeAxis(&eAxis, 14, s, &eMax,
-                        q3Vec3{-C[2][1], C[2][0], float(0.0)}, &nE))
-      return;
+                        q3Vec3{-C[2][1], C[2][0], float(0.0)}))
+      return ~14;
   }
 
   // Artificial axis bias to improve frame coherence
   const float kRelTol = float(0.95);
   const float kAbsTol = float(0.01);
-  int axis;
-  float sMax;
-  q3Vec3 n;
   float faceMax = std::max(aMax, bMax);
   if (kRelTol * eMax > faceMax + kAbsTol) {
-    axis = eAxis;
-    sMax = eMax;
-    n = nE;
+    *separation = eMax;
+    return eAxis;
   }
 
   else {
     if (kRelTol * bMax > aMax + kAbsTol) {
-      axis = bAxis;
-      sMax = bMax;
-      n = nB;
+      *separation = bMax;
+      return bAxis;
     }
 
     else {
-      axis = aAxis;
-      sMax = aMax;
-      n = nA;
+      *separation = aMax;
+      return aAxis;
     }
   }
+}
+
+// B's frame in A's space, the C and t of q3QueryBoxAxes. Written out so
+// the cache checks below can skip the entries they do not need; q3Dot sums
+// in the order of the q3Mat3 products, so the values are the same.
+static float q3BoxRotationEntry(const q3BoxPair &p, int i, int j) {
+  return q3Dot(p.atx.rotation[j], p.btx.rotation[i]);
+}
+
+static q3Transform q3BoxRelative(const q3BoxPair &p) {
+  q3Transform relative;
+  q3Vec3 d = p.btx.position - p.atx.position;
+  for (int j = 0; j < 3; ++j) {
+    relative.position[j] = q3Dot(p.atx.rotation[j], d);
+    for (int i = 0; i < 3; ++i)
+      relative.rotation[i][j] = q3BoxRotationEntry(p, i, j);
+  }
+  return relative;
+}
 
-  if (q3Dot(n, btx.position - atx.position) < float(0.0))
-    n = -n;
+// Separation along one axis of the query, with the same arithmetic as
+// q3QueryBoxAxes. Edge axes of boxes with parallel faces are skipped there,
+// and give -max here.
+static float q3BoxAxisSeparation(const q3BoxPair &p, int axis) {
+  q3Vec3 d = p.btx.position - p.atx.position;
+  if (axis < 3) {
+    float t = q3Dot(p.atx.rotation[axis], d);
+    q3Vec3 row{std::abs(q3BoxRotationEntry(p, 0, axis)),
+               std::abs(q3BoxRotationEntry(p, 1, axis)),
+               std::abs(q3BoxRotationEntry(p, 2, axis))};
+    return std::abs(t) - (p.eA[axis] + q3Dot(row, p.eB));
+  }
+
+  q3Transform relative = q3BoxRelative(p);
+  const q3Mat3 &C = relative.rotation;
+  const q3Vec3 &t = relative.position;
+  if (axis < 6) {
+    int i = axis - 3;
+    q3Vec3 absC{std::abs(C[i][0]), std::abs(C[i][1]), std::abs(C[i][2])};
+    return std::abs(q3Dot(t, C[i])) - (p.eB[i] + q3Dot(absC, p.eA));
+  }
+
+  q3Mat3 absC;
+  bool parallel = false;
+  const float kCosTol = float(1.0e-6);
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      absC[i][j] = std::abs(C[i][j]);
+      if (absC[i][j] + kCosTol >= float(1.0))
+        parallel = true;
+    }
+  }
+  if (parallel)
+    return -std::numeric_limits<float>::max();
+
+  // Cross( a[i], b[j] ), the other two axes of each box in ascending order
+  const int other[3][2] = {{1, 2}, {0, 2}, {0, 1}};
+  int i = (axis - 6) / 3;
+  int j = (axis - 6) % 3;
+  int p0 = other[i][0], p1 = other[i][1];
+  int q0 = other[j][0], q1 = other[j][1];
+  float rA = p.eA[p0] * absC[j][p1] + p.eA[p1] * absC[j][p0];
+  float rB = p.eB[q0] * absC[q1][i] + p.eB[q1] * absC[q0][i];
+  float s;
+  q3Vec3 n;
+  switch (i) {
+  case 0:
+    s = std::abs(t.z * C[j][1] - t.y * C[j][2]);
+    n = q3Vec3{float(0.0), -C[j][2], C[j][1]};
+    break;
+  case 1:
+    s = std::abs(t.x * C[j][2] - t.z * C[j][0]);
+    n = q3Vec3{C[j][2], float(0.0), -C[j][0]};
+    break;
+  default:
+    s = std::abs(t.y * C[j][0] - t.x * C[j][1]);
+    n = q3Vec3{-C[j][1], C[j][0], float(0.0)};
+    break;
+  }
+  s -= rA + rB;
+  if (s > float(0.0))
+    return s;
+  return s * (float(1.0) / n.Length());
+}
+
+// Settles the query from the manifold's cache when it can. An axis that
+// still separates the boxes ends the query; it would end the full query
+// too. Touching boxes whose relative pose stayed within the slops of the
+// last full query keep its axis, so the manifold is rebuilt on the same
+// features.
+static bool q3QueryBoxCache(q3SatCache *cache, const q3BoxPair &p, int *axis,
+                            float *separation) {
+  if (!cache->valid)
+    return false;
+
+  float s = q3BoxAxisSeparation(p, cache->axis);
+  if (s > float(0.0)) {
+    *axis = ~cache->axis;
+    cache->last = q3SatQuery::eSeparation;
+    return true;
+  }
+  if (cache->separated || s == -std::numeric_limits<float>::max())
+    return false;
+
+  q3Transform relative = q3BoxRelative(p);
+  q3Vec3 dp = relative.position - cache->relative.position;
+  if (dp.LengthSq() > k_satLinearSlop * k_satLinearSlop)
+    return false;
+  for (int i = 0; i < 3; ++i) {
+    q3Vec3 dr = relative.rotation[i] - cache->relative.rotation[i];
+    if (dr.LengthSq() > k_satAngularSlop * k_satAngularSlop)
+      return false;
+  }
+
+  *axis = cache->axis;
+  *separation = s;
+  cache->last = q3SatQuery::eFeature;
+  return true;
+}
 
-  if (axis == ~0)
+// Records the result of a full query. Only touching pairs reuse the
+// relative pose, so separated ones skip it.
+static void q3UpdateBoxCache(q3SatCache *cache, const q3BoxPair &p,
+                             int axis) {
+  if (axis >= 0)
+    cache->relative = q3BoxRelative(p);
+  cache->separated = axis < 0;
+  cache->axis = axis < 0 ? ~axis : axis;
+  cache->valid = true;
+  cache->last = q3SatQuery::eFull;
+}
+
+// Builds the manifold for the axis found by the query, clipping the
+// incident face for face axes
+static void q3BuildBoxManifold(q3Manifold *m, const q3BoxPair &p, int axis,
+                               float sMax) {
+  if (axis < 0)
     return;
 
+  const q3Transform &atx = p.atx;
+  const q3Transform &btx = p.btx;
+  const q3Vec3 &eA = p.eA;
+  const q3Vec3 &eB = p.eB;
+  q3Vec3 n = q3BoxAxisNormal(p, axis);
+  if (q3Dot(n, btx.position - atx.position) < float(0.0))
+    n = -n;
+
   if (axis < 6) {
     q3Transform rtx;
     q3Transform itx;
@@ -679,3 +857,211 @@ void q3BoxtoBox(q3Manifold *m, q3Body *a_body, q3Box *a, q3Body *b_body,
     c->position = (CA + CB) * float(0.5);
   }
 }
+
+void q3BoxtoBox(q3Manifold *m, q3Body *a_body, q3Box *a, q3Body *b_body,
+                q3Box *b) {
+  q3BoxPair p(a_body, a, b_body, b);
+  float sMax;
+  int axis;
+  if (!q3QueryBoxCache(&m->cache, p, &axis, &sMax)) {
+    axis = q3QueryBoxAxes(p, &sMax);
+    q3UpdateBoxCache(&m->cache, p, axis);
+  }
+  q3BuildBoxManifold(m, p, axis, sMax);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Batched query
+//--------------------------------------------------------------------------------------------------
+namespace {
+
+// Four box pairs, one per lane. Rotation columns are indexed [column][row].
+struct alignas(16) q3BoxPair4 {
+  float ra[3][3][4];
+  float rb[3][3][4];
+  float d[3][4]; // B's position minus A's
+  float ea[3][4];
+  float eb[3][4];
+
+  void Set(int lane, const q3BoxPair &p) {
+    q3Vec3 d3 = p.btx.position - p.atx.position;
+    for (int i = 0; i < 3; ++i) {
+      for (int j = 0; j < 3; ++j) {
+        ra[i][j][lane] = p.atx.rotation[i][j];
+        rb[i][j][lane] = p.btx.rotation[i][j];
+      }
+      d[i][lane] = d3[i];
+      ea[i][lane] = p.eA[i];
+      eb[i][lane] = p.eB[i];
+    }
+  }
+};
+
+} // namespace
+
+// q3QueryBoxAxes on four pairs at once. Every axis is tested in every lane,
+// instead of stopping at the first separating one, with the arithmetic in
+// the same order as the scalar query so each lane gets the same result.
+// Lanes that are apart return ~ their most separating axis instead of the
+// first, which the cache can use just as well.
+static void q3QueryBoxAxes4(const q3BoxPair4 &p, int *axes,
+                            float *separations) {
+  using F = q3Float4;
+  F ra[3][3];
+  F rb[3][3];
+  F ea[3];
+  F eb[3];
+  F d[3];
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      ra[i][j] = F::Load(p.ra[i][j]);
+      rb[i][j] = F::Load(p.rb[i][j]);
+    }
+    ea[i] = F::Load(p.ea[i]);
+    eb[i] = F::Load(p.eb[i]);
+    d[i] = F::Load(p.d[i]);
+  }
+
+  // B's frame in A's space, C[i][j] is row j of column i
+  F C[3][3];
+  F absC[3][3];
+  F parallel = F::Splat(0.0f) < F::Splat(0.0f);
+  const F kCosTol = F::Splat(1.0e-6f);
+  const F one = F::Splat(1.0f);
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      C[i][j] = ra[j][0] * rb[i][0] + ra[j][1] * rb[i][1] + ra[j][2] * rb[i][2];
+      absC[i][j] = q3Abs(C[i][j]);
+      parallel = parallel | (absC[i][j] + kCosTol >= one);
+    }
+  }
+
+  // Vector from center A to center B in A's space
+  F t[3];
+  for (int j = 0; j < 3; ++j)
+    t[j] = ra[j][0] * d[0] + ra[j][1] * d[1] + ra[j][2] * d[2];
+
+  const F lowest = F::Splat(-std::numeric_limits<float>::max());
+  F aMax = lowest;
+  F bMax = lowest;
+  F eMax = lowest;
+  F aAxis = F::Splat(-1.0f);
+  F bAxis = aAxis;
+  F eAxis = aAxis;
+  auto track = [](F s, float axis, F *sMax, F *sAxis) {
+    F better = s > *sMax;
+    *sMax = q3Select(better, s, *sMax);
+    *sAxis = q3Select(better, F::Splat(axis), *sAxis);
+  };
+
+  // Face axis checks
+  for (int j = 0; j < 3; ++j) {
+    F s = q3Abs(t[j]) -
+          (ea[j] + (absC[0][j] * eb[0] + absC[1][j] * eb[1] +
+                    absC[2][j] * eb[2]));
+    track(s, float(j), &aMax, &aAxis);
+  }
+  for (int i = 0; i < 3; ++i) {
+    F s = q3Abs(t[0] * C[i][0] + t[1] * C[i][1] + t[2] * C[i][2]) -
+          (eb[i] + (absC[i][0] * ea[0] + absC[i][1] * ea[1] +
+                    absC[i][2] * ea[2]));
+    track(s, float(3 + i), &bMax, &bAxis);
+  }
+
+  // Edge axis checks, cross( a[i], b[j] ). Lanes with parallel faces skip
+  // them, as the scalar query does.
+  const int other[3][2] = {{1, 2}, {0, 2}, {0, 1}};
+  for (int i = 0; i < 3; ++i) {
+    int p0 = other[i][0];
+    int p1 = other[i][1];
+    for (int j = 0; j < 3; ++j) {
+      int q0 = other[j][0];
+      int q1 = other[j][1];
+      F rA = ea[p0] * absC[j][p1] + ea[p1] * absC[j][p0];
+      F rB = eb[q0] * absC[q1][i] + eb[q1] * absC[q0][i];
+
+      // The normal has a zero in row i; its squared length skips the term
+      F s;
+      F lengthSq;
+      switch (i) {
+      case 0:
+        s = t[2] * C[j][1] - t[1] * C[j][2];
+        lengthSq = C[j][2] * C[j][2] + C[j][1] * C[j][1];
+        break;
+      case 1:
+        s = t[0] * C[j][2] - t[2] * C[j][0];
+        lengthSq = C[j][2] * C[j][2] + C[j][0] * C[j][0];
+        break;
+      default:
+        s = t[1] * C[j][0] - t[0] * C[j][1];
+        lengthSq = C[j][1] * C[j][1] + C[j][0] * C[j][0];
+        break;
+      }
+      s = q3Select(parallel, lowest, q3Abs(s) - (rA + rB));
+      s = s * (one / q3Sqrt(lengthSq));
+      track(s, float(6 + 3 * i + j), &eMax, &eAxis);
+    }
+  }
+
+  // Artificial axis bias to improve frame coherence
+  const F kRelTol = F::Splat(0.95f);
+  const F kAbsTol = F::Splat(0.01f);
+  F faceMax = q3Max(aMax, bMax);
+  F useEdge = kRelTol * eMax > faceMax + kAbsTol;
+  F useB = kRelTol * bMax > aMax + kAbsTol;
+  F axis = q3Select(useEdge, eAxis, q3Select(useB, bAxis, aAxis));
+  F sMax = q3Select(useEdge, eMax, q3Select(useB, bMax, aMax));
+  F apartAxis = q3Select(eMax > faceMax, eAxis,
+                         q3Select(bMax > aMax, bAxis, aAxis));
+  F separated = q3Max(faceMax, eMax) > F::Splat(0.0f);
+  axis = q3Select(separated, F::Splat(-1.0f) - apartAxis, axis);
+
+  alignas(16) float axisOut[4];
+  axis.Store(axisOut);
+  sMax.Store(separations);
+  for (int i = 0; i < 4; ++i)
+    axes[i] = int(axisOut[i]);
+}
+
+void q3BoxtoBoxBatch(q3Manifold *const *manifolds, int count) {
+  // Pairs the cache cannot settle, queried four at a time
+  q3Manifold *pending[4];
+  q3BoxPair pairs[4];
+  int pendingCount = 0;
+
+  auto flush = [&]() {
+    // Spare lanes repeat the last pair
+    q3BoxPair4 pair4;
+    for (int i = 0; i < 4; ++i)
+      pair4.Set(i, pairs[std::min(i, pendingCount - 1)]);
+
+    int axes[4];
+    alignas(16) float separations[4];
+    q3QueryBoxAxes4(pair4, axes, separations);
+    for (int i = 0; i < pendingCount; ++i) {
+      q3UpdateBoxCache(&pending[i]->cache, pairs[i], axes[i]);
+      q3BuildBoxManifold(pending[i], pairs[i], axes[i], separations[i]);
+    }
+    pendingCount = 0;
+  };
+
+  for (int i = 0; i < count; ++i) {
+    // The pair goes in the next free lane, which it keeps unless the cache
+    // settles it. Cold caches skip the call.
+    q3Manifold *m = manifolds[i];
+    q3BoxPair &p = pairs[pendingCount];
+    p = q3BoxPair(m);
+    float sMax;
+    int axis;
+    if (m->cache.valid && q3QueryBoxCache(&m->cache, p, &axis, &sMax)) {
+      q3BuildBoxManifold(m, p, axis, sMax);
+      continue;
+    }
+
+    pending[pendingCount] = m;
+    if (++pendingCount == 4)
+      flush();
+  }
+  if (pendingCount)
+    flush();
+}
@@ -0,0 +1,135 @@
+#pragma once
+#include <assert.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+// Handle into a q3SlotMap. The generation tells a handle to a removed value
+// apart from one to a later value that reuses the slot.
+struct q3SlotHandle {
+  uint32_t index = ~uint32_t(0);
+  uint32_t generation = 0;
+
+  bool operator==(const q3SlotHandle &) const = default;
+};
+
+//--------------------------------------------------------------------------------------------------
+// q3SlotMap
+//--------------------------------------------------------------------------------------------------
+// Values packed densely in one vector, addressed through a table of slots.
+// Removal moves the last value into the hole, so insertion and removal are
+// O(1) and iteration walks contiguous memory. Slots never move: a slot index
+// stays valid as a stable name for its value while the value itself moves
+// around the dense array. Pointers to values only last until the next
+// insertion or removal.
+template <typename T> class q3SlotMap {
+  struct Slot {
+    uint32_t dense; // Index into m_values, or next free slot
+    uint32_t generation;
+  };
+
+  static const uint32_t Null = ~uint32_t(0);
+
+  std::vector<T> m_values;
+  std::vector<uint32_t> m_owners; // Slot of each value
+  std::vector<Slot> m_slots;
+  uint32_t m_freeList = Null;
+
+public:
+  template <typename... Args> q3SlotHandle Emplace(Args &&...args) {
+    uint32_t index;
+    if (m_freeList != Null) {
+      index = m_freeList;
+      m_freeList = m_slots[index].dense;
+    } else {
+      index = uint32_t(m_slots.size());
+      m_slots.push_back({Null, 0});
+    }
+
+    m_slots[index].dense = uint32_t(m_values.size());
+    m_values.emplace_back(std::forward<Args>(args)...);
+    m_owners.push_back(index);
+    return {index, m_slots[index].generation};
+  }
+
+  // Returns false for a stale handle
+  bool Remove(q3SlotHandle h) {
+    if (!IsValid(h))
+      return false;
+
+    uint32_t dense = m_slots[h.index].dense;
+    uint32_t last = uint32_t(m_values.size()) - 1;
+    if (dense != last) {
+      m_values[dense] = std::move(m_values[last]);
+      m_owners[dense] = m_owners[last];
+      m_slots[m_owners[dense]].dense = dense;
+    }
+    m_values.pop_back();
+    m_owners.pop_back();
+
+    m_slots[h.index].dense = m_freeList;
+    ++m_slots[h.index].generation;
+    m_freeList = h.index;
+    return true;
+  }
+
+  bool IsValid(q3SlotHandle h) const {
+    return h.index < m_slots.size() &&
+           m_slots[h.index].generation == h.generation;
+  }
+
+  // Null for a stale handle
+  T *Get(q3SlotHandle h) {
+    return IsValid(h) ? &m_values[m_slots[h.index].dense] : nullptr;
+  }
+  const T *Get(q3SlotHandle h) const {
+    return IsValid(h) ? &m_values[m_slots[h.index].dense] : nullptr;
+  }
+
+  // Unchecked access by the index of a live slot
+  T &AtSlot(uint32_t index) {
+    assert(index < m_slots.size());
+    return m_values[m_slots[index].dense];
+  }
+
+  // Handle of the value in a live slot
+  q3SlotHandle SlotHandle(uint32_t index) const {
+    assert(index < m_slots.size());
+    return {index, m_slots[index].generation};
+  }
+
+  // Handle of the value at a dense position
+  q3SlotHandle HandleAt(size_t dense) const {
+    assert(dense < m_values.size());
+    uint32_t index = m_owners[dense];
+    return {index, m_slots[index].generation};
+  }
+
+  T &operator[](size_t dense) { return m_values[dense]; }
+  const T &operator[](size_t dense) const { return m_values[dense]; }
+
+  size_t Size() const { return m_values.size(); }
+  bool Empty() const { return m_values.empty(); }
+
+  typename std::vector<T>::iterator begin() { return m_values.begin(); }
+  typename std::vector<T>::iterator end() { return m_values.end(); }
+  typename std::vector<T>::const_iterator begin() const {
+    return m_values.begin();
+  }
+  typename std::vector<T>::const_iterator end() const {
+    return m_values.end();
+  }
+
+  void Reserve(size_t count) {
+    m_values.reserve(count);
+    m_owners.reserve(count);
+    m_slots.reserve(count);
+  }
+
+  void Clear() {
+    m_values.clear();
+    m_owners.clear();
+    m_slots.clear();
+    m_freeList = Null;
+  }
+};
@@ -0,0 +1,285 @@
+#pragma once
+#include "q3DynamicAABBTree.h"
+#include <algorithm>
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------
+// q3SweepAndPrune
+//--------------------------------------------------------------------------------------------------
+// Sort and sweep over fat AABBs along a single axis, the one along which the
+// proxy centers vary the most. Proxies keep the fat AABB and moved flag
+// semantics of q3DynamicAABBTree, so FindPairs reports the same pairs the
+// tree finds for its moved proxies. The sorted list carries over between
+// steps, which keeps the insertion sort close to linear for scenes that
+// mostly rest.
+template <typename T> class q3SweepAndPrune {
+  struct Proxy {
+    q3AABB aabb;
+    T userData;
+    float margin;
+    int entry; // Index into m_entries, or next free proxy
+  };
+
+  // Sort entry of one proxy. Everything the sweep needs before the full
+  // AABB test is kept here so the sweep walks one contiguous array.
+  struct Entry {
+    float min;
+    float max;
+    int id;
+    bool isStatic;
+    bool moved;
+  };
+
+  static const int Null = -1;
+
+  std::vector<Proxy> m_proxies;
+  int m_freeList = Null;
+  int m_count = 0;
+
+  std::vector<Entry> m_entries;
+  // Entries past this index were appended since the last sort
+  int m_sorted = 0;
+  // Removed proxies leave dead entries until the next sort
+  bool m_dead = false;
+  int m_axis = 0;
+
+  // Sorted positions of the moved entries, rebuilt by FindPairs
+  std::vector<int> m_movedAt;
+
+public:
+  int Insert(const q3AABB &aabb, T userData, bool isStatic,
+             float margin = k_aabbMargin) {
+    int id;
+    if (m_freeList != Null) {
+      id = m_freeList;
+      m_freeList = m_proxies[id].entry;
+    } else {
+      id = int(m_proxies.size());
+      m_proxies.emplace_back();
+    }
+    ++m_count;
+
+    Proxy &p = m_proxies[id];
+    p.aabb = aabb;
+    FattenAABB(p.aabb, margin);
+    p.userData = userData;
+    p.margin = margin;
+    p.entry = int(m_entries.size());
+
+    m_entries.push_back({
+        .min = p.aabb.min[m_axis],
+        .max = p.aabb.max[m_axis],
+        .id = id,
+        .isStatic = isStatic,
+        .moved = true,
+    });
+    return id;
+  }
+
+  void Remove(int id) {
+    assert(id >= 0 && id < int(m_proxies.size()));
+
+    m_entries[m_proxies[id].entry].id = Null;
+    m_dead = true;
+
+    m_proxies[id].entry = m_freeList;
+    m_freeList = id;
+    --m_count;
+  }
+
+  // Same as q3DynamicAABBTree::Update. Returns true when the proxy got a
+  // new fat AABB and was flagged as moved.
+  bool Update(int id, const q3AABB &aabb, const q3Vec3 &displacement = {}) {
+    assert(id >= 0 && id < int(m_proxies.size()));
+
+    Proxy &p = m_proxies[id];
+    if (!NeedsRefatten(p.aabb, aabb, p.margin, displacement))
+      return false;
+
+    p.aabb = aabb;
+    FattenAABB(p.aabb, p.margin, displacement);
+
+    Entry &e = m_entries[p.entry];
+    e.min = p.aabb.min[m_axis];
+    e.max = p.aabb.max[m_axis];
+    e.moved = true;
+    return true;
+  }
+
+  T GetUserData(int id) const {
+    assert(id >= 0 && id < int(m_proxies.size()));
+    return m_proxies[id].userData;
+  }
+
+  const q3AABB &GetFatAABB(int id) const {
+    assert(id >= 0 && id < int(m_proxies.size()));
+    return m_proxies[id].aabb;
+  }
+
+  bool IsStatic(int id) const {
+    assert(id >= 0 && id < int(m_proxies.size()));
+    return m_entries[m_proxies[id].entry].isStatic;
+  }
+
+  int Axis() const { return m_axis; }
+
+  // Report cb( idA, idB ) for every overlapping pair where at least one
+  // proxy moved since the last call, and not both are static. Clears all
+  // moved flags.
+  template <typename F> void FindPairs(F &&cb) {
+    Sort();
+
+    m_movedAt.clear();
+    for (int i = 0; i < int(m_entries.size()); ++i) {
+      if (m_entries[i].moved)
+        m_movedAt.push_back(i);
+    }
+
+    auto test = [this, &cb](const Entry &a, const Entry &b) {
+      if (a.isStatic && b.isStatic)
+        return;
+
+      if (m_proxies[a.id].aabb.IsOverlapped(m_proxies[b.id].aabb))
+        cb(a.id, b.id);
+    };
+
+    // Each pair is visited from its lower entry. A moved entry sweeps every
+    // entry after it; a resting one only needs the moved entries after it.
+    int n = int(m_entries.size());
+    int moved = int(m_movedAt.size());
+    int nextMoved = 0;
+    for (int i = 0; i < n && nextMoved < moved; ++i) {
+      const Entry &a = m_entries[i];
+      if (a.moved) {
+        ++nextMoved;
+        for (int j = i + 1; j < n && m_entries[j].min <= a.max; ++j)
+          test(a, m_entries[j]);
+      } else {
+        for (int k = nextMoved;
+             k < moved && m_entries[m_movedAt[k]].min <= a.max; ++k)
+          test(a, m_entries[m_movedAt[k]]);
+      }
+    }
+
+    for (int i : m_movedAt)
+      m_entries[i].moved = false;
+  }
+
+  // Queries test every proxy. The sort order is only brought up to date
+  // by FindPairs, so they cannot rely on it.
+  template <typename F> void QueryAABB(F &&cb, const q3AABB &aabb) const {
+    float min = aabb.min[m_axis];
+    float max = aabb.max[m_axis];
+    for (const Entry &e : m_entries) {
+      if (e.id == Null || e.min > max || e.max < min)
+        continue;
+
+      if (aabb.IsOverlapped(m_proxies[e.id].aabb) && !cb(e.id))
+        return;
+    }
+  }
+
+  // Calls cb( id ) for every proxy
+  template <typename F> void ForEach(F &&cb) const {
+    for (const Entry &e : m_entries) {
+      if (e.id != Null)
+        cb(e.id);
+    }
+  }
+
+  // Reports proxies overlapping the bounds of the ray segment
+  template <typename F> void QueryRay(F &&cb, q3RaycastData &rayCast) const {
+    q3Vec3 p0 = rayCast.start;
+    q3Vec3 p1 = p0 + rayCast.dir * rayCast.t;
+    q3AABB bounds = q3AABB{p0, p0}.Combine({p1, p1});
+    QueryAABB(cb, bounds);
+  }
+
+  void Render(q3Render *render) const {
+    render->SetPenColor(0.5f, 0.5f, 1.0f);
+    for (const Entry &e : m_entries) {
+      if (e.id != Null)
+        render->LineAABB(m_proxies[e.id].aabb);
+    }
+  }
+
+private:
+  // Bring m_entries into order along the axis of greatest variance
+  void Sort() {
+    if (m_dead) {
+      // Keeps the sorted prefix sorted
+      int sorted = 0;
+      int count = 0;
+      for (int i = 0; i < int(m_entries.size()); ++i) {
+        if (m_entries[i].id == Null)
+          continue;
+        if (i < m_sorted)
+          ++sorted;
+        m_entries[count++] = m_entries[i];
+      }
+      m_entries.resize(count);
+      m_sorted = sorted;
+      m_dead = false;
+    }
+
+    int axis = ChooseAxis();
+    if (axis != m_axis) {
+      m_axis = axis;
+      for (Entry &e : m_entries) {
+        e.min = m_proxies[e.id].aabb.min[m_axis];
+        e.max = m_proxies[e.id].aabb.max[m_axis];
+      }
+      m_sorted = 0;
+    }
+
+    auto less = [](const Entry &a, const Entry &b) { return a.min < b.min; };
+
+    // Last step's order, disturbed only by proxies that moved
+    for (int i = 1; i < m_sorted; ++i) {
+      Entry e = m_entries[i];
+      int j = i;
+      for (; j > 0 && e.min < m_entries[j - 1].min; --j)
+        m_entries[j] = m_entries[j - 1];
+      m_entries[j] = e;
+    }
+
+    // New proxies can land anywhere, so sort them on their own and merge
+    auto middle = m_entries.begin() + m_sorted;
+    std::sort(middle, m_entries.end(), less);
+    std::inplace_merge(m_entries.begin(), middle, m_entries.end(), less);
+    m_sorted = int(m_entries.size());
+
+    for (int i = 0; i < int(m_entries.size()); ++i)
+      m_proxies[m_entries[i].id].entry = i;
+  }
+
+  // Switches only when another axis clearly spreads the proxies out more,
+  // since a switch costs a full sort
+  int ChooseAxis() const {
+    if (m_entries.empty())
+      return m_axis;
+
+    q3Vec3 sum;
+    q3Vec3 sumSq;
+    for (const Entry &e : m_entries) {
+      const q3AABB &aabb = m_proxies[e.id].aabb;
+      q3Vec3 c = (aabb.min + aabb.max) * float(0.5);
+      sum += c;
+      sumSq += q3Vec3{c.x * c.x, c.y * c.y, c.z * c.z};
+    }
+
+    float n = float(m_entries.size());
+    float variance[3];
+    for (int i = 0; i < 3; ++i)
+      variance[i] = sumSq[i] / n - (sum[i] / n) * (sum[i] / n);
+
+    int best = 0;
+    for (int i = 1; i < 3; ++i) {
+      if (variance[i] > variance[best])
+        best = i;
+    }
+
+    const float k_hysteresis = float(1.25);
+    return variance[best] > variance[m_axis] * k_hysteresis ? best : m_axis;
+  }
+};
@@ -5,34 +5,127 @@
 #include "q3ContactManager.h"
 #include "q3ContactSolver.h"
 #include "q3Island.h"
+#include "../q3ThreadPool.h"
 #include <Remotery.h>
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+namespace {
+
+bool q3IsSeed(const q3Body *seed) {
+  // Seed cannot be apart of an island already
+  if (seed->HasFlag(q3BodyFlags::eIsland)) {
+    return false;
+  }
+
+  // Seed must be awake
+  if (!seed->HasFlag(q3BodyFlags::eAwake)) {
+    return false;
+  }
+
+  // Seed cannot be a static body in order to keep islands
+  // as small as possible
+  return !seed->HasFlag(q3BodyFlags::eStatic);
+}
+
+struct q3IslandRange {
+  int firstBody;
+  int bodyCount;
+  int firstConstraint;
+  int constraintCount;
+};
+
+// Static bodies may be in several islands. Solving one island after
+// another, each build wakes them and each island that falls asleep puts
+// them to sleep, so they end up as the last of their islands left them.
+void q3SleepStatics(std::span<q3Body *const> bodies, bool asleep) {
+  for (auto body : bodies) {
+    if (!body->HasFlag(q3BodyFlags::eStatic))
+      continue;
+    body->SetToAwake();
+    if (asleep)
+      body->SetToSleep();
+  }
+}
+
+// Every island is built before any is solved. Building reads flags and
+// contact edges, which solving leaves alone, and wakes the island's bodies.
+// Dynamic bodies belong to one island only; for the static ones
+// q3SleepStatics replays the wake and sleep calls in island order.
+void q3SolveIslands(const q3Env &env, q3Scene *scene,
+                    q3ContactManager *contactManager, q3ThreadPool *pool) {
+  std::vector<q3Body *> bodies;
+  std::vector<q3ContactConstraint *> constraints;
+  std::vector<q3IslandRange> islands;
+  for (auto seed : *scene) {
+    if (!q3IsSeed(seed)) {
+      continue;
+    }
+
+    // The island goes out of scope right away so its static bodies can join
+    // the next islands, as in the serial loop
+    q3Island island(seed, contactManager);
+    islands.push_back({int(bodies.size()), int(island.m_bodies.size()),
+                       int(constraints.size()),
+                       int(island.m_constraints.size())});
+    bodies.insert(bodies.end(), island.m_bodies.begin(),
+                  island.m_bodies.end());
+    constraints.insert(constraints.end(), island.m_constraints.begin(),
+                       island.m_constraints.end());
+  }
+
+  // Largest first, so a big island does not start last and hold up the
+  // join. Threads take the next island as they become free.
+  std::vector<int> order(islands.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&islands](int a, int b) {
+    return islands[a].constraintCount + islands[a].bodyCount >
+           islands[b].constraintCount + islands[b].bodyCount;
+  });
+
+  auto islandBodies = [&](const q3IslandRange &island) {
+    return std::span(bodies).subspan(island.firstBody, island.bodyCount);
+  };
+  std::vector<uint8_t> asleep(islands.size());
+  pool->ParallelFor(int(order.size()), [&](int index, int) {
+    const q3IslandRange &island = islands[order[index]];
+    asleep[order[index]] = q3ContactsSolve(
+        env, islandBodies(island),
+        std::span(constraints)
+            .subspan(island.firstConstraint, island.constraintCount));
+  });
+
+  for (int i = 0; i < int(islands.size()); ++i)
+    q3SleepStatics(islandBodies(islands[i]), asleep[i]);
+}
+
+} // namespace
 
 void q3TimeStep(const q3Env &env, q3Scene *scene,
                 class q3BroadPhase *broadphase,
-                q3ContactManager *contactManager) {
+                q3ContactManager *contactManager, q3ThreadPool *islandPool) {
   rmt_ScopedCPUSample(q3TimeStep, 0);
 
+  contactManager->ClearEvents();
+
+  auto beginContact = [contactManager](q3Body *bodyA, q3Shape *A, q3Body *bodyB,
+                                       q3Shape *B) {
+    contactManager->BeginContact(bodyA, A, bodyB, B);
+  };
+  auto endContact = [contactManager](q3Body *bodyA, q3Shape *A, q3Body *bodyB,
+                                     q3Shape *B) {
+    contactManager->EndContact(bodyA, A, bodyB, B);
+  };
+
   if (scene->NewBox()) {
-    broadphase->UpdatePairs(std::bind(
-        &q3ContactManager::AddContact, contactManager, std::placeholders::_1,
-        std::placeholders::_2, std::placeholders::_3, std::placeholders::_4));
+    broadphase->UpdatePairs(beginContact, endContact);
   }
 
-  // Remove contacts without broadphase overlap
+  // Update manifolds, dropping contacts that cannot collide anymore
   {
     rmt_ScopedCPUSample(qTestCollisions, 0);
-    auto testOverlap = [broadphase](q3Box *a, q3Box *b) {
-      return broadphase->TestOverlap(a->BroadPhaseIndex(),
-                                     b->BroadPhaseIndex());
-    };
-    auto it = contactManager->begin();
-    for (; it != contactManager->end();) {
-      if ((*it)->Test(testOverlap)) {
-        ++it;
-      } else {
-        it = contactManager->RemoveContact(*it);
-      }
-    }
+    contactManager->TestCollisions();
   }
 
   for (auto body : *scene) {
@@ -40,26 +133,19 @@ void q3TimeStep(const q3Env &env, q3Scene *scene,
   }
 
 #if 1
-  // Build each active island and then solve each built island
-  for (auto seed : *scene) {
-    // Seed cannot be apart of an island already
-    if (seed->HasFlag(q3BodyFlags::eIsland)) {
-      continue;
-    }
-
-    // Seed must be awake
-    if (!seed->HasFlag(q3BodyFlags::eAwake)) {
-      continue;
-    }
+  if (islandPool) {
+    q3SolveIslands(env, scene, contactManager, islandPool);
+  } else {
+    // Build each active island and then solve each built island
+    for (auto seed : *scene) {
+      if (!q3IsSeed(seed)) {
+        continue;
+      }
 
-    // Seed cannot be a static body in order to keep islands
-    // as small as possible
-    if (seed->HasFlag(q3BodyFlags::eStatic)) {
-      continue;
+      q3Island island(seed, contactManager);
+      bool asleep = q3ContactsSolve(env, island.m_bodies, island.m_constraints);
+      q3SleepStatics(island.m_bodies, asleep);
     }
-
-    q3Island island(seed, contactManager);
-    q3ContactsSolve(env, island.m_bodies, island.m_constraints);
   }
 #else
   // not span. range
@@ -69,9 +155,9 @@ void q3TimeStep(const q3Env &env, q3Scene *scene,
     bodies.push_back(body);
   }
   std::vector<q3ContactConstraint *> constraints;
-  for(auto constraint: *contactManager)
+  for(auto &constraint: *contactManager)
   {
-    constraints.push_back(constraint);
+    constraints.push_back(&constraint);
   }
   q3ContactsSolve(env, bodies, constraints);
 #endif
@@ -79,13 +165,8 @@ void q3TimeStep(const q3Env &env, q3Scene *scene,
   // Update the broadphase AABBs
   scene->UpdateTransforms();
 
-  // Look for new contacts
-  // ContactManager for each pair found
-  // Has broadphase find all contacts and call AddContact on the
-  broadphase->UpdatePairs(
-      [contactManager](q3Body *bodyA, q3Box *A, q3Body *bodyB, q3Box *B) {
-        contactManager->AddContact(bodyA, A, bodyB, B);
-      });
+  // Look for new contacts and drop the ones whose fat AABBs separated
+  broadphase->UpdatePairs(beginContact, endContact);
 
   // Clear all forces
   for (auto body : *scene) {
@@ -2,7 +2,10 @@
 #include "../scene/q3Env.h"
 
 // Run the simulation forward in time by dt (fixed timestep). Variable
-// timestep is not supported.
+// timestep is not supported. With a pool, the islands are all built first
+// and then solved across its threads, largest first; the results are bit
+// for bit those of solving them one after another.
 void q3TimeStep(const q3Env &env, class q3Scene *scene,
                 class q3BroadPhase *broadPhase,
-                class q3ContactManager *contactManager);
+                class q3ContactManager *contactManager,
+                class q3ThreadPool *islandPool = nullptr);
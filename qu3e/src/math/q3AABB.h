@@ -14,6 +14,16 @@ struct q3AABB {
     return min.x <= point.x && min.y <= point.y && min.z <= point.z &&
            max.x >= point.x && max.y >= point.y && max.z >= point.z;
   }
+  // Squared distance from point to the box, zero inside it
+  float DistanceSq(const q3Vec3 &point) const {
+    float d = float(0.0);
+    for (int i = 0; i < 3; ++i) {
+      float v = std::max(std::max(min[i] - point[i], point[i] - max[i]),
+                         float(0.0));
+      d += v * v;
+    }
+    return d;
+  }
   float SurfaceArea() const {
     float x = max.x - min.x;
     float y = max.y - min.y;
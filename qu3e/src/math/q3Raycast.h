@@ -1,4 +1,5 @@
 #pragma once
+#include "q3Transform.h"
 #include "q3Vec3.h"
 
 struct q3RaycastData {
@@ -21,3 +22,28 @@ struct q3RaycastData {
   // return value of true.
   q3Vec3 GetImpactPoint() const { return q3Vec3(start + dir * toi); }
 };
+
+// A box cast along a path, moving without turning
+struct q3SweepData {
+  q3Transform tx; // World transform of the box at the start
+  q3Vec3 e;       // Half extents of the box
+  q3Vec3 dir;     // Direction of the sweep (normalized)
+  float t;        // Time specifying the sweep endpoint
+
+  float toi;     // Solved time of impact
+  q3Vec3 normal; // Surface normal of the hit box at impact
+
+  void Set(const q3Transform &transform, const q3Vec3 &extent,
+           const q3Vec3 &direction, float endPointTime) {
+    tx = transform;
+    e = extent;
+    dir = direction;
+    t = endPointTime;
+  }
+
+  // World transform of the box at toi. Should only be called after a sweep
+  // has been conducted with a return value of true.
+  q3Transform GetImpactTransform() const {
+    return {tx.position + dir * toi, tx.rotation};
+  }
+};
@@ -0,0 +1,121 @@
+#include "q3Segment.h"
+#include <limits>
+
+//--------------------------------------------------------------------------------------------------
+// Resources:
+// Real-Time Collision Detection, Christer Ericson, 5.1.9
+void q3ClosestSegmentPoints(const q3Vec3 &p1, const q3Vec3 &q1,
+                            const q3Vec3 &p2, const q3Vec3 &q2, q3Vec3 *c1,
+                            q3Vec3 *c2) {
+  const float epsilon = float(1.0e-12);
+  q3Vec3 d1 = q1 - p1;
+  q3Vec3 d2 = q2 - p2;
+  q3Vec3 r = p1 - p2;
+  float a = q3Dot(d1, d1);
+  float e = q3Dot(d2, d2);
+  float f = q3Dot(d2, r);
+  float s;
+  float t;
+
+  if (a <= epsilon && e <= epsilon) {
+    *c1 = p1;
+    *c2 = p2;
+    return;
+  }
+
+  if (a <= epsilon) {
+    s = float(0.0);
+    t = std::clamp(f / e, float(0.0), float(1.0));
+  } else {
+    float c = q3Dot(d1, r);
+    if (e <= epsilon) {
+      t = float(0.0);
+      s = std::clamp(-c / a, float(0.0), float(1.0));
+    } else {
+      // Parallel segments pick s = 0 and let t settle it
+      float b = q3Dot(d1, d2);
+      float denom = a * e - b * b;
+      s = denom > float(0.0)
+              ? std::clamp((b * f - c * e) / denom, float(0.0), float(1.0))
+              : float(0.0);
+
+      t = (b * s + f) / e;
+      if (t < float(0.0)) {
+        t = float(0.0);
+        s = std::clamp(-c / a, float(0.0), float(1.0));
+      } else if (t > float(1.0)) {
+        t = float(1.0);
+        s = std::clamp((b - c) / a, float(0.0), float(1.0));
+      }
+    }
+  }
+
+  *c1 = p1 + d1 * s;
+  *c2 = p2 + d2 * t;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Outside the box the closest pair has an endpoint of the segment, or a
+// point of one of the 12 box edges: a segment point closest to the inside
+// of a face runs parallel to it, and then so does the rest of the segment
+// up to an endpoint or an edge.
+float q3SegmentBoxClosest(const q3Vec3 &a, const q3Vec3 &b, const q3Vec3 &e,
+                          q3Vec3 *onSegment, q3Vec3 *onBox) {
+  // Clip the segment against the slabs of the box
+  q3Vec3 d = b - a;
+  float tmin = float(0.0);
+  float tmax = float(1.0);
+  for (int i = 0; i < 3 && tmin <= tmax; ++i) {
+    if (std::abs(d[i]) < float(1.0e-8)) {
+      if (a[i] < -e[i] || a[i] > e[i])
+        tmax = -float(1.0);
+      continue;
+    }
+
+    float inv = float(1.0) / d[i];
+    float t0 = (-e[i] - a[i]) * inv;
+    float t1 = (e[i] - a[i]) * inv;
+    if (t0 > t1)
+      std::swap(t0, t1);
+    tmin = std::max(tmin, t0);
+    tmax = std::min(tmax, t1);
+  }
+  if (tmin <= tmax) {
+    *onSegment = a + d * (float(0.5) * (tmin + tmax));
+    *onBox = *onSegment;
+    return float(0.0);
+  }
+
+  float best = std::numeric_limits<float>::max();
+  auto consider = [&](const q3Vec3 &s, const q3Vec3 &q) {
+    float distanceSq = q3DistanceSq(s, q);
+    if (distanceSq < best) {
+      best = distanceSq;
+      *onSegment = s;
+      *onBox = q;
+    }
+  };
+  consider(a, q3ClampToBox(a, e));
+  consider(b, q3ClampToBox(b, e));
+
+  // Edges along axis i, at the four corners of the other two
+  for (int i = 0; i < 3; ++i) {
+    int j = (i + 1) % 3;
+    int k = (i + 2) % 3;
+    for (int corner = 0; corner < 4; ++corner) {
+      q3Vec3 p;
+      p[j] = corner & 1 ? e[j] : -e[j];
+      p[k] = corner & 2 ? e[k] : -e[k];
+      p[i] = -e[i];
+      q3Vec3 q = p;
+      q[i] = e[i];
+
+      q3Vec3 s;
+      q3Vec3 c;
+      q3ClosestSegmentPoints(a, b, p, q, &s, &c);
+      consider(s, c);
+    }
+  }
+
+  return std::sqrt(best);
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include "q3Vec3.h"
+#include <algorithm>
+
+// Parameter in [0, 1] of the point of the segment from a to b closest to p
+inline float q3SegmentParameter(const q3Vec3 &a, const q3Vec3 &b,
+                                const q3Vec3 &p) {
+  q3Vec3 ab = b - a;
+  float lengthSq = q3Dot(ab, ab);
+  if (lengthSq <= float(1.0e-12))
+    return float(0.0);
+  return std::clamp(q3Dot(p - a, ab) / lengthSq, float(0.0), float(1.0));
+}
+
+inline q3Vec3 q3ClosestPointOnSegment(const q3Vec3 &a, const q3Vec3 &b,
+                                      const q3Vec3 &p) {
+  return a + (b - a) * q3SegmentParameter(a, b, p);
+}
+
+// Point of the box with half extents e around the origin closest to p
+inline q3Vec3 q3ClampToBox(const q3Vec3 &p, const q3Vec3 &e) {
+  return {
+      std::clamp(p.x, -e.x, e.x),
+      std::clamp(p.y, -e.y, e.y),
+      std::clamp(p.z, -e.z, e.z),
+  };
+}
+
+// Closest points of the segments p1 q1 and p2 q2. Either may be a point.
+void q3ClosestSegmentPoints(const q3Vec3 &p1, const q3Vec3 &q1,
+                            const q3Vec3 &p2, const q3Vec3 &q2, q3Vec3 *c1,
+                            q3Vec3 *c2);
+
+// Closest points of the segment from a to b and the box with half extents e
+// around the origin, all in the box's space. Returns their distance. A
+// segment passing through the box gives zero, with both points in the middle
+// of the part inside.
+float q3SegmentBoxClosest(const q3Vec3 &a, const q3Vec3 &b, const q3Vec3 &e,
+                          q3Vec3 *onSegment, q3Vec3 *onBox);
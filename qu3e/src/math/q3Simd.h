@@ -0,0 +1,159 @@
+#pragma once
+#include <bit>
+#include <cmath>
+#include <stdint.h>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define Q3_SSE 1
+#include <emmintrin.h>
+#endif
+
+//--------------------------------------------------------------------------------------------------
+// q3Float4
+//--------------------------------------------------------------------------------------------------
+// Four float lanes. Maps to one SSE register when available, otherwise a
+// plain array with the same semantics. Comparisons return lane masks (all
+// bits set for true) to be consumed by q3Select and q3MoveMask.
+struct q3Float4 {
+#ifdef Q3_SSE
+  __m128 v;
+
+  static q3Float4 Load(const float *p) { return {_mm_load_ps(p)}; }
+  static q3Float4 Splat(float f) { return {_mm_set1_ps(f)}; }
+  void Store(float *p) const { _mm_store_ps(p, v); }
+#else
+  float v[4];
+
+  static q3Float4 Load(const float *p) { return {{p[0], p[1], p[2], p[3]}}; }
+  static q3Float4 Splat(float f) { return {{f, f, f, f}}; }
+  void Store(float *p) const {
+    for (int i = 0; i < 4; ++i)
+      p[i] = v[i];
+  }
+#endif
+};
+
+#ifdef Q3_SSE
+inline q3Float4 operator+(q3Float4 a, q3Float4 b) {
+  return {_mm_add_ps(a.v, b.v)};
+}
+inline q3Float4 operator-(q3Float4 a, q3Float4 b) {
+  return {_mm_sub_ps(a.v, b.v)};
+}
+inline q3Float4 operator*(q3Float4 a, q3Float4 b) {
+  return {_mm_mul_ps(a.v, b.v)};
+}
+inline q3Float4 operator/(q3Float4 a, q3Float4 b) {
+  return {_mm_div_ps(a.v, b.v)};
+}
+inline q3Float4 operator<(q3Float4 a, q3Float4 b) {
+  return {_mm_cmplt_ps(a.v, b.v)};
+}
+inline q3Float4 operator<=(q3Float4 a, q3Float4 b) {
+  return {_mm_cmple_ps(a.v, b.v)};
+}
+inline q3Float4 operator>(q3Float4 a, q3Float4 b) {
+  return {_mm_cmpgt_ps(a.v, b.v)};
+}
+inline q3Float4 operator>=(q3Float4 a, q3Float4 b) {
+  return {_mm_cmpge_ps(a.v, b.v)};
+}
+inline q3Float4 operator&(q3Float4 a, q3Float4 b) {
+  return {_mm_and_ps(a.v, b.v)};
+}
+inline q3Float4 operator|(q3Float4 a, q3Float4 b) {
+  return {_mm_or_ps(a.v, b.v)};
+}
+inline q3Float4 q3Min(q3Float4 a, q3Float4 b) { return {_mm_min_ps(a.v, b.v)}; }
+inline q3Float4 q3Max(q3Float4 a, q3Float4 b) { return {_mm_max_ps(a.v, b.v)}; }
+inline q3Float4 q3Abs(q3Float4 a) {
+  return {_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v)};
+}
+inline q3Float4 q3Sqrt(q3Float4 a) { return {_mm_sqrt_ps(a.v)}; }
+// mask ? a : b
+inline q3Float4 q3Select(q3Float4 mask, q3Float4 a, q3Float4 b) {
+  return {_mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v))};
+}
+// Bit i is set when lane i of the mask is true
+inline int q3MoveMask(q3Float4 mask) { return _mm_movemask_ps(mask.v); }
+#else
+namespace q3Detail {
+template <typename F> inline q3Float4 Lanes(q3Float4 a, q3Float4 b, F f) {
+  q3Float4 r;
+  for (int i = 0; i < 4; ++i)
+    r.v[i] = f(a.v[i], b.v[i]);
+  return r;
+}
+inline float Mask(bool b) { return std::bit_cast<float>(b ? ~0u : 0u); }
+inline uint32_t Bits(float f) { return std::bit_cast<uint32_t>(f); }
+} // namespace q3Detail
+
+inline q3Float4 operator+(q3Float4 a, q3Float4 b) {
+  return q3Detail::Lanes(a, b, [](float x, float y) { return x + y; });
+}
+inline q3Float4 operator-(q3Float4 a, q3Float4 b) {
+  return q3Detail::Lanes(a, b, [](float x, float y) { return x - y; });
+}
+inline q3Float4 operator*(q3Float4 a, q3Float4 b) {
+  return q3Detail::Lanes(a, b, [](float x, float y) { return x * y; });
+}
+inline q3Float4 operator/(q3Float4 a, q3Float4 b) {
+  return q3Detail::Lanes(a, b, [](float x, float y) { return x / y; });
+}
+inline q3Float4 operator<(q3Float4 a, q3Float4 b) {
+  return q3Detail::Lanes(
+      a, b, [](float x, float y) { return q3Detail::Mask(x < y); });
+}
+inline q3Float4 operator<=(q3Float4 a, q3Float4 b) {
+  return q3Detail::Lanes(
+      a, b, [](float x, float y) { return q3Detail::Mask(x <= y); });
+}
+inline q3Float4 operator>(q3Float4 a, q3Float4 b) {
+  return q3Detail::Lanes(
+      a, b, [](float x, float y) { return q3Detail::Mask(x > y); });
+}
+inline q3Float4 operator>=(q3Float4 a, q3Float4 b) {
+  return q3Detail::Lanes(
+      a, b, [](float x, float y) { return q3Detail::Mask(x >= y); });
+}
+inline q3Float4 operator&(q3Float4 a, q3Float4 b) {
+  return q3Detail::Lanes(a, b, [](float x, float y) {
+    return std::bit_cast<float>(q3Detail::Bits(x) & q3Detail::Bits(y));
+  });
+}
+inline q3Float4 operator|(q3Float4 a, q3Float4 b) {
+  return q3Detail::Lanes(a, b, [](float x, float y) {
+    return std::bit_cast<float>(q3Detail::Bits(x) | q3Detail::Bits(y));
+  });
+}
+// Same operand order as minps/maxps so NaN handling matches SSE
+inline q3Float4 q3Min(q3Float4 a, q3Float4 b) {
+  return q3Detail::Lanes(a, b, [](float x, float y) { return x < y ? x : y; });
+}
+inline q3Float4 q3Max(q3Float4 a, q3Float4 b) {
+  return q3Detail::Lanes(a, b, [](float x, float y) { return x > y ? x : y; });
+}
+inline q3Float4 q3Abs(q3Float4 a) {
+  return q3Detail::Lanes(a, a, [](float x, float) {
+    return std::bit_cast<float>(q3Detail::Bits(x) & 0x7fffffffu);
+  });
+}
+inline q3Float4 q3Sqrt(q3Float4 a) {
+  return q3Detail::Lanes(a, a, [](float x, float) { return std::sqrt(x); });
+}
+// mask ? a : b
+inline q3Float4 q3Select(q3Float4 mask, q3Float4 a, q3Float4 b) {
+  q3Float4 r;
+  for (int i = 0; i < 4; ++i)
+    r.v[i] = q3Detail::Bits(mask.v[i]) ? a.v[i] : b.v[i];
+  return r;
+}
+// Bit i is set when lane i of the mask is true
+inline int q3MoveMask(q3Float4 mask) {
+  int bits = 0;
+  for (int i = 0; i < 4; ++i)
+    bits |= (q3Detail::Bits(mask.v[i]) >> 31) << i;
+  return bits;
+}
+#endif
@@ -0,0 +1,119 @@
+#include "q3SweptSphere.h"
+#include "q3Segment.h"
+#include <limits>
+
+bool q3SweptSphere::TestPoint(const q3Vec3 &p) const {
+  return q3DistanceSq(p, q3ClosestPointOnSegment(a, b, p)) <= radius * radius;
+}
+
+float q3SweptSphere::Distance(const q3Vec3 &p) const {
+  float d = q3Distance(p, q3ClosestPointOnSegment(a, b, p));
+  return std::max(d - radius, float(0.0));
+}
+
+//--------------------------------------------------------------------------------------------------
+// The first hit of the cylinder around the segment and the spheres at its
+// ends. A ray starting inside hits at toi zero.
+bool q3SweptSphere::Raycast(q3RaycastData *raycast) const {
+  const q3Vec3 &start = raycast->start;
+  const q3Vec3 &dir = raycast->dir;
+  if (TestPoint(start)) {
+    raycast->toi = float(0.0);
+    raycast->normal = -dir;
+    return true;
+  }
+
+  float tmin = std::numeric_limits<float>::max();
+  q3Vec3 n0;
+
+  // Both quadratics are solved about the ray's closest approach, since
+  // b * b - c loses all precision when the ray starts far away
+  auto sphere = [&](const q3Vec3 &c) {
+    q3Vec3 m = start - c;
+    float b = q3Dot(m, dir);
+    q3Vec3 closest = m - dir * b;
+    float h = radius * radius - q3Dot(closest, closest);
+    if (h < float(0.0))
+      return;
+
+    float t = -b - std::sqrt(h);
+    if (t >= float(0.0) && t < tmin) {
+      tmin = t;
+      n0 = (start + dir * t - c) * (float(1.0) / radius);
+    }
+  };
+  sphere(a);
+  sphere(b);
+
+  q3Vec3 axis = b - a;
+  float length = axis.Length();
+  if (length > float(1.0e-6)) {
+    q3Vec3 u = axis * (float(1.0) / length);
+    q3Vec3 m = start - a;
+    q3Vec3 mPerp = m - u * q3Dot(m, u);
+    q3Vec3 dPerp = dir - u * q3Dot(dir, u);
+    float A = q3Dot(dPerp, dPerp);
+    float tc = A > float(1.0e-12) ? -q3Dot(mPerp, dPerp) / A : float(0.0);
+    q3Vec3 closest = mPerp + dPerp * tc;
+    float h = radius * radius - q3Dot(closest, closest);
+    if (A > float(1.0e-12) && h >= float(0.0)) {
+      float t = tc - std::sqrt(h / A);
+      float y = q3Dot(m, u) + q3Dot(dir, u) * t;
+      if (t >= float(0.0) && t < tmin && y >= float(0.0) && y <= length) {
+        tmin = t;
+        n0 = (mPerp + dPerp * t) * (float(1.0) / radius);
+      }
+    }
+  }
+
+  if (tmin > raycast->t)
+    return false;
+
+  raycast->toi = tmin;
+  raycast->normal = n0;
+  return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+bool q3SweptSphere::Sweep(q3SweepData *sweep) const {
+  // The box never closes in faster than it moves, so stepping by the
+  // distance never passes the first contact
+  const float tolerance = float(1.0e-4);
+  const int maxIterations = 64;
+  q3Mat3 inv = sweep->tx.rotation.Transposed();
+
+  float t = float(0.0);
+  for (int i = 0; i < maxIterations; ++i) {
+    q3Vec3 position = sweep->tx.position + sweep->dir * t;
+    q3Vec3 la = inv * (a - position);
+    q3Vec3 lb = inv * (b - position);
+    q3Vec3 onSegment;
+    q3Vec3 onBox;
+    float distance = q3SegmentBoxClosest(la, lb, sweep->e, &onSegment, &onBox);
+
+    if (distance - radius <= tolerance) {
+      // From the swept sphere toward the box, or back along the sweep when the
+      // segment already runs through the box
+      q3Vec3 n = onBox - onSegment;
+      float length = n.Length();
+      sweep->toi = t;
+      sweep->normal = length > float(1.0e-6)
+                          ? sweep->tx.rotation * (n * (float(1.0) / length))
+                          : -sweep->dir;
+      return true;
+    }
+
+    t += distance - radius;
+    if (t > sweep->t)
+      return false;
+  }
+
+  return false;
+}
+
+q3AABB q3SweptSphere::ComputeAABB() const {
+  q3Vec3 r{radius, radius, radius};
+  q3Vec3 min{std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z)};
+  q3Vec3 max{std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z)};
+  return {min - r, max + r};
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "q3AABB.h"
+#include "q3Raycast.h"
+#include "q3Vec3.h"
+
+//--------------------------------------------------------------------------------------------------
+// q3SweptSphere
+//--------------------------------------------------------------------------------------------------
+// The points within radius of the segment from a to b, the world space
+// geometry of q3Capsule and, with a point for a segment, of q3Sphere.
+struct q3SweptSphere {
+  q3Vec3 a;
+  q3Vec3 b;
+  float radius;
+
+  bool TestPoint(const q3Vec3 &p) const;
+  // Distance from p to the surface, zero inside it
+  float Distance(const q3Vec3 &p) const;
+  bool Raycast(q3RaycastData *raycast) const;
+  // Linear cast of the sweep's box, by conservative advancement: the box
+  // moves ahead by its distance until they touch. Fills in toi and normal
+  // like q3Box::Sweep.
+  bool Sweep(q3SweepData *sweep) const;
+  q3AABB ComputeAABB() const;
+};
@@ -41,8 +41,10 @@ distribution.
 #include "q3Render.h"
 #include "scene/q3Body.h"
 #include "scene/q3Box.h"
+#include "scene/q3Capsule.h"
 #include "scene/q3Env.h"
 #include "scene/q3Scene.h"
+#include "scene/q3Sphere.h"
 
 inline void q3RenderScene(q3Render *renderer, const class q3Scene *scene) {
   for (auto body : *scene) {
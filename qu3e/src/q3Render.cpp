@@ -1,4 +1,5 @@
 #include "q3Render.h"
+#include "math/q3Math.h"
 
 void q3Render::LineAABB(const q3AABB &b) {
   SetPenPosition(b.min.x, b.max.y, b.min.z);
@@ -53,3 +54,37 @@ void q3Render::Cube(const q3Transform &world, const q3Vec3 extent) {
     Triangle(a.x, a.y, a.z, b.x, b.y, b.z, c.x, c.y, c.z);
   }
 }
+
+void q3Render::Capsule(const q3Transform &world, float radius,
+                       float halfHeight) {
+  const int k_segments = 16;
+  auto draw = [&](const q3Vec3 &local, bool first) {
+    q3Vec3 p = world * local;
+    if (first)
+      SetPenPosition(p.x, p.y, p.z);
+    else
+      Line(p.x, p.y, p.z);
+  };
+
+  // Rings around the ends of the segment
+  for (float y : {-halfHeight, halfHeight}) {
+    for (int i = 0; i <= k_segments; ++i) {
+      float a = float(2.0) * q3PI * i / k_segments;
+      draw({std::cos(a) * radius, y, std::sin(a) * radius}, i == 0);
+    }
+  }
+
+  // Outlines in the xy and zy planes: the top half circle, then the bottom
+  for (int plane = 0; plane < 2; ++plane) {
+    auto point = [&](float a, float y) {
+      float c = std::cos(a) * radius;
+      float s = std::sin(a) * radius;
+      return plane == 0 ? q3Vec3{c, s + y, 0.0f} : q3Vec3{0.0f, s + y, c};
+    };
+    for (int i = 0; i <= k_segments; ++i)
+      draw(point(q3PI * i / k_segments, halfHeight), i == 0);
+    for (int i = 0; i <= k_segments; ++i)
+      draw(point(q3PI + q3PI * i / k_segments, -halfHeight), false);
+    draw(point(0.0f, halfHeight), false);
+  }
+}
@@ -51,6 +51,11 @@ public:
 
   virtual void Cube(const q3Transform &world, const q3Vec3 extent);
 
+  // Wireframe of a capsule around the segment from -halfHeight to
+  // halfHeight on the y axis of world. A zero halfHeight draws a sphere.
+  virtual void Capsule(const q3Transform &world, float radius,
+                       float halfHeight);
+
 protected:
   virtual void SetTriNormal(float x, float y, float z){}
 
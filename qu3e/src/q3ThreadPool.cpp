@@ -0,0 +1,80 @@
+#include "q3ThreadPool.h"
+
+q3ThreadPool::q3ThreadPool(int workerCount) {
+  for (int i = 0; i < workerCount; ++i) {
+    m_workers.emplace_back(&q3ThreadPool::WorkerMain, this, i + 1);
+  }
+}
+
+q3ThreadPool::~q3ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_exit = true;
+  }
+  m_wake.notify_all();
+  for (auto &worker : m_workers) {
+    worker.join();
+  }
+}
+
+void q3ThreadPool::ParallelFor(
+    int count, const std::function<void(int index, int threadIndex)> &task) {
+  if (count <= 0)
+    return;
+
+  if (m_workers.empty() || count == 1) {
+    for (int i = 0; i < count; ++i)
+      task(i, 0);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_task = &task;
+    m_count = count;
+    m_next = 0;
+    m_busy = int(m_workers.size());
+    ++m_generation;
+  }
+  m_wake.notify_all();
+
+  RunTasks(task, count, 0);
+
+  // Wait for the workers to leave this job before the task goes out of scope
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_done.wait(lock, [this] { return m_busy == 0; });
+  m_task = nullptr;
+}
+
+void q3ThreadPool::WorkerMain(int threadIndex) {
+  int generation = 0;
+  for (;;) {
+    const std::function<void(int, int)> *task;
+    int count;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wake.wait(lock,
+                  [&] { return m_exit || m_generation != generation; });
+      if (m_exit)
+        return;
+      generation = m_generation;
+      task = m_task;
+      count = m_count;
+    }
+
+    RunTasks(*task, count, threadIndex);
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      --m_busy;
+    }
+    m_done.notify_one();
+  }
+}
+
+void q3ThreadPool::RunTasks(const std::function<void(int, int)> &task,
+                            int count, int threadIndex) {
+  for (int i = m_next++; i < count; i = m_next++) {
+    task(i, threadIndex);
+  }
+}
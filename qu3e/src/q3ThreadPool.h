@@ -0,0 +1,51 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for the engine's parallel loops. The thread
+// that calls ParallelFor takes part in the work, so a pool created with zero
+// workers runs everything inline.
+class q3ThreadPool {
+  std::vector<std::thread> m_workers;
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::condition_variable m_done;
+
+  // Current job, published under m_mutex
+  const std::function<void(int, int)> *m_task = nullptr;
+  int m_count = 0;
+  int m_generation = 0;
+  int m_busy = 0;
+  bool m_exit = false;
+
+  std::atomic<int> m_next;
+
+public:
+  explicit q3ThreadPool(int workerCount = DefaultWorkerCount());
+  ~q3ThreadPool();
+  q3ThreadPool(const q3ThreadPool &) = delete;
+  q3ThreadPool &operator=(const q3ThreadPool &) = delete;
+
+  // Workers plus the calling thread
+  int ThreadCount() const { return int(m_workers.size()) + 1; }
+
+  // Calls task( index, threadIndex ) once for every index in [0, count) and
+  // returns when all of them finished. Indices are handed out in increasing
+  // order as threads become free. threadIndex is in [0, ThreadCount()) and
+  // can be used to address per-thread scratch buffers.
+  void ParallelFor(int count, const std::function<void(int index, int threadIndex)> &task);
+
+  static int DefaultWorkerCount() {
+    int hardware = int(std::thread::hardware_concurrency());
+    return hardware > 1 ? hardware - 1 : 0;
+  }
+
+private:
+  void WorkerMain(int threadIndex);
+  void RunTasks(const std::function<void(int, int)> &task, int count,
+                int threadIndex);
+};
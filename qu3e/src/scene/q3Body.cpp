@@ -26,7 +26,7 @@ distribution.
 
 #include "q3Body.h"
 #include "../math/q3Math.h"
-#include "q3Box.h"
+#include "q3Shape.h"
 #include "q3Env.h"
 #include "q3Scene.h"
 
@@ -73,9 +73,12 @@ q3Body::q3Body(const q3BodyDef &def) {
 
   if (def.lockAxisZ)
     AddFlag(q3BodyFlags::eLockAxisZ);
+
+  if (def.compound)
+    AddFlag(q3BodyFlags::eCompound);
 }
 
-void q3Body::RemoveBox(const q3Box *box) {
+void q3Body::RemoveBox(const q3Shape *box) {
   assert(box);
 
   auto node = std::find(m_boxes.begin(), m_boxes.end(), box);
@@ -89,15 +92,22 @@ void q3Body::RemoveBox(const q3Box *box) {
 }
 
 void q3Body::RemoveAllBoxes() {
-  for (auto box : m_boxes) {
+  // Each box leaves the list before the mass is computed again, as in
+  // RemoveBox
+  while (!m_boxes.empty()) {
+    q3Shape *box = m_boxes.front();
+    m_boxes.pop_front();
     OnBoxRemove(box);
     CalculateMassData();
     delete box;
   }
-  m_boxes.clear();
 }
 
 void q3Body::ApplyForce(const q3Env &env) {
+  // Static bodies keep their zero velocity state, and are shared by islands
+  if (HasFlag(q3BodyFlags::eStatic))
+    return;
+
   if (HasFlag(q3BodyFlags::eDynamic)) {
     ApplyLinearForce(env.m_gravity * m_gravityScale);
 
@@ -273,6 +283,8 @@ void q3Body::Dump(FILE *file, int index) const {
           HasFlag(q3BodyFlags::eLockAxisY));
   fprintf(file, "\tbd.lockAxisZ = bool( %d );\n",
           HasFlag(q3BodyFlags::eLockAxisZ));
+  fprintf(file, "\tbd.compound = bool( %d );\n",
+          HasFlag(q3BodyFlags::eCompound));
   fprintf(file, "\tbodies[ %d ] = scene.CreateBody( bd );\n\n", index);
 
   for (auto box : m_boxes) {
@@ -26,6 +26,7 @@ distribution.
 //--------------------------------------------------------------------------------------------------
 
 #pragma once
+#include "../dynamics/q3ContactEdge.h"
 #include "../math/q3Transform.h"
 #include <assert.h>
 #include <functional>
@@ -34,8 +35,7 @@ distribution.
 
 class q3Scene;
 struct q3BoxDef;
-struct q3ContactEdge;
-class q3Box;
+class q3Shape;
 
 enum q3BodyType {
   eStaticBody,
@@ -55,6 +55,7 @@ enum class q3BodyFlags {
   eLockAxisX = 0x100,
   eLockAxisY = 0x200,
   eLockAxisZ = 0x400,
+  eCompound = 0x800,
 };
 
 //--------------------------------------------------------------------------------------------------
@@ -90,6 +91,9 @@ struct q3BodyDef {
   bool lockAxisX = false; // Locked rotation on the x axis.
   bool lockAxisY = false; // Locked rotation on the y axis.
   bool lockAxisZ = false; // Locked rotation on the z axis.
+  // The boxes share one broadphase proxy and pair up through a tree of their
+  // own, see q3CompoundTree. Meant for bodies of many boxes, e.g. vehicles.
+  bool compound = false;
 };
 
 struct q3VelocityState {
@@ -122,7 +126,9 @@ class q3Body {
   float m_gravityScale;
   int m_layers;
   q3BodyFlags m_flags = {};
-  std::list<q3Box *> m_boxes;
+  // First edge of the contact list, kept by q3ContactManager
+  int m_contactEdge = q3ContactEdge::Null;
+  std::list<q3Shape *> m_boxes;
   float m_linearDamping;
   float m_angularDamping;
 
@@ -130,8 +136,8 @@ public:
   // not applied. working
   q3VelocityState m_velocityState;
 
-  std::function<void(q3Box *)> OnBoxAdd;
-  std::function<void(const q3Box *)> OnBoxRemove;
+  std::function<void(q3Shape *)> OnBoxAdd;
+  std::function<void(const q3Shape *)> OnBoxRemove;
   std::function<void()> OnTransformUpdated;
   q3Body(const q3BodyDef &def);
   q3BodyState State() const { return m_state; }
@@ -139,8 +145,8 @@ public:
     m_tx.position = m_state.m_worldCenter - m_tx.rotation * m_localCenter;
     return m_tx;
   }
-  std::list<q3Box *>::const_iterator begin() const { return m_boxes.begin(); }
-  std::list<q3Box *>::const_iterator end() const { return m_boxes.end(); }
+  std::list<q3Shape *>::const_iterator begin() const { return m_boxes.begin(); }
+  std::list<q3Shape *>::const_iterator end() const { return m_boxes.end(); }
   q3Transform Transform() const { return m_tx; }
 
   void Sleep(const struct q3Env &env, float *minSleepTime);
@@ -155,14 +161,14 @@ public:
     m_force = {};
     m_torque = {};
   }
-  void AddBox(q3Box *box) {
+  void AddBox(q3Shape *box) {
     m_boxes.push_back(box);
     OnBoxAdd(box);
   }
   // Removes this box from the body and broadphase. Forces the body
   // to recompute its mass if the body is dynamic. Frees the memory
   // pointed to by the box pointer.
-  void RemoveBox(const q3Box *box);
+  void RemoveBox(const q3Shape *box);
 
   // Removes all boxes from this body and the broadphase.
   void RemoveAllBoxes();
@@ -206,6 +212,8 @@ public:
     }
   }
   bool IsAwake() const { return HasFlag(q3BodyFlags::eAwake) ? true : false; }
+  void SetContactEdge(int edge) { m_contactEdge = edge; }
+  int ContactEdge() const { return m_contactEdge; }
   bool CanCollide(const q3Body *other) const {
     if (this == other) {
       return false;
@@ -223,6 +231,14 @@ public:
 
   void ApplyForce(const struct q3Env &env);
   q3VelocityState &VelocityState() { return m_velocityState; }
+  // Velocity as of the end of the last step
+  q3Vec3 VelocityAtWorldPoint(const q3Vec3 &p) const {
+    q3Vec3 directionToPoint = p - m_state.m_worldCenter;
+    q3Vec3 relativeAngularVel =
+        q3Cross(m_velocity.angularVelocity, directionToPoint);
+
+    return m_velocity.linearVelocity + relativeAngularVel;
+  }
   void ApplyVelocityState(const struct q3Env &env);
 
   // Used for debug rendering lines, triangles and basic lighting
@@ -245,13 +261,6 @@ private:
   // float GetInvMass() const { return m_state.m_invMass; }
   // q3Vec3 GetWorldVector(const q3Vec3 &v) const { return m_tx.rotation * v; }
   // // q3Vec3 GetLinearVelocity() const { return m_linearVelocity; }
-  // q3Vec3 GetVelocityAtWorldPoint(const q3Vec3 &p) const {
-  //   q3Vec3 directionToPoint = p - m_state.m_worldCenter;
-  //   q3Vec3 relativeAngularVel =
-  //       q3Cross(m_velocity.angularVelocity, directionToPoint);
-
-  //   return m_velocity.linearVelocity + relativeAngularVel;
-  // }
   // void SetLinearVelocity(const q3Vec3 &v) {
   //   // Velocity of static bodies cannot be adjusted
   //   if (HasFlag(q3BodyFlags::eStatic)) {
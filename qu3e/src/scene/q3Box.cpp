@@ -29,7 +29,8 @@ distribution.
 #include "../math/q3Math.h"
 #include <q3Render.h>
 
-q3Box::q3Box(const q3BoxDef &def) : def_(def) {}
+q3Box::q3Box(const q3BoxDef &def)
+    : q3Shape(q3ShapeType::eBox, def), def_(def) {}
 
 bool q3Box::TestPoint(const q3Transform &tx, const q3Vec3 &p) const {
   q3Transform world = tx * def_.m_tx;
@@ -47,6 +48,20 @@ bool q3Box::TestPoint(const q3Transform &tx, const q3Vec3 &p) const {
   return true;
 }
 
+float q3Box::Distance(const q3Transform &tx, const q3Vec3 &p) const {
+  q3Transform world = tx * def_.m_tx;
+  q3Vec3 p0 = world.Inversed() * p;
+
+  // Offset of p from the closest point of the box, in box space
+  q3Vec3 d;
+  for (int i = 0; i < 3; ++i) {
+    float ei = def_.m_e[i];
+    d[i] = p0[i] - std::min(std::max(p0[i], -ei), ei);
+  }
+
+  return d.Length();
+}
+
 //--------------------------------------------------------------------------------------------------
 bool q3Box::Raycast(const q3Transform &tx, q3RaycastData *raycast) const {
   q3Transform world = tx * def_.m_tx;
@@ -99,6 +114,95 @@ bool q3Box::Raycast(const q3Transform &tx, q3RaycastData *raycast) const {
   return true;
 }
 
+//--------------------------------------------------------------------------------------------------
+// The boxes overlap exactly when they overlap along every one of their 15
+// separating axes: 3 face normals each and 9 edge cross products. Along one
+// axis the distance of the centers changes linearly with time, so each axis
+// gives an interval of overlap. The sweep hits when the intervals share a
+// time; the first such time is the latest entry over all axes.
+bool q3Box::Sweep(const q3Transform &tx, q3SweepData *sweep) const {
+  q3Transform world = tx * def_.m_tx;
+  const q3Mat3 &rA = sweep->tx.rotation;
+  const q3Mat3 &rB = world.rotation;
+  q3Vec3 d = world.position - sweep->tx.position;
+  const float epsilon = float(1.0e-6);
+
+  q3Vec3 axes[15];
+  int count = 0;
+  for (int i = 0; i < 3; ++i) {
+    axes[count++] = rA[i];
+    axes[count++] = rB[i];
+  }
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      // Parallel edges add nothing over the face normals
+      q3Vec3 axis = q3Cross(rA[i], rB[j]);
+      float length = axis.Length();
+      if (length > epsilon)
+        axes[count++] = axis * (float(1.0) / length);
+    }
+  }
+
+  float tmin = -std::numeric_limits<float>::max();
+  float tmax = sweep->t;
+  q3Vec3 n0;
+  // Least penetrated axis, for sweeps starting in overlap
+  float minDepth = std::numeric_limits<float>::max();
+  q3Vec3 n1;
+
+  for (int i = 0; i < count; ++i) {
+    const q3Vec3 &axis = axes[i];
+    float r = float(0.0);
+    for (int j = 0; j < 3; ++j) {
+      r += sweep->e[j] * std::abs(q3Dot(rA[j], axis));
+      r += def_.m_e[j] * std::abs(q3Dot(rB[j], axis));
+    }
+
+    // Distance of the centers along the axis is c - v * time
+    float c = q3Dot(d, axis);
+    float v = q3Dot(sweep->dir, axis);
+
+    float depth = r - std::abs(c);
+    if (depth < minDepth) {
+      minDepth = depth;
+      n1 = c > float(0.0) ? -axis : axis;
+    }
+
+    if (std::abs(v) < epsilon) {
+      // Moving parallel to a separating plane
+      if (depth < float(0.0))
+        return false;
+      continue;
+    }
+
+    float t0 = (c - r) / v;
+    float t1 = (c + r) / v;
+    if (v < float(0.0))
+      std::swap(t0, t1);
+
+    if (t0 > tmin) {
+      tmin = t0;
+      n0 = v > float(0.0) ? -axis : axis;
+    }
+
+    tmax = std::min(tmax, t1);
+
+    if (tmin > tmax || tmax < float(0.0)) {
+      return false;
+    }
+  }
+
+  if (tmin > float(0.0)) {
+    sweep->toi = tmin;
+    sweep->normal = n0;
+  } else {
+    sweep->toi = float(0.0);
+    sweep->normal = n1;
+  }
+
+  return true;
+}
+
 //--------------------------------------------------------------------------------------------------
 q3AABB q3Box::ComputeAABB(const q3Transform &tx) const {
   q3Transform world = tx * def_.m_tx;
@@ -190,6 +294,7 @@ void q3BoxDef::Dump(FILE *file) const {
   fprintf(file, "\t\tsd.SetRestitution( float( %.15lf ) );\n", m_restitution);
   fprintf(file, "\t\tsd.SetDensity( float( %.15lf ) );\n", m_density);
   fprintf(file, "\t\tsd.SetSensor( bool( %d ) );\n", m_sensor);
+  fprintf(file, "\t\tsd.SetAABBMargin( float( %.15lf ) );\n", m_aabbMargin);
   fprintf(file, "\t\tq3Transform boxTx;\n");
   q3Transform boxTx = m_tx;
   q3Vec3 xAxis = boxTx.rotation.ex;
@@ -26,17 +26,7 @@ distribution.
 //--------------------------------------------------------------------------------------------------
 
 #pragma once
-#include "../math/q3Mat3.h"
-#include "../math/q3Raycast.h"
-#include "../math/q3Transform.h"
-#include "../math/q3AABB.h"
-#include <optional>
-
-struct q3MassData {
-  q3Mat3 inertia;
-  q3Vec3 center;
-  float mass;
-};
+#include "q3Shape.h"
 
 struct q3BoxDef {
   q3Transform m_tx = {};
@@ -45,28 +35,30 @@ struct q3BoxDef {
   float m_restitution = 0.2f;
   float m_density = 1.0f;
   bool m_sensor = false;
+  // Padding of the box's fat AABB in the broadphase. Smaller margins mean
+  // fewer false pairs but more reinsertions while the box moves.
+  float m_aabbMargin = 0.5f;
   void Dump(FILE *file) const;
 };
 
-class q3Box {
+class q3Box : public q3Shape {
   q3BoxDef def_;
-  int broadPhaseIndex_ = -1;
 
 public:
   q3Box(const q3BoxDef &def);
   // def
-  const q3Transform &Local() const { return def_.m_tx; }
   const q3Vec3 &Extent() const { return def_.m_e; }
-  float Friction() const { return def_.m_friction; }
-  float Restitution() const { return def_.m_restitution; }
-  bool Sensor() const { return def_.m_sensor; }
 
-  void SetBroadPhaseIndex(int index) { broadPhaseIndex_ = index; }
-  int BroadPhaseIndex() const { return broadPhaseIndex_; }
-  bool TestPoint(const q3Transform &tx, const q3Vec3 &p) const;
-  bool Raycast(const q3Transform &tx, q3RaycastData *raycast) const;
-  q3AABB ComputeAABB(const q3Transform &tx) const;
-  std::optional<q3MassData> ComputeMass() const;
-  void Render(const q3Transform &tx, bool awake, class q3Render *render) const;
-  void Dump(FILE *file, int index) const;
+  bool TestPoint(const q3Transform &tx, const q3Vec3 &p) const override;
+  // Distance from p to the box, zero inside it
+  float Distance(const q3Transform &tx, const q3Vec3 &p) const override;
+  bool Raycast(const q3Transform &tx, q3RaycastData *raycast) const override;
+  // Exact linear cast of the sweep's box against this one. Fills in toi and
+  // normal; a sweep that starts overlapping hits at toi zero.
+  bool Sweep(const q3Transform &tx, q3SweepData *sweep) const override;
+  q3AABB ComputeAABB(const q3Transform &tx) const override;
+  std::optional<q3MassData> ComputeMass() const override;
+  void Render(const q3Transform &tx, bool awake,
+              class q3Render *render) const override;
+  void Dump(FILE *file, int index) const override;
 };
@@ -0,0 +1,107 @@
+#include "q3Capsule.h"
+#include "../math/q3Math.h"
+#include <q3Render.h>
+
+q3Capsule::q3Capsule(const q3CapsuleDef &def)
+    : q3Shape(q3ShapeType::eCapsule, def), def_(def) {}
+
+q3SweptSphere q3Capsule::World(const q3Transform &tx) const {
+  q3Transform world = tx * def_.m_tx;
+  q3Vec3 h = world.rotation.ey * def_.m_halfHeight;
+  return {world.position - h, world.position + h, def_.m_radius};
+}
+
+bool q3Capsule::TestPoint(const q3Transform &tx, const q3Vec3 &p) const {
+  return World(tx).TestPoint(p);
+}
+
+float q3Capsule::Distance(const q3Transform &tx, const q3Vec3 &p) const {
+  return World(tx).Distance(p);
+}
+
+bool q3Capsule::Raycast(const q3Transform &tx, q3RaycastData *raycast) const {
+  return World(tx).Raycast(raycast);
+}
+
+bool q3Capsule::Sweep(const q3Transform &tx, q3SweepData *sweep) const {
+  return World(tx).Sweep(sweep);
+}
+
+q3AABB q3Capsule::ComputeAABB(const q3Transform &tx) const {
+  return World(tx).ComputeAABB();
+}
+
+std::optional<q3MassData> q3Capsule::ComputeMass() const {
+  if (def_.m_density == float(0.0)) {
+    return {};
+  }
+
+  // A cylinder of height H and the two halves of a sphere at its ends
+  float r = def_.m_radius;
+  float r2 = r * r;
+  float H = float(2.0) * def_.m_halfHeight;
+  float cylinder = q3PI * r2 * H * def_.m_density;
+  float sphere = float(4.0 / 3.0) * q3PI * r2 * r * def_.m_density;
+  float mass = cylinder + sphere;
+  float y = cylinder * r2 * float(0.5) + sphere * r2 * float(0.4);
+  float xz = cylinder * (H * H / float(12.0) + r2 * float(0.25)) +
+             sphere * (r2 * float(0.4) + H * H * float(0.25) +
+                       H * r * float(3.0 / 8.0));
+  q3Mat3 I = q3Mat3::Diagonal(xz, y, xz);
+
+  // Transform tensor to local space
+  I = def_.m_tx.rotation * I * def_.m_tx.rotation.Transposed();
+  q3Mat3 identity = {};
+  I += (identity * q3Dot(def_.m_tx.position, def_.m_tx.position) -
+        q3OuterProduct(def_.m_tx.position, def_.m_tx.position)) *
+       mass;
+
+  return q3MassData{
+      .inertia = I,
+      .center = def_.m_tx.position,
+      .mass = mass,
+  };
+}
+
+void q3Capsule::Render(const q3Transform &tx, bool awake,
+                       q3Render *render) const {
+  render->Capsule(tx * def_.m_tx, def_.m_radius, def_.m_halfHeight);
+}
+
+void q3Capsule::Dump(FILE *file, int index) const {
+  fprintf(file, "\t{\n");
+  fprintf(file, "\t\tq3CapsuleDef sd;\n");
+  def_.Dump(file);
+  fprintf(file, "\t\tbodies[ %d ]->AddCapsule( sd );\n", index);
+  fprintf(file, "\t}\n");
+}
+
+void q3CapsuleDef::Dump(FILE *file) const {
+  fprintf(file, "\t\tsd.SetFriction( float( %.15lf ) );\n", m_friction);
+  fprintf(file, "\t\tsd.SetRestitution( float( %.15lf ) );\n", m_restitution);
+  fprintf(file, "\t\tsd.SetDensity( float( %.15lf ) );\n", m_density);
+  fprintf(file, "\t\tsd.SetSensor( bool( %d ) );\n", m_sensor);
+  fprintf(file, "\t\tsd.SetAABBMargin( float( %.15lf ) );\n", m_aabbMargin);
+  fprintf(file, "\t\tq3Transform capsuleTx;\n");
+  const q3Mat3 &r = m_tx.rotation;
+  fprintf(file,
+          "\t\tq3Vec3 xAxis( float( %.15lf ), float( %.15lf ), float( %.15lf "
+          ") );\n",
+          r.ex.x, r.ex.y, r.ex.z);
+  fprintf(file,
+          "\t\tq3Vec3 yAxis( float( %.15lf ), float( %.15lf ), float( %.15lf "
+          ") );\n",
+          r.ey.x, r.ey.y, r.ey.z);
+  fprintf(file,
+          "\t\tq3Vec3 zAxis( float( %.15lf ), float( %.15lf ), float( %.15lf "
+          ") );\n",
+          r.ez.x, r.ez.y, r.ez.z);
+  fprintf(file, "\t\tcapsuleTx.rotation.SetRows( xAxis, yAxis, zAxis );\n");
+  fprintf(file,
+          "\t\tcapsuleTx.position.Set( float( %.15lf ), float( %.15lf ), "
+          "float( %.15lf ) );\n",
+          m_tx.position.x, m_tx.position.y, m_tx.position.z);
+  fprintf(file,
+          "\t\tsd.Set( capsuleTx, float( %.15lf ), float( %.15lf ) );\n",
+          m_radius, m_halfHeight);
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "../math/q3SweptSphere.h"
+#include "q3Shape.h"
+
+struct q3CapsuleDef {
+  // The capsule's segment runs along the y axis, centered on the position
+  q3Transform m_tx = {};
+  float m_radius = 0.0f;
+  float m_halfHeight = 0.0f; // Half the segment length
+  float m_friction = 0.4f;
+  float m_restitution = 0.2f;
+  float m_density = 1.0f;
+  bool m_sensor = false;
+  // Padding of the capsule's fat AABB in the broadphase, as for q3BoxDef
+  float m_aabbMargin = 0.5f;
+  void Dump(FILE *file) const;
+};
+
+class q3Capsule : public q3Shape {
+  q3CapsuleDef def_;
+
+public:
+  q3Capsule(const q3CapsuleDef &def);
+  // def
+  float Radius() const { return def_.m_radius; }
+  float HalfHeight() const { return def_.m_halfHeight; }
+
+  // World segment and radius of the capsule on a body at tx
+  q3SweptSphere World(const q3Transform &tx) const;
+
+  bool TestPoint(const q3Transform &tx, const q3Vec3 &p) const override;
+  // Distance from p to the capsule, zero inside it
+  float Distance(const q3Transform &tx, const q3Vec3 &p) const override;
+  bool Raycast(const q3Transform &tx, q3RaycastData *raycast) const override;
+  // Linear cast of the sweep's box by conservative advancement, see
+  // q3SweptSphere::Sweep
+  bool Sweep(const q3Transform &tx, q3SweepData *sweep) const override;
+  q3AABB ComputeAABB(const q3Transform &tx) const override;
+  std::optional<q3MassData> ComputeMass() const override;
+  void Render(const q3Transform &tx, bool awake,
+              class q3Render *render) const override;
+  void Dump(FILE *file, int index) const override;
+};
@@ -7,6 +7,7 @@ struct q3Env {
   int m_iterations = 20;
   bool m_allowSleep = true;
   bool m_enableFriction = true;
+  bool m_wideSolver = false;
 
   // Increasing the iteration count increases the CPU cost of simulating
   // Scene.Step(). Decreasing the iterations makes the simulation less
@@ -31,6 +32,11 @@ struct q3Env {
   // another. The friction force resists this sliding motion.
   void SetEnableFriction(bool enabled) { m_enableFriction = enabled; }
 
+  // Solves four contact constraints at a time, on bodies they do not share,
+  // in SIMD lanes. The order constraints are solved in changes, so results
+  // differ slightly from the default one-at-a-time solver.
+  void SetWideSolver(bool enabled) { m_wideSolver = enabled; }
+
   // Gets and sets the global gravity vector used during integration
   const q3Vec3 GetGravity() const { return m_gravity; }
   void SetGravity(const q3Vec3 &gravity) { m_gravity = gravity; }
@@ -27,6 +27,8 @@ distribution.
 #include "q3Scene.h"
 #include "q3Body.h"
 #include "q3Box.h"
+#include "q3Capsule.h"
+#include "q3Sphere.h"
 #include "q3Env.h"
 #include <Remotery.h>
 #include <stdlib.h>
@@ -36,12 +38,23 @@ q3Scene::~q3Scene() {
   OnBodyAdd = {};
   OnBodyRemove = {};
   OnBodyTransformUpdated = {};
+  OnTransformsUpdated = {};
   OnBoxRemove = {};
   OnBoxAdd = {};
   RemoveAllBodies();
 }
 
 void q3Scene::UpdateTransforms() {
+  if (OnTransformsUpdated) {
+    m_movedBodies.clear();
+    for (auto body : m_bodyList) {
+      if (!body->HasFlag(q3BodyFlags::eStatic))
+        m_movedBodies.push_back(body);
+    }
+    OnTransformsUpdated(m_movedBodies);
+    return;
+  }
+
   for (auto body : m_bodyList) {
     if (body->HasFlag(q3BodyFlags::eStatic))
       continue;
@@ -52,12 +65,12 @@ void q3Scene::UpdateTransforms() {
 q3Body *q3Scene::CreateBody(const q3BodyDef &def) {
   auto body = new q3Body(def);
 
-  body->OnBoxAdd = [self = this, body](q3Box *box) {
+  body->OnBoxAdd = [self = this, body](q3Shape *box) {
     if (self->OnBodyAdd) {
       self->OnBoxAdd(body, box);
     }
   };
-  body->OnBoxRemove = [self = this, body](const q3Box *box) {
+  body->OnBoxRemove = [self = this, body](const q3Shape *box) {
     if (self->OnBoxRemove) {
       self->OnBoxRemove(body, box);
     }
@@ -75,10 +88,26 @@ q3Body *q3Scene::CreateBody(const q3BodyDef &def) {
 
 const q3Box *q3Scene::AddBox(q3Body *body, const q3BoxDef &def) {
   auto box = new q3Box(def);
-  body->AddBox(box);
+  AddShape(body, box);
+  return box;
+}
+
+const q3Sphere *q3Scene::AddSphere(q3Body *body, const q3SphereDef &def) {
+  auto sphere = new q3Sphere(def);
+  AddShape(body, sphere);
+  return sphere;
+}
+
+const q3Capsule *q3Scene::AddCapsule(q3Body *body, const q3CapsuleDef &def) {
+  auto capsule = new q3Capsule(def);
+  AddShape(body, capsule);
+  return capsule;
+}
+
+void q3Scene::AddShape(q3Body *body, q3Shape *shape) {
+  body->AddBox(shape);
   body->CalculateMassData();
   m_newBox = true;
-  return box;
 }
 
 void q3Scene::RemoveBody(q3Body *body) {
@@ -111,6 +140,8 @@ void q3Scene::Dump(FILE *file, const q3Env &m_env) const {
           m_env.m_allowSleep ? "true" : "false");
   fprintf(file, "scene.SetEnableFriction( %s );\n",
           m_env.m_enableFriction ? "true" : "false");
+  fprintf(file, "scene.SetWideSolver( %s );\n",
+          m_env.m_wideSolver ? "true" : "false");
 
   fprintf(file,
           "q3Body** bodies = (q3Body**)q3Alloc( sizeof( q3Body* ) * %zu );\n",
@@ -28,21 +28,32 @@ distribution.
 #pragma once
 #include <functional>
 #include <list>
+#include <span>
 #include <stdio.h>
+#include <vector>
 
 class q3Body;
+class q3Shape;
 class q3Box;
+class q3Sphere;
+class q3Capsule;
 struct q3BodyDef;
 class q3Scene {
   bool m_newBox = false;
   std::list<q3Body *> m_bodyList;
+  std::vector<q3Body *> m_movedBodies; // Scratch of UpdateTransforms
+
+  void AddShape(q3Body *body, q3Shape *shape);
 
 public:
   std::function<void(q3Body *)> OnBodyAdd;
   std::function<void(q3Body *)> OnBodyRemove;
   std::function<void(q3Body *)> OnBodyTransformUpdated;
-  std::function<void(q3Body *, q3Box *)> OnBoxAdd;
-  std::function<void(q3Body *, const q3Box *)> OnBoxRemove;
+  // When set, UpdateTransforms reports all bodies at once through this
+  // instead of OnBodyTransformUpdated
+  std::function<void(std::span<q3Body *const>)> OnTransformsUpdated;
+  std::function<void(q3Body *, q3Shape *)> OnBoxAdd;
+  std::function<void(q3Body *, const q3Shape *)> OnBoxRemove;
 
   ~q3Scene();
   std::list<q3Body *>::const_iterator begin() const {
@@ -70,6 +81,9 @@ public:
   // another. The body will recalculate its mass values. No contacts
   // will be created until the next q3Scene::Step( ) call.
   const q3Box *AddBox(q3Body *body, const struct q3BoxDef &def);
+  // Same as AddBox, for the round shapes
+  const q3Sphere *AddSphere(q3Body *body, const struct q3SphereDef &def);
+  const q3Capsule *AddCapsule(q3Body *body, const struct q3CapsuleDef &def);
 
   // Frees a body, removes all shapes associated with the body and frees
   // all shapes and contacts associated and attached to this body.
@@ -0,0 +1,72 @@
+#pragma once
+#include "../math/q3AABB.h"
+#include "../math/q3Mat3.h"
+#include "../math/q3Raycast.h"
+#include "../math/q3Transform.h"
+#include <optional>
+#include <stdint.h>
+#include <stdio.h>
+
+struct q3MassData {
+  q3Mat3 inertia;
+  q3Vec3 center;
+  float mass;
+};
+
+enum class q3ShapeType : uint8_t {
+  eBox,
+  eSphere,
+  eCapsule,
+  eCount,
+};
+
+//--------------------------------------------------------------------------------------------------
+// q3Shape
+//--------------------------------------------------------------------------------------------------
+// Collision shape of a body: q3Box, q3Sphere or q3Capsule. Bodies, the
+// broadphase and contacts hold shapes through this base; the narrowphase
+// picks its routine by the types of the two shapes.
+class q3Shape {
+  q3ShapeType type_;
+  q3Transform local_;
+  float friction_;
+  float restitution_;
+  bool sensor_;
+  float aabbMargin_;
+  int broadPhaseIndex_ = -1;
+
+protected:
+  // The members every shape def has
+  template <typename Def>
+  q3Shape(q3ShapeType type, const Def &def)
+      : type_(type), local_(def.m_tx), friction_(def.m_friction),
+        restitution_(def.m_restitution), sensor_(def.m_sensor),
+        aabbMargin_(def.m_aabbMargin) {}
+
+public:
+  virtual ~q3Shape() {}
+
+  q3ShapeType Type() const { return type_; }
+  const q3Transform &Local() const { return local_; }
+  float Friction() const { return friction_; }
+  float Restitution() const { return restitution_; }
+  bool Sensor() const { return sensor_; }
+  float AABBMargin() const { return aabbMargin_; }
+
+  void SetBroadPhaseIndex(int index) { broadPhaseIndex_ = index; }
+  int BroadPhaseIndex() const { return broadPhaseIndex_; }
+
+  virtual bool TestPoint(const q3Transform &tx, const q3Vec3 &p) const = 0;
+  // Distance from p to the shape, zero inside it
+  virtual float Distance(const q3Transform &tx, const q3Vec3 &p) const = 0;
+  virtual bool Raycast(const q3Transform &tx,
+                       q3RaycastData *raycast) const = 0;
+  // Linear cast of the sweep's box against this shape. Fills in toi and
+  // normal; a sweep that starts overlapping hits at toi zero.
+  virtual bool Sweep(const q3Transform &tx, q3SweepData *sweep) const = 0;
+  virtual q3AABB ComputeAABB(const q3Transform &tx) const = 0;
+  virtual std::optional<q3MassData> ComputeMass() const = 0;
+  virtual void Render(const q3Transform &tx, bool awake,
+                      class q3Render *render) const = 0;
+  virtual void Dump(FILE *file, int index) const = 0;
+};
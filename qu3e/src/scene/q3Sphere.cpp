@@ -0,0 +1,105 @@
+#include "q3Sphere.h"
+#include "../math/q3Math.h"
+#include <limits>
+#include <q3Render.h>
+
+q3Sphere::q3Sphere(const q3SphereDef &def)
+    : q3Shape(q3ShapeType::eSphere, def), def_(def) {}
+
+q3SweptSphere q3Sphere::World(const q3Transform &tx) const {
+  q3Vec3 c = Center(tx);
+  return {c, c, def_.m_radius};
+}
+
+bool q3Sphere::TestPoint(const q3Transform &tx, const q3Vec3 &p) const {
+  return q3DistanceSq(p, Center(tx)) <= def_.m_radius * def_.m_radius;
+}
+
+float q3Sphere::Distance(const q3Transform &tx, const q3Vec3 &p) const {
+  return std::max(q3Distance(p, Center(tx)) - def_.m_radius, float(0.0));
+}
+
+//--------------------------------------------------------------------------------------------------
+// Solved about the ray's closest approach to the center, since b * b - c
+// loses all precision when the ray starts far away. A ray starting inside
+// hits at toi zero.
+bool q3Sphere::Raycast(const q3Transform &tx, q3RaycastData *raycast) const {
+  q3Vec3 m = raycast->start - Center(tx);
+  float r2 = def_.m_radius * def_.m_radius;
+  if (q3Dot(m, m) <= r2) {
+    raycast->toi = float(0.0);
+    raycast->normal = -raycast->dir;
+    return true;
+  }
+
+  float b = q3Dot(m, raycast->dir);
+  q3Vec3 closest = m - raycast->dir * b;
+  float h = r2 - q3Dot(closest, closest);
+  if (h < float(0.0))
+    return false;
+
+  float t = -b - std::sqrt(h);
+  if (t < float(0.0) || t > raycast->t)
+    return false;
+
+  raycast->toi = t;
+  raycast->normal = (m + raycast->dir * t) * (float(1.0) / def_.m_radius);
+  return true;
+}
+
+bool q3Sphere::Sweep(const q3Transform &tx, q3SweepData *sweep) const {
+  return World(tx).Sweep(sweep);
+}
+
+q3AABB q3Sphere::ComputeAABB(const q3Transform &tx) const {
+  q3Vec3 c = Center(tx);
+  q3Vec3 r{def_.m_radius, def_.m_radius, def_.m_radius};
+  return {c - r, c + r};
+}
+
+std::optional<q3MassData> q3Sphere::ComputeMass() const {
+  if (def_.m_density == float(0.0)) {
+    return {};
+  }
+
+  float r2 = def_.m_radius * def_.m_radius;
+  float mass = float(4.0 / 3.0) * q3PI * r2 * def_.m_radius * def_.m_density;
+  q3Mat3 I = q3Mat3::Diagonal(float(0.4) * mass * r2);
+
+  // A sphere's tensor does not turn, it only moves to the body's origin
+  const q3Vec3 &c = def_.m_tx.position;
+  q3Mat3 identity = {};
+  I += (identity * q3Dot(c, c) - q3OuterProduct(c, c)) * mass;
+
+  return q3MassData{
+      .inertia = I,
+      .center = c,
+      .mass = mass,
+  };
+}
+
+void q3Sphere::Render(const q3Transform &tx, bool awake,
+                      q3Render *render) const {
+  render->Capsule(tx * def_.m_tx, def_.m_radius, float(0.0));
+}
+
+void q3Sphere::Dump(FILE *file, int index) const {
+  fprintf(file, "\t{\n");
+  fprintf(file, "\t\tq3SphereDef sd;\n");
+  def_.Dump(file);
+  fprintf(file, "\t\tbodies[ %d ]->AddSphere( sd );\n", index);
+  fprintf(file, "\t}\n");
+}
+
+void q3SphereDef::Dump(FILE *file) const {
+  fprintf(file, "\t\tsd.SetFriction( float( %.15lf ) );\n", m_friction);
+  fprintf(file, "\t\tsd.SetRestitution( float( %.15lf ) );\n", m_restitution);
+  fprintf(file, "\t\tsd.SetDensity( float( %.15lf ) );\n", m_density);
+  fprintf(file, "\t\tsd.SetSensor( bool( %d ) );\n", m_sensor);
+  fprintf(file, "\t\tsd.SetAABBMargin( float( %.15lf ) );\n", m_aabbMargin);
+  fprintf(file,
+          "\t\tsd.SetCenter( q3Vec3( float( %.15lf ), float( %.15lf ), "
+          "float( %.15lf ) ) );\n",
+          m_tx.position.x, m_tx.position.y, m_tx.position.z);
+  fprintf(file, "\t\tsd.SetRadius( float( %.15lf ) );\n", m_radius);
+}
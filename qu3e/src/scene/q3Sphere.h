@@ -0,0 +1,41 @@
+#pragma once
+#include "../math/q3SweptSphere.h"
+#include "q3Shape.h"
+
+struct q3SphereDef {
+  q3Transform m_tx = {}; // The sphere is centered on its position
+  float m_radius = 0.0f;
+  float m_friction = 0.4f;
+  float m_restitution = 0.2f;
+  float m_density = 1.0f;
+  bool m_sensor = false;
+  // Padding of the sphere's fat AABB in the broadphase, as for q3BoxDef
+  float m_aabbMargin = 0.5f;
+  void Dump(FILE *file) const;
+};
+
+class q3Sphere : public q3Shape {
+  q3SphereDef def_;
+
+public:
+  q3Sphere(const q3SphereDef &def);
+  // def
+  float Radius() const { return def_.m_radius; }
+
+  // World center of the sphere on a body at tx
+  q3Vec3 Center(const q3Transform &tx) const { return tx * def_.m_tx.position; }
+  q3SweptSphere World(const q3Transform &tx) const;
+
+  bool TestPoint(const q3Transform &tx, const q3Vec3 &p) const override;
+  // Distance from p to the sphere, zero inside it
+  float Distance(const q3Transform &tx, const q3Vec3 &p) const override;
+  bool Raycast(const q3Transform &tx, q3RaycastData *raycast) const override;
+  // Linear cast of the sweep's box by conservative advancement, see
+  // q3SweptSphere::Sweep
+  bool Sweep(const q3Transform &tx, q3SweepData *sweep) const override;
+  q3AABB ComputeAABB(const q3Transform &tx) const override;
+  std::optional<q3MassData> ComputeMass() const override;
+  void Render(const q3Transform &tx, bool awake,
+              class q3Render *render) const override;
+  void Dump(FILE *file, int index) const override;
+};